@@ -88,6 +88,7 @@ SOURCES += \
         src/pdf/singlerenderer.cpp \
         src/pdf/cachemap.cpp \
         src/pdf/cachethread.cpp \
+        src/pdf/renderprofiler.cpp \
         src/screens/controlscreen.cpp \
         src/screens/presentationscreen.cpp \
         src/slide/previewslide.cpp \
@@ -96,6 +97,15 @@ SOURCES += \
         src/slide/presentationslide.cpp \
         src/draw/pathoverlay.cpp \
         src/draw/drawpath.cpp \
+        src/draw/annotationfile.cpp \
+        src/draw/drawingexport.cpp \
+        src/draw/drawingloader.cpp \
+        src/draw/gzipdevice.cpp \
+        src/draw/inputlatency.cpp \
+        src/draw/journal.cpp \
+        src/draw/layerrenderer.cpp \
+        src/draw/pathindex.cpp \
+        src/draw/strokearena.cpp \
         src/gui/timer.cpp \
         src/gui/pagenumberedit.cpp \
         src/gui/toolbutton.cpp \
@@ -116,6 +126,7 @@ HEADERS += \
         src/pdf/singlerenderer.h \
         src/pdf/cachemap.h \
         src/pdf/cachethread.h \
+        src/pdf/renderprofiler.h \
         src/screens/controlscreen.h \
         src/screens/presentationscreen.h \
         src/slide/previewslide.h \
@@ -124,6 +135,17 @@ HEADERS += \
         src/slide/presentationslide.h \
         src/draw/pathoverlay.h \
         src/draw/drawpath.h \
+        src/draw/annotationfile.h \
+        src/draw/drawingexport.h \
+        src/draw/drawingloader.h \
+        src/draw/gzipdevice.h \
+        src/draw/inputlatency.h \
+        src/draw/journal.h \
+        src/draw/layerrenderer.h \
+        src/draw/pathindex.h \
+        src/draw/segmenthits.h \
+        src/draw/strokearena.h \
+        src/draw/strokeop.h \
         src/gui/timer.h \
         src/gui/pagenumberedit.h \
         src/gui/toolbutton.h \
@@ -146,6 +168,8 @@ FORMS += \
 unix {
     INCLUDEPATH += /usr/include/poppler/qt5
     LIBS += -L /usr/lib/ -lpoppler-qt5
+    # zlib is required for reading and writing compressed drawing files.
+    LIBS += -lz
 }
 macx {
     ## Please configure this according to your poppler installation.
@@ -158,6 +182,8 @@ win32 {
     ## The configuration will probably have the following form:
     #INCLUDEPATH += C:\...\poppler-0.??.?-win??
     #LIBS += -LC:\...\poppler-0.??.?-win?? -lpoppler-qt5
+    ## zlib is also required:
+    #LIBS += -LC:\...\zlib -lz
 }
 
 unix {
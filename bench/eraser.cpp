@@ -0,0 +1,103 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Microbenchmark of the eraser kernel markSegmentHits on a page with 100k nodes.
+// It does not need Qt and is not part of the qmake project. Build and run from the repository root:
+//
+//   g++ -std=c++14 -O2 -o eraser-bench bench/eraser.cpp && ./eraser-bench
+//
+// Optionally pass the number of nodes and the number of eraser segments: ./eraser-bench 100000 2000
+// The throughput is given in million nodes checked per second.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "../src/draw/segmenthits.h"
+
+namespace {
+
+/// Eraser movement between two input events (in points of the page).
+struct EraserSegment {
+    double ax, ay, bx, by;
+};
+
+/// Run the kernel for all eraser segments with coordinates of type T and the given stride.
+/// Print the throughput and return the number of hit segments.
+template <int stride, typename T>
+long run(char const* name, T const* x, T const* y, int const segments, std::vector<EraserSegment> const& erasers, T const radius)
+{
+    std::vector<unsigned char> hits(segments);
+    long number = 0;
+    auto const start = std::chrono::steady_clock::now();
+    for (EraserSegment const& eraser : erasers) {
+        markSegmentHits<stride>(x, y, segments, T(eraser.ax), T(eraser.ay), T(eraser.bx), T(eraser.by), radius, hits.data());
+        for (int i=0; i<segments; i++)
+            number += hits[i];
+    }
+    double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("%-28s %8.1f Mnodes/s  %8.3f ms per eraser event  %ld hits\n",
+                name, double(segments)*erasers.size()/seconds/1e6, 1e3*seconds/erasers.size(), number);
+    return number;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    int const nodes = argc > 1 ? std::atoi(argv[1]) : 100000;
+    int const events = argc > 2 ? std::atoi(argv[2]) : 2000;
+    if (nodes < 2 || events < 1) {
+        std::fprintf(stderr, "usage: %s [nodes >= 2] [eraser events >= 1]\n", argv[0]);
+        return 1;
+    }
+    // Handwriting-like random walk on an A4 page (in points) with steps of about 1 point.
+    std::mt19937 random(42);
+    std::normal_distribution<double> step(0., 1.);
+    std::uniform_real_distribution<double> xpos(0., 595.), ypos(0., 842.);
+    std::vector<double> interleaved(2*size_t(nodes));
+    std::vector<float> fx(nodes), fy(nodes);
+    double x = xpos(random), y = ypos(random);
+    for (int i=0; i<nodes; i++) {
+        x = std::min(std::max(x + step(random), 0.), 595.);
+        y = std::min(std::max(y + step(random), 0.), 842.);
+        interleaved[2*i] = x;
+        interleaved[2*i+1] = y;
+        fx[i] = float(x);
+        fy[i] = float(y);
+    }
+    // Eraser events moving by up to 20 points, with radius 10 points.
+    std::uniform_real_distribution<double> move(-20., 20.);
+    std::vector<EraserSegment> erasers(events);
+    for (EraserSegment& eraser : erasers) {
+        eraser.ax = xpos(random);
+        eraser.ay = ypos(random);
+        eraser.bx = eraser.ax + move(random);
+        eraser.by = eraser.ay + move(random);
+    }
+    std::printf("%d nodes, %d eraser events\n", nodes, events);
+    long const interleavedHits = run<2>("double, interleaved (QPointF)", interleaved.data(), interleaved.data() + 1, nodes - 1, erasers, 10.);
+    long const separateHits = run<1>("float, separate arrays", fx.data(), fy.data(), nodes - 1, erasers, 10.f);
+    // Both variants must find (almost) the same segments. Rounding to float can change hits at the border.
+    if (std::labs(interleavedHits - separateHits) > interleavedHits/1000 + 1) {
+        std::fprintf(stderr, "Results differ: %ld and %ld hits\n", interleavedHits, separateHits);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,356 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cstring>
+#include <climits>
+#include <QtDebug>
+#include <QtEndian>
+#include <QSaveFile>
+
+#include "annotationfile.h"
+
+char const AnnotationFile::magic[8] = {'B', 'P', 'D', 'R', 'A', 'W', '\r', '\n'};
+
+namespace {
+
+/// Tool identifiers in the file. These must not be changed.
+quint32 const filePen = 1;
+quint32 const fileHighlighter = 2;
+/// Added to the tool identifier if the pressure of the nodes is stored.
+quint32 const filePressure = 0x100;
+
+inline qint64 padded(qint64 const size) {return (size + 3) & ~qint64(3);}
+
+inline float readFloat(uchar const* src)
+{
+    quint32 const bits = qFromLittleEndian<quint32>(src);
+    float value;
+    std::memcpy(&value, &bits, sizeof(float));
+    return value;
+}
+
+/// Sequential reader for little endian data. All reads are checked against the end of the data.
+/// After the first read beyond the end, all reads return 0 or nullptr.
+class Reader
+{
+private:
+    uchar const* const data;
+    qint64 const size;
+    qint64 pos;
+    bool valid = true;
+
+public:
+    Reader(uchar const* data, qint64 const size, qint64 const pos = 0) : data(data), size(size), pos(pos) {}
+    bool ok() const {return valid;}
+    /// Return a pointer to the next bytes and move behind them.
+    uchar const* skip(qint64 const bytes)
+    {
+        if (!valid || bytes < 0 || bytes > size - pos) {
+            valid = false;
+            return nullptr;
+        }
+        uchar const* const ptr = data + pos;
+        pos += bytes;
+        return ptr;
+    }
+    quint32 u32() {uchar const* const ptr = skip(4); return ptr == nullptr ? 0 : qFromLittleEndian<quint32>(ptr);}
+    quint64 u64() {uchar const* const ptr = skip(8); return ptr == nullptr ? 0 : qFromLittleEndian<quint64>(ptr);}
+    QString const string()
+    {
+        quint32 const length = u32();
+        uchar const* const ptr = skip(padded(length));
+        return ptr == nullptr ? QString() : QString::fromUtf8(reinterpret_cast<char const*>(ptr), int(length));
+    }
+};
+
+/// Little endian output buffer.
+class Writer
+{
+public:
+    QByteArray data;
+
+    void u32(quint32 const value)
+    {
+        uchar bytes[4];
+        qToLittleEndian<quint32>(value, bytes);
+        data.append(reinterpret_cast<char const*>(bytes), 4);
+    }
+    void u64(quint64 const value)
+    {
+        uchar bytes[8];
+        qToLittleEndian<quint64>(value, bytes);
+        data.append(reinterpret_cast<char const*>(bytes), 8);
+    }
+    void f32(float const value)
+    {
+        quint32 bits;
+        std::memcpy(&bits, &value, sizeof(float));
+        u32(bits);
+    }
+    void floats(float const* values, int const number)
+    {
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+        data.append(reinterpret_cast<char const*>(values), 4*number);
+#else
+        for (int i=0; i<number; i++)
+            f32(values[i]);
+#endif
+    }
+    /// Write bytes padded to a multiple of 4 bytes.
+    void bytes(quint8 const* values, int const number)
+    {
+        data.append(reinterpret_cast<char const*>(values), number);
+        data.append(int(padded(number) - number), '\0');
+    }
+    void string(QString const& string)
+    {
+        QByteArray const utf8 = string.toUtf8();
+        u32(quint32(utf8.size()));
+        data.append(utf8);
+        data.append(int(padded(utf8.size()) - utf8.size()), '\0');
+    }
+    void document(AnnotationFile::Document const& document)
+    {
+        string(document.file);
+        string(document.modified);
+        u32(document.pages);
+    }
+};
+
+}
+
+AnnotationFile::AnnotationFile(QString const& filename) :
+    file(filename)
+{
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCritical() << "Loading file failed: file is not readable.";
+        return;
+    }
+    size = file.size();
+    data = file.map(0, size);
+    if (data == nullptr) {
+        // Mapping is not possible on all file systems.
+        buffer = file.readAll();
+        data = reinterpret_cast<uchar const*>(buffer.constData());
+        size = buffer.size();
+    }
+    // The mapping stays valid after closing the file.
+    file.close();
+    if (!readHeader()) {
+        qCritical() << "Loading file failed: file is damaged or has an unknown format.";
+        data = nullptr;
+        index.clear();
+    }
+}
+
+AnnotationFile::~AnnotationFile()
+{
+    if (buffer.isEmpty() && data != nullptr)
+        file.unmap(const_cast<uchar*>(data));
+}
+
+bool AnnotationFile::isAnnotationFile(QString const& filename)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray const start = file.read(8);
+    file.close();
+    return start.size() == 8 && std::memcmp(start.constData(), magic, 8) == 0;
+}
+
+bool AnnotationFile::readHeader()
+{
+    // header (at least 16 bytes), index (at least 4 bytes), trailer (16 bytes)
+    if (data == nullptr || size < 36 || std::memcmp(data, magic, 8) != 0 || std::memcmp(data + size - 8, magic, 8) != 0)
+        return false;
+    Reader header(data, size - 16, 8);
+    quint32 const fileVersion = header.u32();
+    if (fileVersion > version) {
+        qCritical() << "This drawing file was written by a newer version of BeamerPresenter.";
+        return false;
+    }
+    generation = header.u32();
+    presentation.file = header.string();
+    presentation.modified = header.string();
+    presentation.pages = header.u32();
+    notes.file = header.string();
+    notes.modified = header.string();
+    notes.pages = header.u32();
+    if (!header.ok())
+        return false;
+
+    quint64 const indexOffset = qFromLittleEndian<quint64>(data + size - 16);
+    if (indexOffset > quint64(size - 16))
+        return false;
+    Reader reader(data, size - 16, qint64(indexOffset));
+    quint32 const number = reader.u32();
+    for (quint32 i=0; i<number && reader.ok(); i++) {
+        Chunk chunk;
+        chunk.offset = reader.u64();
+        chunk.size = reader.u64();
+        QString const label = reader.string();
+        // Chunks must lie between header and index.
+        if (chunk.offset > indexOffset || chunk.size > indexOffset - chunk.offset)
+            return false;
+        // Nodes are read as floats directly from the mapped file, which requires aligned chunks.
+        // pageData copies a chunk to a QByteArray, which is limited to INT_MAX bytes.
+        if (chunk.offset % 4 != 0 || chunk.size > quint64(INT_MAX))
+            return false;
+        index.insert(label, chunk);
+    }
+    return reader.ok();
+}
+
+QList<DrawPath*> const AnnotationFile::readPage(QString const& label, QSharedPointer<StrokeArena> const& arena) const
+{
+    QList<DrawPath*> list;
+    QMap<QString, Chunk>::const_iterator const chunk = index.constFind(label);
+    if (data == nullptr || chunk == index.cend())
+        return list;
+    Reader reader(data + chunk->offset, qint64(chunk->size));
+    quint32 const number = reader.u32();
+    uchar const* const records = reader.skip(16*qint64(number));
+    if (records == nullptr) {
+        qWarning() << "Drawing file contains damaged page" << label;
+        return list;
+    }
+    list.reserve(int(number));
+    for (quint32 i=0; i<number; i++) {
+        uchar const* const record = records + 16*i;
+        quint32 const toolId = qFromLittleEndian<quint32>(record);
+        QRgb const color = qFromLittleEndian<quint32>(record + 4);
+        float const width = readFloat(record + 8);
+        quint32 const nodes = qFromLittleEndian<quint32>(record + 12);
+        uchar const* const x = reader.skip(4*qint64(nodes));
+        uchar const* const y = reader.skip(4*qint64(nodes));
+        uchar const* const pressure = toolId & filePressure ? reader.skip(padded(nodes)) : nullptr;
+        if (!reader.ok()) {
+            qWarning() << "Drawing file contains damaged page" << label;
+            break;
+        }
+        quint32 const toolType = toolId & ~filePressure;
+        DrawTool const tool = toolType == filePen ? Pen : toolType == fileHighlighter ? Highlighter : NoTool;
+        if (tool == NoTool || nodes == 0)
+            continue;
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+        // Chunks are aligned to 4 bytes: the coordinates can be copied directly from the mapped file.
+        int const start = arena->append(reinterpret_cast<float const*>(x), reinterpret_cast<float const*>(y), int(nodes), pressure);
+#else
+        QVector<float> xs(int(nodes)), ys(int(nodes));
+        for (int j=0; j<int(nodes); j++) {
+            xs[j] = readFloat(x + 4*j);
+            ys[j] = readFloat(y + 4*j);
+        }
+        int const start = arena->append(xs.constData(), ys.constData(), int(nodes), pressure);
+#endif
+        FullDrawTool const* const record_tool = StrokeArena::toolRecord({tool, QColor::fromRgba(color), width, {0.}});
+        list.append(new DrawPath(arena, record_tool, start, int(nodes)));
+    }
+    return list;
+}
+
+QByteArray const AnnotationFile::pageData(QString const& label) const
+{
+    QMap<QString, Chunk>::const_iterator const chunk = index.constFind(label);
+    if (data == nullptr || chunk == index.cend())
+        return QByteArray();
+    return QByteArray(reinterpret_cast<char const*>(data + chunk->offset), int(chunk->size));
+}
+
+bool AnnotationFile::write(QString const& filename, Document const& presentation, Document const& notes, QMap<QString, QList<DrawPath*>> const& paths)
+{
+    return writeData(filename, serialize(presentation, notes, paths));
+}
+
+QByteArray const AnnotationFile::serialize(Document const& presentation, Document const& notes, QMap<QString, QList<DrawPath*>> const& paths, quint32 const generation, QMap<QString, QByteArray> const& rawPages)
+{
+    Writer writer;
+    writer.data.append(magic, 8);
+    writer.u32(version);
+    writer.u32(generation);
+    writer.document(presentation);
+    writer.document(notes);
+
+    QMap<QString, Chunk> chunks;
+    for (QMap<QString, QList<DrawPath*>>::const_iterator page_it=paths.cbegin(); page_it!=paths.cend(); page_it++) {
+        QList<DrawPath const*> strokes;
+        for (QList<DrawPath*>::const_iterator path_it=page_it->cbegin(); path_it!=page_it->cend(); path_it++) {
+            DrawTool const tool = (*path_it)->getTool().tool;
+            if ((tool == Pen || tool == Highlighter) && !(*path_it)->isEmpty())
+                strokes.append(*path_it);
+        }
+        if (strokes.isEmpty())
+            continue;
+        Chunk chunk;
+        chunk.offset = quint64(writer.data.size());
+        writer.u32(quint32(strokes.length()));
+        for (QList<DrawPath const*>::const_iterator path_it=strokes.cbegin(); path_it!=strokes.cend(); path_it++) {
+            FullDrawTool const& tool = (*path_it)->getTool();
+            writer.u32((tool.tool == Pen ? filePen : fileHighlighter) | ((*path_it)->hasPressure() ? filePressure : 0));
+            writer.u32(tool.color.rgba());
+            writer.f32(float(tool.size));
+            writer.u32(quint32((*path_it)->number()));
+        }
+        for (QList<DrawPath const*>::const_iterator path_it=strokes.cbegin(); path_it!=strokes.cend(); path_it++) {
+            writer.floats((*path_it)->x(), (*path_it)->number());
+            writer.floats((*path_it)->y(), (*path_it)->number());
+            if ((*path_it)->hasPressure())
+                writer.bytes((*path_it)->pressure(), (*path_it)->number());
+        }
+        chunk.size = quint64(writer.data.size()) - chunk.offset;
+        chunks.insert(page_it.key(), chunk);
+    }
+    // Chunks are self-contained. They can be copied directly, only the alignment must be kept.
+    for (QMap<QString, QByteArray>::const_iterator page_it=rawPages.cbegin(); page_it!=rawPages.cend(); page_it++) {
+        if (page_it->isEmpty() || chunks.contains(page_it.key()))
+            continue;
+        Chunk chunk;
+        chunk.offset = quint64(writer.data.size());
+        chunk.size = quint64(page_it->size());
+        writer.data.append(*page_it);
+        writer.data.append(int(padded(page_it->size()) - page_it->size()), '\0');
+        chunks.insert(page_it.key(), chunk);
+    }
+
+    quint64 const indexOffset = quint64(writer.data.size());
+    writer.u32(quint32(chunks.size()));
+    for (QMap<QString, Chunk>::const_iterator chunk_it=chunks.cbegin(); chunk_it!=chunks.cend(); chunk_it++) {
+        writer.u64(chunk_it->offset);
+        writer.u64(chunk_it->size);
+        writer.string(chunk_it.key());
+    }
+    writer.u64(indexOffset);
+    writer.data.append(magic, 8);
+    return writer.data;
+}
+
+bool AnnotationFile::writeData(QString const& filename, QByteArray const& data)
+{
+    // The old file is only replaced if the new file was written completely.
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCritical() << "Saving file failed: file is not writable.";
+        return false;
+    }
+    file.write(data);
+    if (!file.commit()) {
+        qCritical() << "Saving file failed:" << file.errorString();
+        return false;
+    }
+    return true;
+}
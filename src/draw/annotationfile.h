@@ -0,0 +1,117 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ANNOTATIONFILE_H
+#define ANNOTATIONFILE_H
+
+#include <QFile>
+#include <QMap>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QSharedPointer>
+#include "drawpath.h"
+
+/// Binary BeamerPresenter drawing file.
+///
+/// All numbers are little endian. Every block starts at a multiple of 4 bytes.
+/// Strings are stored as quint32 length followed by UTF-8 bytes, padded to a multiple of 4 bytes.
+///   header:  magic (8 bytes), quint32 version, quint32 journal generation (0 if no journal is used),
+///            presentation and notes: string file, string modified, quint32 pages
+///   pages:   one chunk per page: quint32 number of paths,
+///            for each path: quint32 tool, quint32 color (ARGB), float width, quint32 number of nodes,
+///            then for each path: float x[nodes], float y[nodes],
+///            and if the tool has the pressure flag: quint8 pressure[nodes] padded to a multiple of 4 bytes
+///   index:   quint32 number of pages, for each page: quint64 offset, quint64 size, string label
+///   trailer: quint64 offset of index, magic (8 bytes)
+///
+/// The file is mapped to memory and only the header and index are read when it is opened.
+/// The node arrays of a page can be copied directly to a StrokeArena.
+/// The object is not changed after it has been opened, such that pages can be read in several threads.
+class AnnotationFile
+{
+public:
+    /// PDF document for which the drawings were saved.
+    struct Document {
+        /// Absolute file path.
+        QString file;
+        /// Modification time in the format yyyy-MM-dd hh:mm:ss.
+        QString modified;
+        quint32 pages = 0;
+    };
+
+    /// First and last 8 bytes of every binary drawing file.
+    static char const magic[8];
+    /// Version written by this program. Files with a higher version are rejected.
+    /// Version 2 added the pressure of the nodes.
+    static quint32 const version = 2;
+
+    /// Open file and read its header and index.
+    explicit AnnotationFile(QString const& filename);
+    ~AnnotationFile();
+
+    /// Check whether the file starts with the magic bytes of this format.
+    static bool isAnnotationFile(QString const& filename);
+    /// Write all paths to filename. Return false if the file could not be written.
+    static bool write(QString const& filename, Document const& presentation, Document const& notes, QMap<QString, QList<DrawPath*>> const& paths);
+    /// Return the content of a file containing all paths.
+    /// generation identifies the state of a Journal which is included in the file.
+    /// rawPages are pages copied from another file (see pageData) for labels which are not contained in paths.
+    static QByteArray const serialize(Document const& presentation, Document const& notes, QMap<QString, QList<DrawPath*>> const& paths, quint32 const generation = 0, QMap<QString, QByteArray> const& rawPages = QMap<QString, QByteArray>());
+    /// Write data to filename such that the old file is only replaced if data were written completely.
+    static bool writeData(QString const& filename, QByteArray const& data);
+
+    /// Were the header and index read successfully?
+    bool isValid() const {return data != nullptr;}
+    Document const& getPresentation() const {return presentation;}
+    Document const& getNotes() const {return notes;}
+    quint32 getGeneration() const {return generation;}
+    /// Labels of all pages in the file.
+    QStringList const pages() const {return index.keys();}
+    bool contains(QString const& label) const {return index.contains(label);}
+    bool isEmpty() const {return index.isEmpty();}
+    /// Read the paths of a page and append their nodes to arena.
+    /// Return an empty list if the page is not contained or damaged.
+    QList<DrawPath*> const readPage(QString const& label, QSharedPointer<StrokeArena> const& arena) const;
+    /// Return a copy of the chunk of a page without reading its paths, or an empty array if the page is not contained.
+    /// The chunk can be written to another file by serialize.
+    QByteArray const pageData(QString const& label) const;
+
+private:
+    /// Position of a page chunk in the file.
+    struct Chunk {
+        quint64 offset;
+        quint64 size;
+    };
+    QFile file;
+    /// Content of the file, either mapped to memory or pointing to buffer.
+    uchar const* data = nullptr;
+    qint64 size = 0;
+    /// Content of the file if it cannot be mapped to memory.
+    QByteArray buffer;
+    Document presentation;
+    Document notes;
+    quint32 generation = 0;
+    QMap<QString, Chunk> index;
+
+    /// Read header and index. Return false if the file is damaged.
+    bool readHeader();
+};
+
+#endif // ANNOTATIONFILE_H
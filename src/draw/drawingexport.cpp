@@ -0,0 +1,251 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <QHash>
+#include <QXmlStreamWriter>
+#ifdef DEBUG_DRAWING
+#include <QtDebug>
+#include <QElapsedTimer>
+#endif
+
+#include "drawingexport.h"
+#include "gzipdevice.h"
+#include "../names.h"
+
+namespace {
+
+/// Share of the progress (in percent) used for serializing the drawings. The rest is used for compressing and writing.
+int const serializeProgress = 80;
+
+}
+
+DrawingExport::DrawingExport(Format const format, QString const& filename, bool const compress, QObject* parent) :
+    QThread(parent),
+    format(format),
+    filename(filename),
+    compress(compress)
+{
+}
+
+DrawingExport::~DrawingExport()
+{
+    wait();
+    for (QMap<QString, QList<DrawPath*>>::iterator page_it=paths.begin(); page_it!=paths.end(); page_it++)
+        qDeleteAll(*page_it);
+}
+
+void DrawingExport::setPaths(QMap<QString, QList<DrawPath*>> const& source)
+{
+    paths = snapshot(source);
+}
+
+QMap<QString, QList<DrawPath*>> const DrawingExport::snapshot(QMap<QString, QList<DrawPath*>> const& source)
+{
+    QMap<QString, QList<DrawPath*>> copies;
+    // Every arena is copied once. The copies share the nodes with the original arenas.
+    QHash<StrokeArena const*, QSharedPointer<StrokeArena>> arenas;
+    for (QMap<QString, QList<DrawPath*>>::const_iterator page_it=source.cbegin(); page_it!=source.cend(); page_it++) {
+        QList<DrawPath*>& list = copies[page_it.key()];
+        list.reserve(page_it->length());
+        for (QList<DrawPath*>::const_iterator path_it=page_it->cbegin(); path_it!=page_it->cend(); path_it++) {
+            QSharedPointer<StrokeArena>& arena = arenas[(*path_it)->getArena().data()];
+            if (arena.isNull())
+                arena = QSharedPointer<StrokeArena>(new StrokeArena(*(*path_it)->getArena()));
+            list.append(new DrawPath(**path_it, arena));
+        }
+    }
+    return copies;
+}
+
+void DrawingExport::setUnreadPages(QSharedPointer<AnnotationFile> const& file, QStringList const& labels)
+{
+    unreadFile = file;
+    unreadLabels = labels;
+}
+
+void DrawingExport::readUnreadPages(bool const raw, QMap<QString, QByteArray>& rawPages)
+{
+    for (QStringList::const_iterator label_it=unreadLabels.cbegin(); label_it!=unreadLabels.cend(); label_it++) {
+        QMap<QString, QList<DrawPath*>>::iterator const page_it = paths.find(*label_it);
+        if (raw && (page_it == paths.end() || page_it->isEmpty())) {
+            rawPages.insert(*label_it, unreadFile->pageData(*label_it));
+            continue;
+        }
+        // Every page gets its own arena, which is only used by this thread.
+        QList<DrawPath*> const list = unreadFile->readPage(*label_it, QSharedPointer<StrokeArena>(new StrokeArena()));
+        if (page_it != paths.end())
+            *page_it = list + *page_it;
+        else if (!list.isEmpty())
+            paths.insert(*label_it, list);
+    }
+}
+
+void DrawingExport::setDocuments(AnnotationFile::Document const& presentationDocument, AnnotationFile::Document const& notesDocument)
+{
+    presentation = presentationDocument;
+    notes = notesDocument;
+}
+
+void DrawingExport::reportProgress(int const percent)
+{
+    if (percent != reported) {
+        reported = percent;
+        emit progress(filename, percent);
+    }
+}
+
+void DrawingExport::run()
+{
+#ifdef DEBUG_DRAWING
+    QElapsedTimer timer;
+    timer.start();
+#endif
+    reportProgress(0);
+    QMap<QString, QByteArray> rawPages;
+    if (!unreadFile.isNull())
+        readUnreadPages(format == Binary, rawPages);
+    QByteArray data;
+    switch (format)
+    {
+    case Binary:
+        data = AnnotationFile::serialize(presentation, notes, paths, 0, rawPages);
+        break;
+    case XML:
+        data = writeXML();
+        break;
+    case Xournal:
+        data = writeXournal();
+        break;
+    }
+    reportProgress(serializeProgress);
+    // Compressed files are written in gzip format. They can be uncompressed using gunzip.
+    if (compress && format != Binary)
+        data = GzipDevice::compress(data);
+    bool const success = !data.isEmpty() && AnnotationFile::writeData(filename, data);
+    reportProgress(100);
+#ifdef DEBUG_DRAWING
+    qDebug() << "Saved drawings to" << filename << "in" << timer.nsecsElapsed()/1000 << "us";
+#endif
+    emit exportFinished(filename, success);
+}
+
+QByteArray const DrawingExport::writeXML()
+{
+    QByteArray data;
+    QXmlStreamWriter writer(&data);
+    writer.setAutoFormatting(true);
+    writer.writeStartDocument();
+    writer.writeDTD("<!DOCTYPE BeamerPresenter>");
+    writer.writeStartElement("BeamerPresenter");
+    writer.writeAttribute("creator", "BeamerPresenter");
+    writer.writeAttribute("version", APP_VERSION);
+
+    writer.writeEmptyElement("presentation");
+    writer.writeAttribute("file", presentation.file);
+    writer.writeAttribute("pages", QString::number(presentation.pages));
+    writer.writeAttribute("modified", presentation.modified);
+
+    writer.writeEmptyElement("notes");
+    writer.writeAttribute("file", notes.file);
+    writer.writeAttribute("pages", QString::number(notes.pages));
+    writer.writeAttribute("modified", notes.modified);
+
+    // Buffer for the coordinates, reused for all strokes.
+    QString text;
+    int page = 0;
+    for (QMap<QString, QList<DrawPath*>>::const_iterator page_it=paths.cbegin(); page_it!=paths.cend(); page_it++, page++) {
+        writer.writeStartElement("page");
+        writer.writeAttribute("label", page_it.key());
+        for (QList<DrawPath*>::const_iterator path_it=page_it->cbegin(); path_it!=page_it->cend(); path_it++) {
+            writer.writeStartElement("stroke");
+            FullDrawTool const& tool = (*path_it)->getTool();
+            writer.writeAttribute("tool", toolNames.value(tool.tool, "unkown"));
+            // Colors are saved in #AARRGGBB format.
+            writer.writeAttribute("color", tool.color.name(QColor::HexArgb));
+            // Stroke width is saved in points.
+            writer.writeAttribute("width", QString::number(tool.size));
+            // The pressure of each node is saved as number between 0 and 1, by which the width is multiplied.
+            if ((*path_it)->hasPressure()) {
+                text.resize(0);
+                (*path_it)->pressureToText(text);
+                writer.writeAttribute("pressure", text);
+            }
+            // Save data as list of x and y coordinates (alternating) in points.
+            text.resize(0);
+            (*path_it)->toText(text);
+            writer.writeCharacters(text);
+            writer.writeEndElement();
+        }
+        writer.writeEndElement();
+        reportProgress(serializeProgress * page / paths.size());
+    }
+    writer.writeEndDocument();
+    return data;
+}
+
+QByteArray const DrawingExport::writeXournal()
+{
+    QByteArray data;
+    QXmlStreamWriter writer(&data);
+    writer.setAutoFormatting(true);
+    writer.writeStartDocument();
+    writer.writeStartElement("xournal");
+    writer.writeAttribute("creator", "BeamerPresenter " APP_VERSION);
+    writer.writeTextElement("title", "Xournal++ readable XML file created by BeamerPresenter");
+
+    QString text;
+    for (int i=0; i<pages.length(); i++) {
+        writer.writeStartElement("page");
+        writer.writeAttribute("width", QString::number(pages[i].second.width()));
+        writer.writeAttribute("height", QString::number(pages[i].second.height()));
+
+        writer.writeEmptyElement("background");
+        writer.writeAttribute("type", "pdf");
+        writer.writeAttribute("domain", "absolute");
+        writer.writeAttribute("filename", presentation.file);
+        writer.writeAttribute("pageno", QString::number(i+1) + "ll");
+
+        writer.writeStartElement("layer");
+        QList<DrawPath*> const& pathlist = paths.value(pages[i].first);
+        for (QList<DrawPath*>::const_iterator path_it=pathlist.cbegin(); path_it!=pathlist.cend(); path_it++) {
+            writer.writeStartElement("stroke");
+            FullDrawTool const& tool = (*path_it)->getTool();
+            writer.writeAttribute("tool", toolNames.value(tool.tool, "pen"));
+            // Colors are saved by xournal in the format #RRGGBBAA, but Qt uses #AARRGGBB.
+            // Convert between the two formats.
+            QString colorstr = tool.color.name(QColor::HexArgb);
+            colorstr.append(colorstr.mid(1, 2));
+            colorstr.remove(1, 2);
+            writer.writeAttribute("color", colorstr);
+            // Stroke width is saved in points. Strokes with pressure have the width of each segment appended.
+            text = QString::number(tool.size);
+            if ((*path_it)->hasPressure())
+                (*path_it)->pressureToText(text, tool.size, true);
+            writer.writeAttribute("width", text);
+            // Save data as list of x and y coordinates (alternating) in points.
+            text.resize(0);
+            (*path_it)->toText(text);
+            writer.writeCharacters(text);
+            writer.writeEndElement();
+        }
+        writer.writeEndElement();
+        writer.writeEndElement();
+        reportProgress(serializeProgress * i / pages.length());
+    }
+    writer.writeEndDocument();
+    return data;
+}
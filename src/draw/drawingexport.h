@@ -0,0 +1,111 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DRAWINGEXPORT_H
+#define DRAWINGEXPORT_H
+
+#include <QThread>
+#include <QMap>
+#include <QList>
+#include <QVector>
+#include <QPair>
+#include <QSizeF>
+#include <QSharedPointer>
+#include <QStringList>
+#include "drawpath.h"
+#include "annotationfile.h"
+
+/// Thread writing a snapshot of the drawings to a file.
+/// The snapshot is taken in the GUI thread when the paths are set. It copies the paths, but
+/// not their nodes: the arenas are implicitly shared and nodes are only copied if the
+/// paths are changed while the file is written.
+class DrawingExport : public QThread
+{
+    Q_OBJECT
+
+public:
+    enum Format {
+        /// Binary BeamerPresenter drawing file (see AnnotationFile).
+        Binary,
+        /// BeamerPresenter XML file.
+        XML,
+        /// XML file which should be readable for Xournal(++).
+        Xournal,
+    };
+
+    /// Create an export to filename. XML and Xournal files are written in gzip format if compress is true.
+    DrawingExport(Format const format, QString const& filename, bool const compress, QObject* parent = nullptr);
+    /// Wait until the file is written.
+    ~DrawingExport();
+
+    /// Return copies of the paths referencing copies of their arenas, which share the nodes with the originals.
+    /// The copies can be used in another thread. The caller must delete them.
+    static QMap<QString, QList<DrawPath*>> const snapshot(QMap<QString, QList<DrawPath*>> const& paths);
+
+    // The following functions must be called before the thread is started.
+    /// Take a snapshot of paths.
+    void setPaths(QMap<QString, QList<DrawPath*>> const& paths);
+    /// Set pages of an opened binary drawing file which have not been read yet. They are read
+    /// in the thread, or copied without reading them if the format is Binary.
+    /// Paths in the snapshot of such a page are placed on top of the paths from the file.
+    void setUnreadPages(QSharedPointer<AnnotationFile> const& file, QStringList const& labels);
+    /// Set the PDF documents for which the drawings are saved.
+    void setDocuments(AnnotationFile::Document const& presentation, AnnotationFile::Document const& notes);
+    /// Append a page of the presentation with given label and size (required for Xournal).
+    void addPage(QString const& label, QSizeF const& size) {pages.append(qMakePair(label, size));}
+
+    QString const& getFilename() const {return filename;}
+
+protected:
+    /// Serialize and compress the snapshot and write it to the file.
+    void run() override;
+
+private:
+    Format const format;
+    QString const filename;
+    bool const compress;
+    /// Copies of the paths referencing copies of the arenas.
+    QMap<QString, QList<DrawPath*>> paths;
+    /// Opened binary drawing file and labels of its pages which are not contained in paths yet.
+    QSharedPointer<AnnotationFile> unreadFile;
+    QStringList unreadLabels;
+    AnnotationFile::Document presentation;
+    AnnotationFile::Document notes;
+    /// Labels and sizes of all pages of the presentation.
+    QVector<QPair<QString, QSizeF>> pages;
+    /// Last reported progress in percent.
+    int reported = -1;
+
+    /// Read the unread pages which are needed in addition to paths.
+    /// Pages without paths in the snapshot are returned as chunks if raw is true.
+    void readUnreadPages(bool const raw, QMap<QString, QByteArray>& rawPages);
+    /// Return BeamerPresenter XML file content.
+    QByteArray const writeXML();
+    /// Return Xournal(++) XML file content.
+    QByteArray const writeXournal();
+    /// Emit progress if it has changed.
+    void reportProgress(int const percent);
+
+signals:
+    /// Progress of writing filename in percent.
+    void progress(QString const filename, int const percent);
+    /// Writing filename has finished. success is false if the file could not be written.
+    void exportFinished(QString const filename, bool const success);
+};
+
+#endif // DRAWINGEXPORT_H
@@ -0,0 +1,322 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <QtDebug>
+#include <QRunnable>
+#include <QRegExp>
+#ifdef DEBUG_DRAWING
+#include <QElapsedTimer>
+#endif
+
+#include "drawingloader.h"
+#include "gzipdevice.h"
+#include "../names.h"
+
+class DrawingLoader::ParseTask : public QRunnable
+{
+private:
+    DrawingLoader* const loader;
+    Part* const part;
+    QString const label;
+    QVector<Stroke> const strokes;
+    bool const xournal;
+
+public:
+    ParseTask(DrawingLoader* loader, Part* part, QString const& label, QVector<Stroke> const& strokes, bool const xournal) :
+        loader(loader), part(part), label(label), strokes(strokes), xournal(xournal) {}
+
+    void run() override
+    {
+        // The part is only accessed by this task until it is marked as done.
+        part->arena = QSharedPointer<StrokeArena>(new StrokeArena());
+        for (QVector<Stroke>::const_iterator stroke_it=strokes.cbegin(); stroke_it!=strokes.cend(); stroke_it++) {
+            DrawPath* const path = parseStroke(*stroke_it, part->arena, xournal);
+            if (path != nullptr)
+                part->paths.append(path);
+        }
+        loader->mutex.lock();
+        part->done = true;
+        loader->condition.wakeAll();
+        loader->mutex.unlock();
+        // The signal is queued to the GUI thread.
+        emit loader->pageParsed(label);
+    }
+};
+
+DrawingLoader::DrawingLoader(QString const& filename, QStringList const& labels, AnnotationFile::Document const& presentation, AnnotationFile::Document const& notes, QObject* parent) :
+    QThread(parent),
+    filename(filename),
+    labels(labels),
+    presentation(presentation),
+    notes(notes)
+{
+}
+
+DrawingLoader::~DrawingLoader()
+{
+    mutex.lock();
+    stopping = true;
+    mutex.unlock();
+    wait();
+    pool.waitForDone();
+    for (QMap<QString, QVector<Part*>>::const_iterator page_it=pages.cbegin(); page_it!=pages.cend(); page_it++) {
+        for (QVector<Part*>::const_iterator part_it=page_it->cbegin(); part_it!=page_it->cend(); part_it++) {
+            qDeleteAll((*part_it)->paths);
+            delete *part_it;
+        }
+    }
+}
+
+void DrawingLoader::run()
+{
+#ifdef DEBUG_DRAWING
+    QElapsedTimer timer;
+    timer.start();
+#endif
+    // The file is read as stream and decompressed on the fly.
+    GzipDevice file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+        qCritical() << "Loading file failed: file is not readable.";
+    else {
+        QXmlStreamReader reader(&file);
+        if (!reader.readNextStartElement())
+            qWarning() << "Could not understand file:" << reader.errorString();
+        else {
+            QString const creator = reader.attributes().value("creator").toString();
+            if (creator.contains("beamerpresenter", Qt::CaseInsensitive))
+                readBeamerPresenter(reader);
+            else if (creator.contains("xournal", Qt::CaseInsensitive))
+                readXournal(reader);
+            else
+                qWarning() << "Could not understand file: Unknown creator" << creator;
+            if (reader.hasError())
+                qWarning() << "Error in line" << reader.lineNumber() << "of drawing file:" << reader.errorString();
+        }
+    }
+    QMutexLocker locker(&mutex);
+    finished = true;
+    condition.wakeAll();
+#ifdef DEBUG_DRAWING
+    qDebug() << "Read drawing file" << filename << "in" << timer.nsecsElapsed()/1000 << "us";
+#endif
+}
+
+void DrawingLoader::readBeamerPresenter(QXmlStreamReader& reader)
+{
+    while (reader.readNextStartElement()) {
+        if (reader.name() == "presentation" || reader.name() == "notes") {
+            // Check whether the PDF file is as expected and warn otherwise.
+            bool const isPresentation = reader.name() == "presentation";
+            AnnotationFile::Document const& document = isPresentation ? presentation : notes;
+            QXmlStreamAttributes const attributes = reader.attributes();
+            if (attributes.value("file") != document.file)
+                qWarning() << "This drawing file was generated for a different PDF file path.";
+            if (attributes.value("modified") != document.modified)
+                qWarning() << (isPresentation ? "The presentation file" : "The notes file") << "has been modified since writing the drawing file.";
+            if (attributes.value("pages").toUInt() != document.pages)
+                qWarning() << "The numbers of pages in the" << (isPresentation ? "presentation" : "notes") << "and drawing file do not match!";
+            reader.skipCurrentElement();
+        }
+        else if (reader.name() == "page") {
+            QString const label = reader.attributes().value("label").toString();
+            QVector<Stroke> strokes;
+            while (reader.readNextStartElement()) {
+                if (reader.name() == "stroke")
+                    strokes.append(readStroke(reader, false));
+                else
+                    reader.skipCurrentElement();
+            }
+            addPart(label, strokes, false);
+        }
+        else
+            reader.skipCurrentElement();
+        QMutexLocker locker(&mutex);
+        if (stopping)
+            return;
+    }
+}
+
+void DrawingLoader::readXournal(QXmlStreamReader& reader)
+{
+    // Strokes from Xournal or Xournal++ files are added to the existing paths.
+    mutex.lock();
+    replace = false;
+    mutex.unlock();
+    bool checkedFilename = false;
+    while (reader.readNextStartElement()) {
+        if (reader.name() != "page") {
+            reader.skipCurrentElement();
+            continue;
+        }
+        // Each page contains a background element which defines the PDF page, followed by layers.
+        QString label;
+        QVector<Stroke> strokes;
+        while (reader.readNextStartElement()) {
+            if (reader.name() == "background") {
+                QXmlStreamAttributes const attributes = reader.attributes();
+                if (!checkedFilename && attributes.hasAttribute("filename")) {
+                    // Compare the file name to the presentation file.
+                    checkedFilename = true;
+                    if (attributes.value("filename") != presentation.file)
+                        qWarning() << "This Xournal(++) file uses a different PDF file path.";
+                }
+                bool ok;
+                int const pageno = attributes.value("pageno").toString().remove(QRegExp("[a-z]")).toInt(&ok) - 1;
+                if (ok && !labels.isEmpty())
+                    label = labels.value(pageno, pageno < 0 ? labels.first() : labels.last());
+                reader.skipCurrentElement();
+            }
+            else if (reader.name() == "layer" && !label.isNull()) {
+                // TODO: handle text.
+                while (reader.readNextStartElement()) {
+                    if (reader.name() == "stroke")
+                        strokes.append(readStroke(reader, true));
+                    else
+                        reader.skipCurrentElement();
+                }
+            }
+            else
+                reader.skipCurrentElement();
+        }
+        if (!strokes.isEmpty())
+            addPart(label, strokes, true);
+        QMutexLocker locker(&mutex);
+        if (stopping)
+            return;
+    }
+}
+
+DrawingLoader::Stroke const DrawingLoader::readStroke(QXmlStreamReader& reader, bool const xournal)
+{
+    QXmlStreamAttributes const attributes = reader.attributes();
+    Stroke stroke;
+    // This requires that tool names are compatible with those used by Xournal(++).
+    // But since the only stroke tools are "pen" and "highlighter", this is not a problem.
+    stroke.tool = toolNames.key(attributes.value("tool").toString(), NoTool);
+    stroke.color = attributes.value("color").toString();
+    // Colors are saved by xournal in the format #RRGGBBAA, but Qt uses #AARRGGBB.
+    // Try to convert between the two formats.
+    if (xournal && stroke.color.size() == 9 && stroke.color[0] == '#') {
+        stroke.color.insert(1, stroke.color.mid(7));
+        stroke.color.truncate(9);
+    }
+    stroke.width = attributes.value("width").toString();
+    if (!xournal)
+        stroke.pressure = attributes.value("pressure").toString();
+    // The text is read as one string. Coordinates are parsed from it by the parsing task.
+    stroke.text = reader.readElementText(QXmlStreamReader::SkipChildElements);
+    return stroke;
+}
+
+DrawPath* DrawingLoader::parseStroke(Stroke const& stroke, QSharedPointer<StrokeArena> const& arena, bool const xournal)
+{
+    if (stroke.tool == NoTool)
+        return nullptr;
+    // Xournal(++) saves a list of widths for strokes drawn with pressure:
+    // the stroke width followed by the width of each segment.
+    int const separator = stroke.width.indexOf(' ');
+    bool ok;
+    qreal size = stroke.width.leftRef(separator).toDouble(&ok);
+    if (!ok)
+        size = defaultToolConfig[stroke.tool].size;
+    QString const pressure = xournal ? (separator < 0 ? QString() : stroke.width.mid(separator)) : stroke.pressure;
+    // Node i gets the width of segment i in Xournal files.
+    DrawPath* const path = new DrawPath(arena, {stroke.tool, QColor(stroke.color), size, {0.}}, stroke.text, DrawPath::parsePressure(pressure, xournal ? 1./size : 1.));
+    if (path->isEmpty()) {
+        delete path;
+        return nullptr;
+    }
+    return path;
+}
+
+void DrawingLoader::addPart(QString const& label, QVector<Stroke> const& strokes, bool const xournal)
+{
+    Part* const part = new Part();
+    mutex.lock();
+    pages[label].append(part);
+    mutex.unlock();
+    pool.start(new ParseTask(this, part, label, strokes, xournal));
+}
+
+bool DrawingLoader::pageReady(QString const& label) const
+{
+    QMap<QString, QVector<Part*>>::const_iterator const page = pages.constFind(label);
+    if (page == pages.cend())
+        return finished;
+    for (QVector<Part*>::const_iterator part_it=page->cbegin(); part_it!=page->cend(); part_it++)
+        if (!(*part_it)->done)
+            return false;
+    return true;
+}
+
+bool DrawingLoader::isReady(QString const& label) const
+{
+    QMutexLocker locker(&mutex);
+    return pageReady(label);
+}
+
+bool DrawingLoader::isEmpty() const
+{
+    QMutexLocker locker(&mutex);
+    return finished && pages.isEmpty();
+}
+
+bool DrawingLoader::takePage(QString const& label, QList<DrawPath*>& list, bool& replacePage)
+{
+    QMutexLocker locker(&mutex);
+    while (!pageReady(label))
+        condition.wait(&mutex);
+    if (!pages.contains(label))
+        return false;
+    QVector<Part*> const parts = pages.take(label);
+    replacePage = replace;
+    for (int i=0; i<parts.length(); i++) {
+        // In BeamerPresenter XML files, a page which occurs repeatedly replaces the previous occurrences.
+        if (replace && i < parts.length() - 1)
+            qDeleteAll(parts[i]->paths);
+        else
+            list += parts[i]->paths;
+        delete parts[i];
+    }
+    return true;
+}
+
+void DrawingLoader::remove(QString const& label)
+{
+    QList<DrawPath*> list;
+    bool replacePage;
+    if (takePage(label, list, replacePage))
+        qDeleteAll(list);
+}
+
+QStringList const DrawingLoader::remainingPages()
+{
+    QMutexLocker locker(&mutex);
+    while (!finished)
+        condition.wait(&mutex);
+    return pages.keys();
+}
+
+QStringList const DrawingLoader::parsedPages() const
+{
+    QMutexLocker locker(&mutex);
+    QStringList labels;
+    for (QMap<QString, QVector<Part*>>::const_iterator page=pages.cbegin(); page!=pages.cend(); page++)
+        if (pageReady(page.key()))
+            labels.append(page.key());
+    return labels;
+}
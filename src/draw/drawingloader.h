@@ -0,0 +1,132 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DRAWINGLOADER_H
+#define DRAWINGLOADER_H
+
+#include <QThread>
+#include <QThreadPool>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QMap>
+#include <QList>
+#include <QVector>
+#include <QStringList>
+#include <QXmlStreamReader>
+#include "drawpath.h"
+#include "annotationfile.h"
+
+/// Thread reading drawings from a compressed or uncompressed BeamerPresenter XML or Xournal(++) file.
+/// The file is read sequentially by this thread. The strokes of each page are parsed by
+/// separate tasks in a thread pool, such that pages are parsed in parallel.
+/// Parsed pages are taken by the GUI thread when they are needed (see PathOverlay::loadPage).
+class DrawingLoader : public QThread
+{
+    Q_OBJECT
+
+public:
+    /// Stroke read from the file, which has not been parsed yet.
+    struct Stroke {
+        DrawTool tool;
+        /// Color in #AARRGGBB format.
+        QString color;
+        /// Width attribute: the stroke width, followed by the width of each segment in Xournal files.
+        QString width;
+        /// Pressure attribute (BeamerPresenter XML).
+        QString pressure;
+        /// Coordinates of the nodes.
+        QString text;
+    };
+
+private:
+    /// Task parsing one Part.
+    class ParseTask;
+    /// Strokes of one page element in the file.
+    struct Part {
+        QList<DrawPath*> paths;
+        QSharedPointer<StrokeArena> arena;
+        bool done = false;
+    };
+
+    QString const filename;
+    /// Labels of the pages of the presentation, used for Xournal files.
+    QStringList const labels;
+    /// Documents for which the drawings are expected.
+    AnnotationFile::Document const presentation;
+    AnnotationFile::Document const notes;
+    /// Pool of the tasks parsing the pages.
+    QThreadPool pool;
+
+    // Shared with the reading thread and the parsing tasks, protected by mutex.
+    mutable QMutex mutex;
+    mutable QWaitCondition condition;
+    /// Parts of all pages which have not been taken, by label.
+    QMap<QString, QVector<Part*>> pages;
+    /// Has the file been read completely?
+    bool finished = false;
+    /// Do pages in this file replace the current paths (BeamerPresenter XML) instead of being added to them (Xournal)?
+    bool replace = true;
+    bool stopping = false;
+
+    /// Read the pages of a BeamerPresenter XML file.
+    void readBeamerPresenter(QXmlStreamReader& reader);
+    /// Read the pages of a Xournal(++) file.
+    void readXournal(QXmlStreamReader& reader);
+    /// Read a stroke element. Colors are converted from Xournal's #RRGGBBAA format if xournal is true.
+    static Stroke const readStroke(QXmlStreamReader& reader, bool const xournal);
+    /// Start parsing the strokes of a page element with given label.
+    void addPart(QString const& label, QVector<Stroke> const& strokes, bool const xournal);
+    /// Are all parts of the page parsed, or is the file read completely without containing the page? Requires mutex.
+    bool pageReady(QString const& label) const;
+
+public:
+    /// Create a loader for filename. labels are the page labels of the presentation.
+    DrawingLoader(QString const& filename, QStringList const& labels, AnnotationFile::Document const& presentation, AnnotationFile::Document const& notes, QObject* parent = nullptr);
+    /// Stop reading and delete all paths which have not been taken.
+    ~DrawingLoader();
+
+    /// Parse one stroke. Return nullptr if the stroke is invalid.
+    static DrawPath* parseStroke(Stroke const& stroke, QSharedPointer<StrokeArena> const& arena, bool const xournal);
+
+    // The following functions must be called in the GUI thread.
+    /// Can the page be taken without waiting? This is the case if it is parsed or if the file does not contain it.
+    bool isReady(QString const& label) const;
+    /// Has the file been read completely and have all pages been taken?
+    bool isEmpty() const;
+    /// Wait until the page has been parsed and move its paths to list.
+    /// Return false if the file does not contain the page.
+    /// A page which occurs in the file repeatedly can be taken again when its next occurrence has been parsed.
+    /// replacePage is set to true if the paths replace the current paths of the page.
+    bool takePage(QString const& label, QList<DrawPath*>& list, bool& replacePage);
+    /// Discard the page if it has not been taken yet.
+    void remove(QString const& label);
+    /// Wait until the file has been read completely and return the labels of all pages which have not been taken.
+    QStringList const remainingPages();
+    /// Return the labels of the pages which have not been taken and can be taken without waiting.
+    QStringList const parsedPages() const;
+
+protected:
+    /// Read the file and start the tasks parsing the pages.
+    void run() override;
+
+signals:
+    /// A part of the page has been parsed. Emitted from the parsing tasks.
+    void pageParsed(QString const label);
+};
+
+#endif // DRAWINGLOADER_H
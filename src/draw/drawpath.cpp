@@ -16,112 +16,358 @@
  * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
  */
 #include <cmath>
+#include <algorithm>
+#include <functional>
+#include <QPolygonF>
 
 #include "drawpath.h"
+#include "segmenthits.h"
 
-qreal square(qreal const a)
+namespace {
+
+/// Maximum number of input points which are dropped between two nodes.
+/// This bounds the time required for checking the tolerance when appending a point.
+int const maxPendingPoints = 64;
+
+/// Below this scale (pixels per point), paths are drawn with reduced level of detail.
+qreal const lodScale = 2.;
+
+/// Maximum number of characters written by formatNumber.
+int const maxNumberLength = 18;
+
+/// Maximum distance (in points) between the outline of a stroke with variable width and the exact stroke.
+qreal const outlineTolerance = 0.02;
+
+qreal const pi = 3.14159265358979323846;
+
+/// Append points on the arc of a circle from angle start to angle end (in radians) to polygon.
+/// The distance between the polygon and the arc is at most outlineTolerance.
+void appendArc(QPolygonF& polygon, QPointF const& center, qreal const radius, qreal const start, qreal const end)
 {
-    return a*a;
+    qreal const step = radius > outlineTolerance ? 2*std::acos(1. - outlineTolerance/radius) : pi/2;
+    int const number = std::min(std::max(int(std::ceil((end - start)/step)), 1), 32);
+    for (int i=0; i<=number; i++) {
+        qreal const angle = start + (end - start)*i/number;
+        polygon.append(QPointF(center.x() + radius*std::cos(angle), center.y() + radius*std::sin(angle)));
+    }
 }
 
-DrawPath::DrawPath(FullDrawTool const& tool, QPointF const& start) :
-    tool(tool)
+/// Add the convex hull of the circles around c0 with radius r0 and around c1 with radius r1 to path.
+/// This is the shape of a segment of a stroke with variable width including round caps.
+/// All hulls have the same orientation, such that overlapping hulls are filled once with Qt::WindingFill.
+void addSegmentHull(QPainterPath& path, QPointF const& c0, qreal const r0, QPointF const& c1, qreal const r1)
+{
+    qreal const dx = c1.x() - c0.x(), dy = c1.y() - c0.y();
+    qreal const distance = std::sqrt(dx*dx + dy*dy);
+    QPolygonF polygon;
+    if (distance <= std::abs(r1 - r0)) {
+        // One circle contains the other one.
+        appendArc(polygon, r0 > r1 ? c0 : c1, std::max(r0, r1), 0., 2*pi);
+    }
+    else {
+        qreal const direction = std::atan2(dy, dx);
+        // Angle between the segment and the points at which the tangents touch the circles.
+        qreal const phi = std::acos((r0 - r1)/distance);
+        appendArc(polygon, c1, r1, direction - phi, direction + phi);
+        appendArc(polygon, c0, r0, direction + phi, direction + 2*pi - phi);
+    }
+    path.addPolygon(polygon);
+    path.closeSubpath();
+}
+
+/// Write value with at most 3 decimals to out and return the position after the last character.
+/// 0.001pt is much more precise than any input device, and writing fixed point numbers avoids
+/// the creation of a string for every number.
+QChar* formatNumber(float const value, QChar* out)
+{
+    // Coordinates are clamped such that they fit in maxNumberLength characters.
+    double const clamped = std::isfinite(value) ? std::min(std::max(double(value), -1e12), 1e12) : 0.;
+    qint64 scaled = qRound64(clamped*1000);
+    if (scaled < 0) {
+        *out++ = QLatin1Char('-');
+        scaled = -scaled;
+    }
+    int decimals = int(scaled % 1000);
+    qint64 integer = scaled / 1000;
+    char digits[16];
+    int length = 0;
+    do {
+        digits[length++] = char('0' + integer % 10);
+        integer /= 10;
+    } while (integer > 0);
+    while (length > 0)
+        *out++ = QLatin1Char(digits[--length]);
+    if (decimals != 0) {
+        *out++ = QLatin1Char('.');
+        for (int divisor=100; divisor>0 && decimals!=0; divisor/=10) {
+            *out++ = QLatin1Char(char('0' + decimals / divisor));
+            decimals %= divisor;
+        }
+    }
+    return out;
+}
+
+/// Parse a decimal number (optionally with exponent) starting at pos after optional white space.
+/// Return false if no number was found. Otherwise move pos behind the number.
+bool parseNumber(QChar const*& pos, QChar const* const end, float& value)
 {
-    path.append(start);
+    while (pos != end && (*pos == QLatin1Char(' ') || *pos == QLatin1Char('\n') || *pos == QLatin1Char('\t') || *pos == QLatin1Char('\r')))
+        pos++;
+    QChar const* p = pos;
+    bool negative = false;
+    if (p != end && (*p == QLatin1Char('-') || *p == QLatin1Char('+')))
+        negative = *p++ == QLatin1Char('-');
+    // Only the first 18 significant digits are used, such that the mantissa fits in 64 bits.
+    quint64 mantissa = 0;
+    int exponent = 0, digits = 0, significant = 0;
+    for (; p != end && p->unicode() >= '0' && p->unicode() <= '9'; p++, digits++) {
+        if (significant < 18) {
+            mantissa = 10*mantissa + (p->unicode() - '0');
+            if (mantissa != 0)
+                significant++;
+        }
+        else
+            exponent++;
+    }
+    if (p != end && *p == QLatin1Char('.')) {
+        for (p++; p != end && p->unicode() >= '0' && p->unicode() <= '9'; p++, digits++) {
+            if (significant < 18) {
+                mantissa = 10*mantissa + (p->unicode() - '0');
+                exponent--;
+                if (mantissa != 0)
+                    significant++;
+            }
+        }
+    }
+    if (digits == 0)
+        return false;
+    if (p != end && (*p == QLatin1Char('e') || *p == QLatin1Char('E'))) {
+        QChar const* q = p + 1;
+        bool negativeExponent = false;
+        if (q != end && (*q == QLatin1Char('-') || *q == QLatin1Char('+')))
+            negativeExponent = *q++ == QLatin1Char('-');
+        int e = 0;
+        QChar const* const digitsStart = q;
+        for (; q != end && q->unicode() >= '0' && q->unicode() <= '9'; q++)
+            e = std::min(10*e + (q->unicode() - '0'), 1000);
+        if (q != digitsStart) {
+            exponent += negativeExponent ? -e : e;
+            p = q;
+        }
+    }
+    static double const powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    double result = double(mantissa);
+    if (exponent >= 0)
+        result *= exponent <= 22 ? powers[exponent] : std::pow(10., exponent);
+    else
+        result /= exponent >= -22 ? powers[-exponent] : std::pow(10., -exponent);
+    value = float(negative ? -result : result);
+    pos = p;
+    return true;
+}
+
+}
+
+DrawPath::DrawPath(QSharedPointer<StrokeArena> const& arena, FullDrawTool const& tool, QPointF const& start, qreal const pressure) :
+    arena(arena),
+    tool(StrokeArena::toolRecord(tool))
+{
+    quint8 const encoded = StrokeArena::encodePressure(pressure);
+    first = this->arena->append(float(start.x()), float(start.y()), encoded);
+    count = 1;
     outer = QRectF(start.x(), start.y(), 0, 0);
+    variableWidth = encoded != StrokeArena::fullPressure;
     updateHash();
 }
 
-DrawPath::DrawPath(FullDrawTool const& tool, QPointF const* const points, int const number) :
-    path(QVector<QPointF>(number)),
+DrawPath::DrawPath(QSharedPointer<StrokeArena> const& arena, FullDrawTool const* tool, int const start, int const number) :
+    arena(arena),
+    first(start),
+    count(number),
     tool(tool)
 {
-    if (number == 0)
+    if (number <= 0) {
+        count = 0;
         return;
-    double left=points[0].x(), right=points[0].x(), top=points[0].y(), bottom=points[0].y();
-    for (int i=0; i<number; i++) {
-        path[i] = points[i];
-        if (left > points[i].x())
-            left = points[i].x();
-        else if (right < points[i].x())
-            right = points[i].x();
-        if (bottom < points[i].y())
-            bottom = points[i].y();
-        else if (top > points[i].y())
-            top = points[i].y();
+    }
+    float const* const px = arena->x() + first;
+    float const* const py = arena->y() + first;
+    quint8 const* const pp = arena->pressure() + first;
+    float left=px[0], right=px[0], top=py[0], bottom=py[0];
+    quint8 minPressure = pp[0];
+    for (int i=1; i<number; i++) {
+        left = std::min(left, px[i]);
+        right = std::max(right, px[i]);
+        top = std::min(top, py[i]);
+        bottom = std::max(bottom, py[i]);
+        minPressure = std::min(minPressure, pp[i]);
     }
     outer = QRectF(left, top, right-left, bottom-top);
+    variableWidth = minPressure != StrokeArena::fullPressure;
     updateHash();
 }
 
-DrawPath::DrawPath(DrawPath const& old, QPointF const shift, double const scale) :
-    path(QVector<QPointF>(old.path.length())),
-    tool({old.tool.tool, old.tool.color, scale*old.tool.size, old.tool.extras}),
-    hash(old.hash)
-{
-    for (int i=0; i<old.path.length(); i++)
-        path[i] = scale*old.path[i] + shift;
-    outer = QRectF(scale*old.outer.topLeft() + shift, scale*old.outer.bottomRight() + shift);
-}
-
-QRect const DrawPath::update(DrawPath const& new_path, QPointF const shift, double const scale)
+QRectF const DrawPath::extend(QSharedPointer<StrokeArena> const& source, int const start, int const number)
 {
-    if (new_path.tool.tool != tool.tool || new_path.tool.color != tool.color || new_path.path.length() < path.length())
-        return QRect(0,0,-1,-1);
-    if (new_path.path.length() == path.length() + 1) {
-        path.append(scale*new_path.path.last() + shift);
-        outer = QRectF(scale*new_path.outer.topLeft() + shift, scale*new_path.outer.bottomRight() + shift);
-        hash = new_path.hash;
-        return QRectF(path.last(), *(path.cend()-2)).normalized()
-                .adjusted(-tool.size/2-.5, -tool.size/2-.5, tool.size/2+.5, tool.size/2+.5)
-                .toAlignedRect();
+    if (number < count)
+        return QRectF();
+    int const old_count = count;
+    if (source == arena) {
+        // Both paths reference the same arena. The new nodes already exist.
+        first = start;
+        count = number;
+    }
+    else {
+        moveToEnd();
+        arena->append(*source, start + count, number - count);
+        count = number;
     }
-    for (QVector<QPointF>::const_iterator it = new_path.path.cbegin() + path.length(); it != new_path.path.cend();) {
-        path.append(scale*(*it++) + shift);
+    if (old_count == 0)
+        outer = QRectF(x()[0], y()[0], 0, 0);
+    float const* const px = x();
+    float const* const py = y();
+    quint8 const* const pp = pressure();
+    for (int i=old_count; i<count; i++)
+        include(px[i], py[i], pp[i]);
+    if (old_count == 0)
+        return getOuterDrawing();
+    // Region containing all new segments.
+    QRectF rect = QRectF(node(old_count-1), node(old_count-1));
+    for (int i=old_count; i<count; i++) {
+        rect.setLeft(std::min(rect.left(), qreal(px[i])));
+        rect.setRight(std::max(rect.right(), qreal(px[i])));
+        rect.setTop(std::min(rect.top(), qreal(py[i])));
+        rect.setBottom(std::max(rect.bottom(), qreal(py[i])));
     }
-    outer = QRectF(scale*new_path.outer.topLeft() + shift, scale*new_path.outer.bottomRight() + shift);
-    hash = new_path.hash;
-    return getOuterDrawing().toAlignedRect();
+    return rect.adjusted(-tool->size/2-.5, -tool->size/2-.5, tool->size/2+.5, tool->size/2+.5);
 }
 
 DrawPath::DrawPath(DrawPath const& old) :
-    path(old.path),
+    arena(old.arena),
+    first(old.first),
+    count(old.count),
+    outer(old.outer),
+    tool(old.tool),
+    hash(old.hash),
+    variableWidth(old.variableWidth),
+    pending(old.pending),
+    pendingPressure(old.pendingPressure),
+    prediction(old.prediction),
+    outline(old.outline),
+    outlineNodes(old.outlineNodes)
+{}
+
+DrawPath::DrawPath(DrawPath const& old, QSharedPointer<StrokeArena> const& copy) :
+    arena(copy),
+    first(old.first),
+    count(old.count),
     outer(old.outer),
     tool(old.tool),
-    hash(old.hash)
+    hash(old.hash),
+    variableWidth(old.variableWidth)
 {}
 
-void DrawPath::transform(QPointF const& shift, const double scale)
+void DrawPath::moveToEnd()
 {
-    for (int i=0; i<path.length(); i++)
-        path[i] = scale*path[i] + shift;
-    outer = QRectF(scale*outer.topLeft() + shift, scale*outer.bottomRight() + shift);
-    tool.size *= scale;
+    if (first + count != arena->size())
+        first = arena->append(*arena, first, count);
+}
+
+void DrawPath::moveToArena(QSharedPointer<StrokeArena> const& newArena)
+{
+    first = newArena->append(*arena, first, count);
+    arena = newArena;
+}
+
+void DrawPath::append(QPointF const& point, qreal const tolerance, qreal const smoothing, qreal const pressure)
+{
+    QPointF p = point;
+    if (smoothing > 0. && count > 0) {
+        QPointF const& previous = pending.isEmpty() ? node(count-1) : pending.last();
+        p = smoothing*previous + (1.-smoothing)*point;
+    }
+    quint8 const encoded = StrokeArena::encodePressure(pressure);
+    if (tolerance <= 0. || count == 0) {
+        commit(p, encoded);
+        return;
+    }
+    // The segment from the last node to p must represent all pending points within tolerance.
+    // If this is not the case, the previous input point is stored as node.
+    QPointF const last = node(count-1);
+    qreal const tolerance2 = tolerance*tolerance;
+    bool drop = pending.length() < maxPendingPoints;
+    for (QVector<QPointF>::const_iterator it = pending.cbegin(); drop && it != pending.cend(); it++)
+        drop = segmentDistanceSquared(it->x(), it->y(), last.x(), last.y(), p.x(), p.y()) <= tolerance2;
+    if (drop && pendingPressure.length() == pending.length()) {
+        // The width at the pending points must lie between the widths at the last node and at p within tolerance.
+        quint8 const lastPressure = arena->pressure()[first+count-1];
+        qreal const margin = tool->size > 0. ? StrokeArena::fullPressure*tolerance/tool->size : StrokeArena::fullPressure;
+        qreal const low = std::min(lastPressure, encoded) - margin, high = std::max(lastPressure, encoded) + margin;
+        for (QVector<quint8>::const_iterator it = pendingPressure.cbegin(); drop && it != pendingPressure.cend(); it++)
+            drop = *it >= low && *it <= high;
+    }
+    if (!drop) {
+        commit(pending.last(), tailPressure());
+        pending.clear();
+        pendingPressure.clear();
+    }
+    pending.append(p);
+    pendingPressure.append(encoded);
 }
 
-void DrawPath::append(QPointF const& point)
+void DrawPath::commit(QPointF const& point, quint8 const pressure)
 {
-    if (point.x() < outer.left())
-        outer.setLeft(point.x());
-    else if (point.x() > outer.right())
-        outer.setRight(point.x());
-    if (point.y() < outer.top())
-        outer.setTop(point.y());
-    else if (point.y() > outer.bottom())
-        outer.setBottom(point.y());
-    path.append(point);
-    hash ^= quint32(std::hash<double>{}(point.x() + 1e5*point.y())) + (hash << 6) + (hash >> 2);
+    // Nodes can only be appended at the end of the arena.
+    // This requires copying the path only if another path was extended in the meantime.
+    moveToEnd();
+    arena->append(float(point.x()), float(point.y()), pressure);
+    count++;
+    include(float(point.x()), float(point.y()), pressure);
 }
 
-QVector<int> DrawPath::intersects(QPointF const& point, const qreal eraser_size) const
+void DrawPath::include(float const x, float const y, quint8 const pressure)
 {
-    if (!(outer.adjusted(-eraser_size, -eraser_size, eraser_size, eraser_size).contains(point)))
+    if (pressure != StrokeArena::fullPressure && !variableWidth) {
+        variableWidth = true;
+        // The outline of a path with constant width cannot be extended.
+        outline = QPainterPath();
+        outlineNodes = 0;
+    }
+    if (x < outer.left())
+        outer.setLeft(x);
+    else if (x > outer.right())
+        outer.setRight(x);
+    if (y < outer.top())
+        outer.setTop(y);
+    else if (y > outer.bottom())
+        outer.setBottom(y);
+    // Same as in updateHash: the hash of a path does not depend on how it was created.
+    hash ^= quint32(std::hash<double>{}(double(x) + 1e5*double(y))) + (hash << 6) + (hash >> 2);
+}
+
+QVector<int> DrawPath::intersects(QPointF const& start, QPointF const& end, qreal const eraser_size) const
+{
+    // Compare bounding boxes first. outer can have zero width or height, therefore QRectF::intersects is not used.
+    if (count == 0
+            || std::max(start.x(), end.x()) + eraser_size < outer.left()
+            || std::min(start.x(), end.x()) - eraser_size > outer.right()
+            || std::max(start.y(), end.y()) + eraser_size < outer.top()
+            || std::min(start.y(), end.y()) - eraser_size > outer.bottom())
+        return QVector<int>();
+    float const* const px = x();
+    float const* const py = y();
+    float const ax = float(start.x()), ay = float(start.y()), bx = float(end.x()), by = float(end.y());
+    if (count == 1) {
+        if (segmentDistanceSquared(px[0], py[0], ax, ay, bx, by) < float(eraser_size*eraser_size))
+            return QVector<int>{0};
         return QVector<int>();
-    QVector<int> vec = QVector<int>();
-    for (int i=0; i<path.length(); i++) {
-        if (std::abs(point.x() - path[i].x()) < eraser_size
-                && std::abs(point.y() - path[i].y()) < eraser_size
-                && square(point.x() - path[i].x()) + square(point.y() - path[i].y()) < square(eraser_size))
+    }
+    int const segments = count - 1;
+    QVector<quint8> hits(segments);
+    markSegmentHits<1>(px, py, segments, ax, ay, bx, by, float(eraser_size), hits.data());
+    QVector<int> vec;
+    for (int i=0; i<segments; i++) {
+        if (hits[i])
             vec.append(i);
     }
     return vec;
@@ -129,56 +375,99 @@ QVector<int> DrawPath::intersects(QPointF const& point, const qreal eraser_size)
 
 DrawPath* DrawPath::split(int start, int end)
 {
-    if (start < 0) {
-        if (end >= path.length())
-            return this;
+    if (start < 0)
         start = 0;
-    }
-    if (end > path.length())
-        end = path.length();
-    return new DrawPath(tool, path.data()+start, end-start);
+    if (end > count)
+        end = count;
+    return new DrawPath(arena, tool, first+start, end-start);
 }
 
 void DrawPath::updateHash()
 {
-    hash = quint32(std::hash<int>{}(tool.tool));
-    hash ^= quint32(tool.color.red())   + (hash << 6) + (hash >> 2);
-    hash ^= quint32(tool.color.green()) + (hash << 6) + (hash >> 2);
-    hash ^= quint32(tool.color.blue())  + (hash << 6) + (hash >> 2);
-    hash ^= quint32(tool.color.alpha()) + (hash << 6) + (hash >> 2);
-    for (auto& p : path)
-        hash ^= quint32(std::hash<double>{}(p.x() + 1e5*p.y())) + (hash << 6) + (hash >> 2);
+    hash = quint32(std::hash<int>{}(tool->tool));
+    hash ^= quint32(tool->color.red())   + (hash << 6) + (hash >> 2);
+    hash ^= quint32(tool->color.green()) + (hash << 6) + (hash >> 2);
+    hash ^= quint32(tool->color.blue())  + (hash << 6) + (hash >> 2);
+    hash ^= quint32(tool->color.alpha()) + (hash << 6) + (hash >> 2);
+    float const* const px = x();
+    float const* const py = y();
+    for (int i=0; i<count; i++)
+        hash ^= quint32(std::hash<double>{}(double(px[i]) + 1e5*double(py[i]))) + (hash << 6) + (hash >> 2);
 }
 
-void DrawPath::toText(QStringList &stringList, QPoint const shift, qreal const scale) const
+void DrawPath::toText(QString& text) const
 {
-    for (auto point : path) {
-        stringList << QString::number((point.x() - shift.x())*scale);
-        stringList << QString::number((point.y() - shift.y())*scale);
+    // Write directly to the characters of text without creating a string for each number.
+    int const oldSize = text.size();
+    text.resize(oldSize + 2*count*(maxNumberLength + 1));
+    QChar* const begin = text.data();
+    QChar* out = begin + oldSize;
+    float const* const px = x();
+    float const* const py = y();
+    for (int i=0; i<count; i++) {
+        if (out != begin)
+            *out++ = QLatin1Char(' ');
+        out = formatNumber(px[i], out);
+        *out++ = QLatin1Char(' ');
+        out = formatNumber(py[i], out);
     }
+    text.resize(int(out - begin));
 }
 
-DrawPath::DrawPath(FullDrawTool const& tool, QStringList const& stringList, QPoint const shift, qreal const scale) :
-    tool({tool.tool, tool.color, scale*tool.size, tool.extras})
+void DrawPath::pressureToText(QString& text, qreal const scale, bool const segments) const
 {
-    if (stringList.size() % 2 != 0 || stringList.size() < 2)
+    int const number = segments ? count - 1 : count;
+    if (number <= 0)
         return;
-    double x = shift.x() + scale*stringList[0].toDouble();
-    double y = shift.y() + scale*stringList[1].toDouble();
-    double left=x, right=x, top=y, bottom=y;
-    path.append(QPointF(x, y));
-    for (QStringList::const_iterator it=stringList.cbegin()+2; it != stringList.cend();) {
-        x = shift.x() + scale*(it++)->toDouble();
-        y = shift.y() + scale*(it++)->toDouble();
-        path.append(QPointF(x, y));
-        if (left > x)
-            left = x;
-        else if (right < x)
-            right = x;
-        if (bottom < y)
-            bottom = y;
-        else if (top > y)
-            top = y;
+    int const oldSize = text.size();
+    text.resize(oldSize + number*(maxNumberLength + 1));
+    QChar* const begin = text.data();
+    QChar* out = begin + oldSize;
+    quint8 const* const pp = pressure();
+    for (int i=0; i<number; i++) {
+        if (out != begin)
+            *out++ = QLatin1Char(' ');
+        qreal const value = segments ? (StrokeArena::decodePressure(pp[i]) + StrokeArena::decodePressure(pp[i+1]))/2 : StrokeArena::decodePressure(pp[i]);
+        out = formatNumber(float(scale*value), out);
+    }
+    text.resize(int(out - begin));
+}
+
+QVector<quint8> const DrawPath::parsePressure(QString const& text, qreal const scale)
+{
+    QVector<quint8> pressure;
+    QChar const* pos = text.constData();
+    QChar const* const end = pos + text.size();
+    float value;
+    while (parseNumber(pos, end, value))
+        pressure.append(StrokeArena::encodePressure(scale*value));
+    return pressure;
+}
+
+DrawPath::DrawPath(QSharedPointer<StrokeArena> const& arena, FullDrawTool const& tool, QString const& text, QVector<quint8> const& pressure) :
+    arena(arena),
+    tool(StrokeArena::toolRecord(tool))
+{
+    first = this->arena->size();
+    QChar const* pos = text.constData();
+    QChar const* const end = pos + text.size();
+    float left=0., right=0., top=0., bottom=0.;
+    float x, y;
+    while (parseNumber(pos, end, x) && parseNumber(pos, end, y)) {
+        quint8 const p = pressure.isEmpty() ? StrokeArena::fullPressure : pressure[std::min(count, pressure.length()-1)];
+        if (p != StrokeArena::fullPressure)
+            variableWidth = true;
+        this->arena->append(x, y, p);
+        if (count++ == 0) {
+            left = right = x;
+            top = bottom = y;
+        }
+        else {
+            left = std::min(left, x);
+            right = std::max(right, x);
+            top = std::min(top, y);
+            bottom = std::max(bottom, y);
+        }
     }
     outer = QRectF(left, top, right-left, bottom-top);
     updateHash();
@@ -186,14 +475,230 @@ DrawPath::DrawPath(FullDrawTool const& tool, QStringList const& stringList, QPoi
 
 void DrawPath::endDrawing()
 {
-    if (path.length() == 1)
-        path.append(path[0] + QPointF(1e-6, 0));
+    prediction = QPointF();
+    if (!pending.isEmpty()) {
+        commit(pending.last(), tailPressure());
+        pending = QVector<QPointF>();
+        pendingPressure = QVector<quint8>();
+    }
+    strokeBuffer = QImage();
+    if (count == 1) {
+        moveToEnd();
+        float const x = arena->x()[first] + 1e-4f, y = arena->y()[first];
+        quint8 const p = arena->pressure()[first];
+        arena->append(x, y, p);
+        count++;
+        include(x, y, p);
+    }
+}
+
+QRectF const DrawPath::getOuterDrawing() const
+{
+    QRectF rect = outer;
+    auto const include = [&rect](QPointF const& point) {
+        rect.setLeft(std::min(rect.left(), point.x()));
+        rect.setRight(std::max(rect.right(), point.x()));
+        rect.setTop(std::min(rect.top(), point.y()));
+        rect.setBottom(std::max(rect.bottom(), point.y()));
+    };
+    if (!pending.isEmpty())
+        include(pending.last());
+    if (!prediction.isNull())
+        include(prediction);
+    return rect.adjusted(-tool->size/2-.5, -tool->size/2-.5, tool->size/2+.5, tool->size/2+.5);
+}
+
+QRectF const DrawPath::getOuterLast() const
+{
+    if (count == 0)
+        return QRectF();
+    // The last section consists of the previous tail section, which has to be removed, and the new one.
+    QPointF const last = node(count-1);
+    QRectF rect = QRectF(last, last);
+    QVector<QPointF> points;
+    if (count > 1)
+        points.append(node(count-2));
+    if (pending.length() > 1)
+        points.append(pending[pending.length()-2]);
+    if (!pending.isEmpty())
+        points.append(pending.last());
+    for (QPointF const& point : points) {
+        rect.setLeft(std::min(rect.left(), point.x()));
+        rect.setRight(std::max(rect.right(), point.x()));
+        rect.setTop(std::min(rect.top(), point.y()));
+        rect.setBottom(std::max(rect.bottom(), point.y()));
+    }
+    return rect.adjusted(-tool->size/2-.5, -tool->size/2-.5, tool->size/2+.5, tool->size/2+.5);
+}
+
+QRectF const DrawPath::setTail(QVector<QPointF> const& tail)
+{
+    if (count == 0)
+        return QRectF();
+    QPointF const last = node(count-1);
+    QRectF rect = QRectF(last, last);
+    if (!pending.isEmpty())
+        rect |= QRectF(last, pending.last()).normalized();
+    if (!prediction.isNull())
+        rect |= QRectF(last, prediction).normalized();
+    pending = tail.mid(0, 1);
+    prediction = tail.value(1);
+    // The tail is drawn with the pressure of the last node.
+    pendingPressure.clear();
+    if (!pending.isEmpty())
+        rect |= QRectF(last, pending.last()).normalized();
+    if (!prediction.isNull())
+        rect |= QRectF(last, prediction).normalized();
+    return rect.adjusted(-tool->size/2-.5, -tool->size/2-.5, tool->size/2+.5, tool->size/2+.5);
+}
+
+QRectF const DrawPath::setPrediction(QPointF const& point)
+{
+    if (count == 0)
+        return QRectF();
+    // The predicted section starts at the tail, which lies within getOuterLast.
+    QPointF const start = pending.isEmpty() ? node(count-1) : pending.last();
+    QRectF rect = QRectF(start, start);
+    if (!prediction.isNull())
+        rect |= QRectF(start, prediction).normalized();
+    prediction = point;
+    if (!prediction.isNull())
+        rect |= QRectF(start, prediction).normalized();
+    return rect.adjusted(-tool->size/2-.5, -tool->size/2-.5, tool->size/2+.5, tool->size/2+.5);
+}
+
+void DrawPath::extendOutline() const
+{
+    if (outlineNodes == 0) {
+        outline = QPainterPath();
+        outline.setFillRule(Qt::WindingFill);
+        addSegmentHull(outline, node(0), width(0)/2, node(0), width(0)/2);
+        outlineNodes = 1;
+    }
+    // Only the new segments are added: the time required for this does not depend on the length of the path.
+    for (; outlineNodes<count; outlineNodes++)
+        addSegmentHull(outline, node(outlineNodes-1), width(outlineNodes-1)/2, node(outlineNodes), width(outlineNodes)/2);
 }
 
-QRect const DrawPath::getOuterLast() const
+void DrawPath::drawUnfinished(QPainter& painter) const
 {
-    return QRectF(path.last(), *(path.cend()-2))
-            .normalized()
-            .adjusted(-tool.size/2-.5, -tool.size/2-.5, tool.size/2+.5, tool.size/2+.5)
-            .toAlignedRect();
+    // Filling the outline in every frame would take a time proportional to the length of the path.
+    // The segments are drawn once to strokeBuffer with opaque color. The buffer is drawn with the
+    // alpha of the tool, such that transparent strokes are not drawn twice where segments overlap.
+    QPaintDevice const* const device = painter.device();
+    qreal const ratio = device->devicePixelRatioF();
+    QSize const size = QSize(device->width(), device->height()) * ratio;
+    QTransform const transform = painter.worldTransform();
+    if (strokeBuffer.size() != size || strokeBufferTransform != transform) {
+        strokeBuffer = QImage(size, QImage::Format_ARGB32_Premultiplied);
+        strokeBuffer.setDevicePixelRatio(ratio);
+        strokeBuffer.fill(QColor(0,0,0,0));
+        strokeBufferTransform = transform;
+        strokeBufferNodes = 0;
+    }
+    if (strokeBufferNodes < count) {
+        QPainterPath segments;
+        segments.setFillRule(Qt::WindingFill);
+        if (strokeBufferNodes == 0) {
+            addSegmentHull(segments, node(0), width(0)/2, node(0), width(0)/2);
+            strokeBufferNodes = 1;
+        }
+        for (; strokeBufferNodes<count; strokeBufferNodes++)
+            addSegmentHull(segments, node(strokeBufferNodes-1), width(strokeBufferNodes-1)/2, node(strokeBufferNodes), width(strokeBufferNodes)/2);
+        QColor opaque = tool->color;
+        opaque.setAlpha(255);
+        QPainter buffer(&strokeBuffer);
+        buffer.setRenderHint(QPainter::Antialiasing);
+        buffer.setWorldTransform(transform);
+        buffer.fillPath(segments, opaque);
+    }
+    painter.save();
+    painter.setWorldTransform(QTransform());
+    painter.setOpacity(painter.opacity() * tool->color.alphaF());
+    painter.drawImage(0, 0, strokeBuffer);
+    painter.restore();
+    // Tail and prediction change in every frame and are drawn directly.
+    // They only overlap the segments in the buffer close to the last node.
+    QPainterPath shape;
+    shape.setFillRule(Qt::WindingFill);
+    qreal const radius = tool->size*StrokeArena::decodePressure(tailPressure())/2;
+    QPointF const tail = pending.isEmpty() ? node(count-1) : pending.last();
+    if (!pending.isEmpty())
+        addSegmentHull(shape, node(count-1), width(count-1)/2, tail, radius);
+    if (!prediction.isNull())
+        addSegmentHull(shape, tail, radius, prediction, radius);
+    painter.fillPath(shape, tool->color);
+}
+
+void DrawPath::draw(QPainter& painter) const
+{
+    if (count == 0)
+        return;
+    if (variableWidth) {
+        // Paths with variable width are always filled using their outline.
+        extendOutline();
+        if (pending.isEmpty() && prediction.isNull()) {
+            strokeBuffer = QImage();
+            painter.fillPath(outline, tool->color);
+        }
+        else
+            drawUnfinished(painter);
+        return;
+    }
+    // Number of pixels per point.
+    qreal const scale = std::sqrt(std::abs(painter.worldTransform().determinant()));
+    if (scale >= lodScale && pending.isEmpty() && prediction.isNull() && count > 1) {
+        // Finished paths are filled using their cached outline instead of stroking them in every paint event.
+        if (outlineNodes != count) {
+            float const* const px = x();
+            float const* const py = y();
+            QPainterPath polyline;
+            polyline.moveTo(px[0], py[0]);
+            for (int i=1; i<count; i++)
+                polyline.lineTo(px[i], py[i]);
+            QPainterPathStroker stroker;
+            stroker.setWidth(tool->size);
+            stroker.setCapStyle(Qt::RoundCap);
+            stroker.setJoinStyle(Qt::RoundJoin);
+            outline = stroker.createStroke(polyline);
+            outlineNodes = count;
+        }
+        painter.fillPath(outline, tool->color);
+        return;
+    }
+    painter.setPen(QPen(tool->color, tool->size, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
+    // QPainter requires the nodes as QPointF. Reuse a buffer for the conversion.
+    thread_local QVector<QPointF> buffer;
+    if (buffer.size() < count + 2)
+        buffer.resize(count + 2);
+    float const* const px = x();
+    float const* const py = y();
+    QPointF* const data = buffer.data();
+    int number = 0;
+    if (scale < lodScale && scale > 0.) {
+        // Skip nodes which are closer than half a pixel to the previous drawn node. The last node is always drawn.
+        float const min_distance2 = float(.25/(scale*scale));
+        data[number++] = QPointF(px[0], py[0]);
+        float lastx = px[0], lasty = py[0];
+        for (int i=1; i<count-1; i++) {
+            float const dx = px[i] - lastx, dy = py[i] - lasty;
+            if (dx*dx + dy*dy >= min_distance2) {
+                data[number++] = QPointF(px[i], py[i]);
+                lastx = px[i];
+                lasty = py[i];
+            }
+        }
+        if (count > 1)
+            data[number++] = QPointF(px[count-1], py[count-1]);
+    }
+    else {
+        for (; number<count; number++)
+            data[number] = QPointF(px[number], py[number]);
+    }
+    // The tail is drawn as if it was the last node.
+    if (!pending.isEmpty())
+        data[number++] = pending.last();
+    if (!prediction.isNull())
+        data[number++] = prediction;
+    painter.drawPolyline(data, number);
 }
@@ -23,60 +23,158 @@
 #include <QVector>
 #include <QPointF>
 #include <QRectF>
+#include <QPainter>
+#include <QPainterPath>
+#include <QImage>
+#include <QTransform>
+#include <QSharedPointer>
+#include "strokearena.h"
 #include "../enumerates.h"
 
+/// A path drawn with a pen or highlighter.
+/// Nodes and stroke width are given in page coordinates (points, relative to the upper left corner of the page).
+/// The nodes are stored in a StrokeArena, which is shared by all paths of a page.
+/// Copies of a path and paths obtained by splitting it reference the same nodes.
+/// While drawing, input points are only stored as nodes if they are required to represent the input
+/// within a given tolerance. The last input point which is not stored yet (tail) is drawn anyway.
+/// If the nodes have different pressure, the stroke width at each node is the tool size multiplied by
+/// the pressure and the path is drawn as filled outline.
 class DrawPath
 {
 private:
-    QVector<QPointF> path;
+    /// Arena containing the nodes of this path.
+    QSharedPointer<StrokeArena> arena;
+    /// Index of the first node in arena.
+    int first = 0;
+    /// Number of nodes.
+    int count = 0;
     /// Rectangle containing all nodes of the path.
     QRectF outer = QRectF();
-    FullDrawTool tool;
+    /// Shared tool record, see StrokeArena::toolRecord.
+    FullDrawTool const* tool;
     quint32 hash = 0;
+    /// Does any node have less than full pressure?
+    bool variableWidth = false;
+    /// Input points since the last node, which have not been stored as nodes.
+    /// All these points are within the tolerance of the segment from the last node to the last input point.
+    QVector<QPointF> pending;
+    /// Encoded pressure of the points in pending.
+    QVector<quint8> pendingPressure;
+    /// Predicted position of the input after the tail, which is drawn but never stored. Null if there is no prediction.
+    QPointF prediction;
+    /// Outline of the stroke in page coordinates. Nodes are never changed, such that the outline stays valid
+    /// for the nodes which it contains. With constant width, the outline is created when the path is drawn
+    /// after it was finished. With variable width, the outline is extended by the new nodes whenever the path is drawn.
+    mutable QPainterPath outline;
+    /// Number of nodes contained in outline.
+    mutable int outlineNodes = 0;
+    /// Segments of an unfinished path with variable width, drawn with opaque color in the device pixels of
+    /// the painter which drew the path last. Only new segments are added when the path is drawn.
+    mutable QImage strokeBuffer;
+    /// Transformation from page to device coordinates for which strokeBuffer was drawn.
+    mutable QTransform strokeBufferTransform;
+    /// Number of nodes contained in strokeBuffer.
+    mutable int strokeBufferNodes = 0;
+
+    /// Make sure that the nodes of this path are at the end of the arena, such that nodes can be appended.
+    void moveToEnd();
+    /// Include a node which has been appended to the path in outer and hash.
+    void include(float const x, float const y, quint8 const pressure);
+    /// Store a point as new node.
+    void commit(QPointF const& point, quint8 const pressure);
+    /// Add the segments from node outlineNodes-1 to the last node to the outline of a path with variable width.
+    void extendOutline() const;
+    /// Draw an unfinished path with variable width using strokeBuffer, such that the time required
+    /// for this does not depend on the length of the path.
+    void drawUnfinished(QPainter& painter) const;
+    /// Stroke width at node i.
+    qreal width(int const i) const {return tool->size*StrokeArena::decodePressure(arena->pressure()[first+i]);}
+    /// Encoded pressure of the tail. Tails received from another path get the pressure of the last node.
+    quint8 tailPressure() const {return !pending.isEmpty() && pendingPressure.length() == pending.length() ? pendingPressure.last() : arena->pressure()[first+count-1];}
 
 public:
-    /// Created new empty path.
-    DrawPath(FullDrawTool const& tool, QPointF const& start);
-    /// Create new path with given points.
-    DrawPath(FullDrawTool const& tool, QPointF const* const points, int const number);
-    /// Read path from string list. Used in file loading function.
-    DrawPath(FullDrawTool const& tool, QStringList const& stringList, QPoint const shift, qreal const scale);
-    DrawPath(DrawPath const& old, QPointF const shift, double const scale);
+    /// Created new path in arena containing only the given node.
+    DrawPath(QSharedPointer<StrokeArena> const& arena, FullDrawTool const& tool, QPointF const& start, qreal const pressure = 1.);
+    /// Create new path referencing nodes which already exist in arena.
+    DrawPath(QSharedPointer<StrokeArena> const& arena, FullDrawTool const* tool, int const start, int const number);
+    /// Read path from text containing alternating x and y coordinates in points, separated by white space.
+    /// pressure contains the encoded pressure of the nodes. Nodes without pressure get the last given pressure.
+    /// Used in file loading functions.
+    DrawPath(QSharedPointer<StrokeArena> const& arena, FullDrawTool const& tool, QString const& text, QVector<quint8> const& pressure = QVector<quint8>());
+    /// Copy path. The copy references the same nodes.
     DrawPath(DrawPath const& old);
+    /// Copy path referencing the nodes with the same indices in copy, which must be a copy of the arena of old.
+    /// The tail and cached outline are not copied.
+    DrawPath(DrawPath const& old, QSharedPointer<StrokeArena> const& copy);
 
-    DrawPath operator=(DrawPath const& old) {path.clear(); return DrawPath(old);}
-    DrawPath operator=(DrawPath const&& old) {path.clear(); return DrawPath(old);}
-
-    ~DrawPath() {path.clear();}
+    DrawPath& operator=(DrawPath const& old) = delete;
 
-    /// Called when drawing ends: makes sure that a path contains at least two points such that it can be drawn.
+    /// Called when drawing ends: stores the tail, removes the prediction and makes sure that a path contains at least two points such that it can be drawn.
     void endDrawing();
-    /// Export path to list of strings representing numbers.
-    /// The list contains (alternately) x and y coordinates in point (=inch/72).
-    void toText(QStringList& stringList, QPoint const shift, qreal const scale) const;
-    void transform(QPointF const& shift, double const scale);
-    /// Update path and return a rectangle containing the updated region.
-    QRect const update(DrawPath const& new_path, QPointF const shift, double const scale);
+    /// Append the nodes to text as alternating x and y coordinates in point (=inch/72), separated by spaces.
+    void toText(QString& text) const;
+    /// Append the pressure of the nodes multiplied by scale to text, separated by spaces.
+    /// If segments is true, one value is written for each segment (the mean of its nodes) as used by Xournal.
+    void pressureToText(QString& text, qreal const scale = 1., bool const segments = false) const;
+    /// Read numbers separated by white space from text and return them multiplied by scale as encoded pressure.
+    static QVector<quint8> const parsePressure(QString const& text, qreal const scale = 1.);
+    /// Extend this path to the nodes from index start to start+number of source.
+    /// These nodes must begin with the nodes of this path. Only the new nodes are read.
+    /// Return a rectangle containing the updated region or an invalid rectangle if the nodes do not match.
+    QRectF const extend(QSharedPointer<StrokeArena> const& source, int const start, int const number);
     void updateHash();
 
     quint32 getHash() const {return hash;}
-    bool isEmpty() const {return path.isEmpty();}
+    bool isEmpty() const {return count == 0;}
     /// Number of nodes in path.
-    int number() const {return path.length();}
-    FullDrawTool const& getTool() const {return tool;}
-    QPointF const* data() const {return path.constData();}
+    int number() const {return count;}
+    FullDrawTool const& getTool() const {return *tool;}
+    /// x coordinates of the nodes. The pointer is invalidated when nodes are added to the arena.
+    float const* x() const {return arena->x() + first;}
+    /// y coordinates of the nodes. The pointer is invalidated when nodes are added to the arena.
+    float const* y() const {return arena->y() + first;}
+    /// Encoded pressure of the nodes. The pointer is invalidated when nodes are added to the arena.
+    quint8 const* pressure() const {return arena->pressure() + first;}
+    /// Is the stroke width variable (does any node have less than full pressure)?
+    bool hasPressure() const {return variableWidth;}
+    QPointF const node(int const i) const {return QPointF(arena->x()[first+i], arena->y()[first+i]);}
+    QSharedPointer<StrokeArena> const& getArena() const {return arena;}
+    /// Index of the first node in the arena.
+    int getFirst() const {return first;}
+    /// Copy the nodes of this path to the end of newArena and reference them there.
+    void moveToArena(QSharedPointer<StrokeArena> const& newArena);
     /// Rectangle containing all nodes.
     QRectF const& getOuter() const {return outer;}
-    /// Rectangle containing all nodes plus a distance of the stroke width.
-    QRectF const getOuterDrawing() const {return outer.adjusted(-tool.size/2-.5, -tool.size/2-.5, tool.size/2+.5, tool.size/2+.5);}
-    /// Return rectangle containing the last section of the stroke (last two points) as required for updating the screen.
-    QRect const getOuterLast() const;
-    /// Return all nodes in this path which are nearer to the given point than eraser_size.
-    QVector<int> intersects(QPointF const& point, qreal const eraser_size) const;
+    /// Rectangle containing all nodes and the tail plus a distance of the stroke width.
+    QRectF const getOuterDrawing() const;
+    /// Return rectangle containing the last section of the stroke (last two nodes and the tail) as required for updating the screen.
+    QRectF const getOuterLast() const;
+    /// Is there an input point which is not stored as node yet?
+    bool hasTail() const {return !pending.isEmpty();}
+    /// Last input point, which is drawn after the last node.
+    QPointF const& getTail() const {return pending.last();}
+    /// Set the tail received from another path (empty or containing one point, optionally followed by the prediction).
+    /// Return a rectangle containing the old and new tail section.
+    QRectF const setTail(QVector<QPointF> const& tail);
+    /// Predicted position of the input after the tail, or a null point.
+    QPointF const& getPrediction() const {return prediction;}
+    /// Set the predicted position of the input (null to remove the prediction).
+    /// Return a rectangle containing the old and new predicted section.
+    QRectF const setPrediction(QPointF const& point);
+    /// Return the indices of all segments which are nearer than eraser_size to the line from start to end,
+    /// which is the area swept by the eraser between two input events.
+    /// Segment i connects node i and node i+1. A path with a single node has only the segment 0.
+    QVector<int> intersects(QPointF const& start, QPointF const& end, qreal const eraser_size) const;
+    /// Draw the path with color and width of its tool. The composition mode must be set in painter.
+    /// The transformation from page to widget coordinates must be set in painter.
+    /// At small scales, nodes which are closer than half a pixel are skipped.
+    void draw(QPainter& painter) const;
 
-    /// Append a new node to the path.
-    void append(QPointF const& point);
-    /// Extract all nodes from index start to index end as a separate path.
+    /// Append a new input point with pressure between 0 and 1 to the path.
+    /// Nodes are only stored if the path or its width would otherwise deviate more than tolerance from an input point.
+    /// If smoothing > 0, the point is first moved towards the previous point by this fraction of their distance.
+    void append(QPointF const& point, qreal const tolerance = 0., qreal const smoothing = 0., qreal const pressure = 1.);
+    /// Create a path referencing the nodes from index start to index end of this path.
     DrawPath* split(int start, int end);
 };
 
@@ -0,0 +1,274 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <QtDebug>
+#include <QtEndian>
+#include <QThreadPool>
+#include <QRunnable>
+
+#include "gzipdevice.h"
+
+namespace {
+
+/// Size of the buffer for compressed data.
+int const bufferSize = 65536;
+
+/// Does the data start with a valid zlib header?
+bool isZlibHeader(uchar const byte0, uchar const byte1)
+{
+    return (byte0 & 0x0f) == Z_DEFLATED && ((byte0 << 8) | byte1) % 31 == 0;
+}
+
+/// Size of the blocks which are compressed in parallel.
+int const parallelBlockSize = 131072;
+/// Size of the deflate window. Each block uses this amount of preceding data as dictionary.
+int const windowSize = 32768;
+
+/// Raw deflate compression of a block of data, which is part of a gzip stream.
+class DeflateBlock : public QRunnable
+{
+public:
+    QByteArray const& data;
+    int const start;
+    int const end;
+    /// Compressed block.
+    QByteArray output;
+    /// CRC-32 of the uncompressed block.
+    uLong crc = 0;
+    bool ok = false;
+
+    DeflateBlock(QByteArray const& data, int const start, int const end) : data(data), start(start), end(end) {setAutoDelete(false);}
+
+    void run() override
+    {
+        Bytef* const bytes = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData()));
+        crc = crc32(0, bytes + start, uInt(end - start));
+        z_stream stream;
+        stream.zalloc = Z_NULL;
+        stream.zfree = Z_NULL;
+        stream.opaque = Z_NULL;
+        // windowBits -15: raw deflate without header.
+        if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            return;
+        if (start > 0) {
+            int const dictionary = std::max(0, start - windowSize);
+            deflateSetDictionary(&stream, bytes + dictionary, uInt(start - dictionary));
+        }
+        // The sync flush adds an empty block of at most 5 bytes.
+        output.resize(int(deflateBound(&stream, uLong(end - start))) + 16);
+        stream.next_in = bytes + start;
+        stream.avail_in = uInt(end - start);
+        stream.next_out = reinterpret_cast<Bytef*>(output.data());
+        stream.avail_out = uInt(output.size());
+        // All blocks except the last one end with a sync flush: they end at a byte boundary without ending the stream.
+        bool const last = end == data.size();
+        int const status = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+        ok = last ? status == Z_STREAM_END : status == Z_OK && stream.avail_in == 0 && stream.avail_out > 0;
+        output.resize(output.size() - int(stream.avail_out));
+        deflateEnd(&stream);
+    }
+};
+
+}
+
+GzipDevice::GzipDevice(QString const& filename, QObject* parent) :
+    QIODevice(parent),
+    file(filename)
+{
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+}
+
+GzipDevice::~GzipDevice()
+{
+    if (isOpen())
+        close();
+}
+
+bool GzipDevice::open(OpenMode mode)
+{
+    if (mode & QIODevice::ReadOnly && mode & QIODevice::WriteOnly) {
+        setErrorString("GzipDevice cannot be opened for reading and writing");
+        return false;
+    }
+    if (!file.open(mode & ~QIODevice::Text)) {
+        setErrorString(file.errorString());
+        return false;
+    }
+    buffer.resize(bufferSize);
+    stream.next_in = Z_NULL;
+    stream.avail_in = 0;
+    finished = false;
+    int status;
+    if (mode & QIODevice::WriteOnly) {
+        format = Gzip;
+        // windowBits 15 + 16: write gzip header.
+        status = deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    }
+    else {
+        QByteArray const start = file.peek(6);
+        uchar const* const bytes = reinterpret_cast<uchar const*>(start.constData());
+        if (start.size() >= 2 && bytes[0] == 0x1f && bytes[1] == 0x8b)
+            format = Gzip;
+        else if (start.size() >= 2 && isZlibHeader(bytes[0], bytes[1]))
+            format = Zlib;
+        else if (start.size() >= 6 && isZlibHeader(bytes[4], bytes[5]))
+            format = QtCompressed;
+        else
+            format = Plain;
+        if (format == QtCompressed)
+            // Skip the uncompressed size.
+            file.read(4);
+        // windowBits 15 + 32: detect zlib or gzip header.
+        status = format == Plain ? Z_OK : inflateInit2(&stream, 15 + 32);
+    }
+    if (status != Z_OK) {
+        setErrorString("Initializing zlib failed");
+        file.close();
+        return false;
+    }
+    return QIODevice::open(mode);
+}
+
+void GzipDevice::close()
+{
+    if (!isOpen())
+        return;
+    if (openMode() & QIODevice::WriteOnly) {
+        deflateBuffer(Z_FINISH);
+        deflateEnd(&stream);
+    }
+    else if (format != Plain)
+        inflateEnd(&stream);
+    QIODevice::close();
+    file.close();
+    buffer = QByteArray();
+}
+
+qint64 GzipDevice::readData(char* data, qint64 maxSize)
+{
+    if (finished)
+        return 0;
+    if (format == Plain) {
+        qint64 const size = file.read(data, maxSize);
+        if (size <= 0 || file.atEnd())
+            finished = true;
+        return size;
+    }
+    stream.next_out = reinterpret_cast<Bytef*>(data);
+    stream.avail_out = uInt(std::min(maxSize, qint64(1) << 30));
+    uInt const requested = stream.avail_out;
+    while (stream.avail_out > 0) {
+        if (stream.avail_in == 0) {
+            qint64 const size = file.read(buffer.data(), buffer.size());
+            if (size <= 0) {
+                // The compressed data end unexpectedly.
+                finished = true;
+                break;
+            }
+            stream.next_in = reinterpret_cast<Bytef*>(buffer.data());
+            stream.avail_in = uInt(size);
+        }
+        int const status = inflate(&stream, Z_NO_FLUSH);
+        if (status == Z_STREAM_END) {
+            finished = true;
+            break;
+        }
+        if (status != Z_OK && status != Z_BUF_ERROR) {
+            setErrorString(stream.msg == Z_NULL ? "Decompression failed" : stream.msg);
+            qWarning() << "Reading compressed file failed:" << errorString();
+            finished = true;
+            if (stream.avail_out == requested)
+                return -1;
+            break;
+        }
+    }
+    return requested - stream.avail_out;
+}
+
+qint64 GzipDevice::writeData(char const* data, qint64 size)
+{
+    qint64 written = 0;
+    while (written < size) {
+        uInt const chunk = uInt(std::min(size - written, qint64(1) << 30));
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data + written));
+        stream.avail_in = chunk;
+        if (!deflateBuffer(Z_NO_FLUSH))
+            return -1;
+        written += chunk;
+    }
+    return written;
+}
+
+bool GzipDevice::deflateBuffer(int const flush)
+{
+    int status;
+    do {
+        stream.next_out = reinterpret_cast<Bytef*>(buffer.data());
+        stream.avail_out = uInt(buffer.size());
+        status = deflate(&stream, flush);
+        if (status == Z_STREAM_ERROR) {
+            setErrorString("Compression failed");
+            return false;
+        }
+        qint64 const size = buffer.size() - stream.avail_out;
+        if (size > 0 && file.write(buffer.constData(), size) != size) {
+            setErrorString(file.errorString());
+            return false;
+        }
+    } while (stream.avail_out == 0 || (flush == Z_FINISH && status != Z_STREAM_END));
+    return true;
+}
+
+QByteArray const GzipDevice::compress(QByteArray const& data)
+{
+    QVector<DeflateBlock*> blocks;
+    int start = 0;
+    do {
+        int const end = std::min(start + parallelBlockSize, data.size());
+        blocks.append(new DeflateBlock(data, start, end));
+        start = end;
+    } while (start < data.size());
+    QThreadPool pool;
+    for (QVector<DeflateBlock*>::const_iterator block=blocks.cbegin(); block!=blocks.cend(); block++)
+        pool.start(*block);
+    pool.waitForDone();
+
+    // gzip header: magic, method deflate, no flags, no time, no extra flags, unknown OS.
+    static char const header[10] = {'\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, '\xff'};
+    QByteArray result(header, 10);
+    uLong crc = crc32(0, Z_NULL, 0);
+    bool ok = true;
+    for (QVector<DeflateBlock*>::const_iterator block=blocks.cbegin(); block!=blocks.cend(); block++) {
+        ok &= (*block)->ok;
+        result.append((*block)->output);
+        crc = crc32_combine(crc, (*block)->crc, (*block)->end - (*block)->start);
+    }
+    qDeleteAll(blocks);
+    if (!ok) {
+        qCritical() << "Compression failed";
+        return QByteArray();
+    }
+    // gzip trailer: CRC-32 and size of the uncompressed data.
+    uchar trailer[8];
+    qToLittleEndian<quint32>(quint32(crc), trailer);
+    qToLittleEndian<quint32>(quint32(data.size()), trailer + 4);
+    result.append(reinterpret_cast<char const*>(trailer), 8);
+    return result;
+}
@@ -0,0 +1,75 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef GZIPDEVICE_H
+#define GZIPDEVICE_H
+
+#include <QIODevice>
+#include <QFile>
+#include <QByteArray>
+#include <zlib.h>
+
+/// Sequential device for streaming a compressed file.
+/// Files are written in gzip format (as used by Xournal(++)).
+/// When reading, the format is detected: gzip, zlib, qCompress (zlib with 4 bytes length prefix,
+/// as written by earlier versions of BeamerPresenter) and uncompressed files are accepted.
+class GzipDevice : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    enum Format {
+        Plain,
+        Gzip,
+        Zlib,
+        QtCompressed,
+    };
+
+    explicit GzipDevice(QString const& filename, QObject* parent = nullptr);
+    ~GzipDevice() override;
+
+    /// Open the file ReadOnly or WriteOnly. Other modes are not supported.
+    bool open(OpenMode mode) override;
+    void close() override;
+    bool isSequential() const override {return true;}
+    bool atEnd() const override {return finished && QIODevice::bytesAvailable() == 0;}
+    /// Format of the file opened for reading.
+    Format getFormat() const {return format;}
+    /// Compress data in gzip format using all processor cores.
+    /// Blocks of the data are compressed in parallel, each using the preceding data as dictionary.
+    /// Return an empty array if compression failed.
+    static QByteArray const compress(QByteArray const& data);
+
+protected:
+    qint64 readData(char* data, qint64 maxSize) override;
+    qint64 writeData(char const* data, qint64 size) override;
+
+private:
+    QFile file;
+    z_stream stream;
+    Format format = Plain;
+    /// Compressed data read from or written to file.
+    QByteArray buffer;
+    /// Is the end of the data reached (reading)?
+    bool finished = false;
+
+    /// Write compressed data from buffer to file until deflate does not produce more output.
+    bool deflateBuffer(int const flush);
+};
+
+#endif // GZIPDEVICE_H
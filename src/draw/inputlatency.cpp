@@ -0,0 +1,98 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <limits>
+#include <QtDebug>
+#include <QElapsedTimer>
+
+#include "inputlatency.h"
+
+namespace {
+
+/// Clock shared by all instances.
+QElapsedTimer const& sharedClock()
+{
+    static QElapsedTimer clock;
+    if (!clock.isValid())
+        clock.start();
+    return clock;
+}
+
+/// Format a time in microseconds as milliseconds.
+QString const ms(qint64 const time)
+{
+    return QString::number(time/1000., 'f', 1);
+}
+
+}
+
+InputLatency::InputLatency(QString const& name) :
+    name(name),
+    offset(std::numeric_limits<qint64>::max()),
+    lastReport(now())
+{
+}
+
+qint64 InputLatency::now()
+{
+    return sharedClock().nsecsElapsed()/1000;
+}
+
+qint64 InputLatency::eventTime(ulong const timestamp)
+{
+    qint64 const received = now();
+    offset = std::min(offset, received - 1000*qint64(timestamp));
+    return 1000*qint64(timestamp) + offset;
+}
+
+void InputLatency::input(qint64 const time)
+{
+    if (oldestInput < 0 || time < oldestInput)
+        oldestInput = time;
+    if (oldestReceived < 0)
+        oldestReceived = now();
+}
+
+void InputLatency::painted()
+{
+    qint64 const time = now();
+    if (oldestInput >= 0) {
+        eventLatencies.append(time - oldestInput);
+        receiveLatencies.append(time - oldestReceived);
+        oldestInput = -1;
+        oldestReceived = -1;
+    }
+    if (time - lastReport >= reportInterval)
+        report();
+}
+
+void InputLatency::report()
+{
+    lastReport = now();
+    if (eventLatencies.isEmpty())
+        return;
+    std::sort(eventLatencies.begin(), eventLatencies.end());
+    std::sort(receiveLatencies.begin(), receiveLatencies.end());
+    int const number = eventLatencies.size();
+    qInfo().noquote() << "Input latency of" << name << QString("in ms (%1 frames): event to paint median").arg(number) << ms(eventLatencies[number/2])
+                      << "95%" << ms(eventLatencies[number*95/100]) << "max" << ms(eventLatencies.last())
+                      << "| received to paint median" << ms(receiveLatencies[number/2])
+                      << "95%" << ms(receiveLatencies[number*95/100]) << "max" << ms(receiveLatencies.last());
+    eventLatencies.clear();
+    receiveLatencies.clear();
+}
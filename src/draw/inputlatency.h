@@ -0,0 +1,73 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INPUTLATENCY_H
+#define INPUTLATENCY_H
+
+#include <QString>
+#include <QVector>
+
+/// Measurement of the time from input events to the frames showing their effect.
+/// Times are measured in microseconds on a clock shared by all instances, such that input
+/// received by one path overlay can be measured when it is painted by another one.
+/// The statistics are written as info messages every few seconds.
+///
+/// Two times are measured for each painted frame containing new input:
+/// from the oldest input event (as given by the event timestamp of the window system) and
+/// from receiving this event in the application. Event timestamps use an unknown clock.
+/// They are converted using the smallest difference between receiving an event and its
+/// timestamp, such that the first time only includes the part of the delivery delay which
+/// exceeds the minimum. The time is measured until painting the frame is finished.
+/// Showing the frame on the display adds up to one refresh interval.
+class InputLatency
+{
+private:
+    /// Name of the measured widget in the log.
+    QString const name;
+    /// Smallest observed difference between receiving an event and its timestamp.
+    qint64 offset;
+    /// Time of the oldest input which has not been painted, or -1.
+    qint64 oldestInput = -1;
+    /// Time at which oldestInput was received.
+    qint64 oldestReceived = -1;
+    /// Measured latencies since the last report.
+    QVector<qint64> eventLatencies;
+    QVector<qint64> receiveLatencies;
+    /// Time of the last report.
+    qint64 lastReport;
+
+    /// Write statistics of the measured latencies and start a new measurement.
+    void report();
+
+public:
+    /// Time between two reports in microseconds.
+    static qint64 const reportInterval = 5000000;
+
+    explicit InputLatency(QString const& name);
+
+    /// Current time on the shared clock.
+    static qint64 now();
+    /// Convert the timestamp (in ms) of an input event to the shared clock.
+    qint64 eventTime(ulong const timestamp);
+    /// Register input which happened at time and will be visible in the next painted frame.
+    void input(qint64 const time);
+    /// Register that a frame has been painted.
+    void painted();
+};
+
+#endif // INPUTLATENCY_H
@@ -0,0 +1,417 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cstring>
+#include <QtDebug>
+#include <QtEndian>
+#include <QFile>
+#include <QSaveFile>
+#include <QDataStream>
+#include <zlib.h>
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#elif defined(Q_OS_WIN)
+#include <io.h>
+#endif
+
+#include "journal.h"
+#include "annotationfile.h"
+
+char const Journal::magic[8] = {'B', 'P', 'J', 'R', 'N', 'L', '\r', '\n'};
+
+namespace {
+
+/// Tool identifiers in the journal. These must not be changed.
+quint8 const journalPen = 1;
+quint8 const journalHighlighter = 2;
+
+/// Header of a journal file.
+QByteArray const journalHeader(quint32 const generation)
+{
+    QByteArray header(Journal::magic, 8);
+    uchar bytes[8];
+    qToLittleEndian<quint32>(Journal::version, bytes);
+    qToLittleEndian<quint32>(generation, bytes + 4);
+    header.append(reinterpret_cast<char const*>(bytes), 8);
+    return header;
+}
+
+/// Make sure that all data written to file are stored on disk.
+void syncFile(QFile& file)
+{
+    file.flush();
+#ifdef Q_OS_UNIX
+    ::fsync(file.handle());
+#elif defined(Q_OS_WIN)
+    ::_commit(file.handle());
+#endif
+}
+
+/// Stream for encoding and decoding records.
+void setupStream(QDataStream& stream)
+{
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+}
+
+bool decodeRecord(QByteArray const& data, JournalRecord& record, quint32 const fileVersion)
+{
+    QDataStream stream(data);
+    setupStream(stream);
+    quint8 type;
+    stream >> type >> record.page;
+    record.type = JournalRecord::Type(type);
+    switch (record.type)
+    {
+    case JournalRecord::AddPath:
+    case JournalRecord::ExtendPath:
+    {
+        quint32 start, number;
+        stream >> record.hash >> start;
+        if (record.type == JournalRecord::AddPath) {
+            quint8 tool;
+            quint32 color;
+            float width;
+            stream >> tool >> color >> width;
+            record.tool.tool = tool == journalPen ? Pen : tool == journalHighlighter ? Highlighter : NoTool;
+            record.tool.color = QColor::fromRgba(color);
+            record.tool.size = width;
+        }
+        stream >> number;
+        // Every node requires 8 bytes.
+        if (stream.status() != QDataStream::Ok || number > quint32(data.size()/8))
+            return false;
+        if (record.type == JournalRecord::AddPath) {
+            record.index = int(start) - 1;
+            start = 0;
+        }
+        record.start = int(start);
+        record.x.resize(int(number));
+        record.y.resize(int(number));
+        for (int i=0; i<int(number); i++)
+            stream >> record.x[i];
+        for (int i=0; i<int(number); i++)
+            stream >> record.y[i];
+        if (fileVersion >= 2) {
+            record.pressure.resize(int(number));
+            for (int i=0; i<int(number); i++)
+                stream >> record.pressure[i];
+        }
+        break;
+    }
+    case JournalRecord::SplitPath:
+    {
+        quint32 number;
+        stream >> record.hash >> number;
+        if (stream.status() != QDataStream::Ok || number > quint32(data.size()/8))
+            return false;
+        record.pieces.resize(int(number));
+        for (int i=0; i<int(number); i++)
+            stream >> record.pieces[i].first >> record.pieces[i].second;
+        break;
+    }
+    case JournalRecord::RemovePath:
+        stream >> record.hash;
+        break;
+    case JournalRecord::ClearPage:
+    case JournalRecord::ClearAll:
+        break;
+    default:
+        return false;
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+}
+
+Journal::Snapshot::~Snapshot()
+{
+    for (QMap<QString, QList<DrawPath*>>::iterator page_it=paths.begin(); page_it!=paths.end(); page_it++)
+        qDeleteAll(*page_it);
+}
+
+Journal::Journal(QString const& filename, quint32 const generation, QObject* parent) :
+    QThread(parent),
+    filename(filename),
+    generation(generation)
+{
+}
+
+Journal::~Journal()
+{
+    stop();
+    wait();
+    delete pendingSnapshot;
+}
+
+bool Journal::read(QString const& filename, quint32& generation, QVector<JournalRecord>& records)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray const data = file.readAll();
+    file.close();
+    if (data.size() < 16 || std::memcmp(data.constData(), magic, 8) != 0)
+        return false;
+    uchar const* const bytes = reinterpret_cast<uchar const*>(data.constData());
+    quint32 const fileVersion = qFromLittleEndian<quint32>(bytes + 8);
+    if (fileVersion > version) {
+        qWarning() << "Journal was written by a newer version of BeamerPresenter and is ignored.";
+        return false;
+    }
+    generation = qFromLittleEndian<quint32>(bytes + 12);
+    int pos = 16;
+    while (data.size() - pos >= 8) {
+        quint32 const size = qFromLittleEndian<quint32>(bytes + pos);
+        quint32 const checksum = qFromLittleEndian<quint32>(bytes + pos + 4);
+        if (size > quint32(data.size() - pos - 8))
+            break;
+        QByteArray const payload = QByteArray::fromRawData(data.constData() + pos + 8, int(size));
+        if (quint32(crc32(0, bytes + pos + 8, size)) != checksum)
+            break;
+        JournalRecord record;
+        if (!decodeRecord(payload, record, fileVersion))
+            break;
+        records.append(record);
+        pos += 8 + int(size);
+    }
+    if (pos < data.size())
+        qWarning() << "Journal" << filename << "has a damaged end, which is ignored.";
+    return true;
+}
+
+void Journal::encodePath(QDataStream& stream, FullDrawTool const& tool, float const* x, float const* y, quint8 const* pressure, int const number)
+{
+    stream << (tool.tool == Highlighter ? journalHighlighter : journalPen) << quint32(tool.color.rgba()) << float(tool.size) << quint32(number);
+    for (int i=0; i<number; i++)
+        stream << x[i];
+    for (int i=0; i<number; i++)
+        stream << y[i];
+    for (int i=0; i<number; i++)
+        stream << pressure[i];
+}
+
+void Journal::recordOp(StrokeOp const& op)
+{
+    QByteArray record;
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    setupStream(stream);
+    switch (op.type)
+    {
+    case StrokeOp::AddPath:
+        // The start field of AddPath records is the insert position + 1 (0: append the path).
+        stream << quint8(JournalRecord::AddPath) << op.page << quint32(0) << quint32(op.index + 1);
+        encodePath(stream, *op.tool, op.arena->x() + op.first, op.arena->y() + op.first, op.arena->pressure() + op.first, op.count);
+        recordedNodes[op.newHash] = op.count;
+        break;
+    case StrokeOp::ExtendPath:
+    {
+        // Only nodes which have not been recorded yet are written.
+        int start = recordedNodes.take(op.hash);
+        if (start > op.count)
+            start = 0;
+        recordedNodes[op.newHash] = op.count;
+        if (start == op.count)
+            return;
+        stream << quint8(JournalRecord::ExtendPath) << op.page << op.hash << quint32(start) << quint32(op.count - start);
+        float const* const x = op.arena->x() + op.first + start;
+        float const* const y = op.arena->y() + op.first + start;
+        quint8 const* const pressure = op.arena->pressure() + op.first + start;
+        for (int i=0; i<op.count-start; i++)
+            stream << x[i];
+        for (int i=0; i<op.count-start; i++)
+            stream << y[i];
+        for (int i=0; i<op.count-start; i++)
+            stream << pressure[i];
+        break;
+    }
+    case StrokeOp::SplitPath:
+        recordedNodes.remove(op.hash);
+        stream << quint8(JournalRecord::SplitPath) << op.page << op.hash << quint32(op.pieces.size());
+        for (QPair<int, int> const& range : op.pieces)
+            stream << qint32(range.first) << qint32(range.second);
+        break;
+    case StrokeOp::RemovePath:
+        recordedNodes.remove(op.hash);
+        stream << quint8(JournalRecord::RemovePath) << op.page << op.hash;
+        break;
+    }
+    queue(record);
+}
+
+void Journal::recordPage(QString const& label, QList<DrawPath*> const& list)
+{
+    // The page is cleared and all paths are added again.
+    QByteArray record;
+    {
+        QDataStream stream(&record, QIODevice::WriteOnly);
+        setupStream(stream);
+        stream << quint8(JournalRecord::ClearPage) << label;
+    }
+    queue(record);
+    for (QList<DrawPath*>::const_iterator path_it=list.cbegin(); path_it!=list.cend(); path_it++) {
+        record.clear();
+        QDataStream stream(&record, QIODevice::WriteOnly);
+        setupStream(stream);
+        stream << quint8(JournalRecord::AddPath) << label << quint32(0) << quint32(0);
+        encodePath(stream, (*path_it)->getTool(), (*path_it)->x(), (*path_it)->y(), (*path_it)->pressure(), (*path_it)->number());
+        queue(record);
+        recordedNodes[(*path_it)->getHash()] = (*path_it)->number();
+    }
+}
+
+void Journal::recordClearAll()
+{
+    QByteArray record;
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    setupStream(stream);
+    stream << quint8(JournalRecord::ClearAll) << QString();
+    recordedNodes.clear();
+    queue(record);
+}
+
+void Journal::queue(QByteArray const& record)
+{
+    uchar frame[8];
+    qToLittleEndian<quint32>(quint32(record.size()), frame);
+    qToLittleEndian<quint32>(quint32(crc32(0, reinterpret_cast<Bytef const*>(record.constData()), uInt(record.size()))), frame + 4);
+    QMutexLocker locker(&mutex);
+    changed = true;
+    bool const wake = pending.isEmpty();
+    pending.append(reinterpret_cast<char const*>(frame), 8);
+    pending.append(record);
+    // The writer thread is only woken for the first record of a batch.
+    if (wake)
+        condition.wakeOne();
+}
+
+bool Journal::hasChanges() const
+{
+    QMutexLocker locker(&mutex);
+    return changed;
+}
+
+void Journal::compact(Snapshot* snapshot)
+{
+    // Nodes which are added later to unfinished paths are recorded together with all previous nodes.
+    // Such records are valid in the old and in the new journal.
+    recordedNodes.clear();
+    QMutexLocker locker(&mutex);
+    changed = false;
+    // All records which have not been written yet are contained in the snapshot. They are kept
+    // until the main file has been written, because they are still needed if writing fails.
+    delete pendingSnapshot;
+    pendingSnapshot = snapshot;
+    snapshotRecords = pending.size();
+    condition.wakeOne();
+}
+
+bool Journal::writeSnapshot(QFile& file, Snapshot const& snapshot, QByteArray const& records)
+{
+    // The main file is written before the journal is replaced. After a crash in between,
+    // the old journal has an outdated generation and is ignored.
+    QByteArray const data = AnnotationFile::serialize(snapshot.presentation, snapshot.notes, snapshot.paths, generation + 1, snapshot.rawPages);
+    if (!AnnotationFile::writeData(snapshot.file, data)) {
+        qCritical() << "Saving drawings to" << snapshot.file << "failed. Changes are kept in the journal" << filename;
+        return false;
+    }
+    file.close();
+    QSaveFile newJournal(filename);
+    if (newJournal.open(QIODevice::WriteOnly)) {
+        newJournal.write(journalHeader(generation + 1));
+        newJournal.write(records);
+        if (newJournal.commit()) {
+            generation++;
+            file.open(QIODevice::WriteOnly | QIODevice::Append);
+            return true;
+        }
+    }
+    // The old journal is outdated now. Try to overwrite it directly.
+    if (file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        file.write(journalHeader(generation + 1));
+        file.write(records);
+        syncFile(file);
+        if (file.error() == QFileDevice::NoError) {
+            generation++;
+            return true;
+        }
+        file.close();
+    }
+    qCritical() << "Cannot write journal" << filename << "- drawings are not protected against crashes.";
+    return false;
+}
+
+void Journal::stop()
+{
+    QMutexLocker locker(&mutex);
+    stopping = true;
+    condition.wakeOne();
+}
+
+void Journal::run()
+{
+    QFile file(filename);
+    mutex.lock();
+    bool const replace = pendingSnapshot == nullptr;
+    mutex.unlock();
+    if (replace) {
+        // Changes from an old journal are either included in the main file or outdated.
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qCritical() << "Cannot write journal" << filename << "- drawings are not protected against crashes.";
+            return;
+        }
+        file.write(journalHeader(generation));
+        syncFile(file);
+    }
+    forever {
+        mutex.lock();
+        while (pending.isEmpty() && pendingSnapshot == nullptr && !stopping)
+            condition.wait(&mutex);
+        // Collect the records which arrive shortly after the first one, such that they are synchronized together.
+        if (!stopping && pendingSnapshot == nullptr)
+            condition.wait(&mutex, syncInterval);
+        QByteArray batch;
+        batch.swap(pending);
+        Snapshot* const snapshot = pendingSnapshot;
+        pendingSnapshot = nullptr;
+        int const included = snapshotRecords;
+        snapshotRecords = 0;
+        bool const stop = stopping;
+        mutex.unlock();
+
+        if (snapshot != nullptr) {
+            if (writeSnapshot(file, *snapshot, batch.mid(included)))
+                batch.clear();
+            else {
+                // Keep all records in the old journal. The generation has not changed.
+                if (!file.isOpen() && !file.open(QIODevice::WriteOnly | QIODevice::Append))
+                    qCritical() << "Cannot write journal" << filename << "- drawings are not protected against crashes.";
+                mutex.lock();
+                changed = true;
+                mutex.unlock();
+            }
+            delete snapshot;
+        }
+        if (!batch.isEmpty() && file.isOpen()) {
+            file.write(batch);
+            syncFile(file);
+        }
+        if (stop)
+            break;
+    }
+    file.close();
+}
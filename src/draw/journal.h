@@ -0,0 +1,172 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QFile>
+#include <QByteArray>
+#include <QDataStream>
+#include <QHash>
+#include <QVector>
+#include <QPair>
+#include <QMap>
+#include "drawpath.h"
+#include "strokeop.h"
+#include "annotationfile.h"
+
+/// Change of the paths on one page read from a journal.
+struct JournalRecord {
+    enum Type : quint8 {
+        /// Append a new path.
+        AddPath = 1,
+        /// Append nodes to a path.
+        ExtendPath = 2,
+        /// Replace a path by pieces of it (eraser).
+        SplitPath = 3,
+        /// Remove a path (undo).
+        RemovePath = 4,
+        /// Remove all paths of a page.
+        ClearPage = 5,
+        /// Remove all paths of all pages.
+        ClearAll = 6,
+    };
+    Type type;
+    QString page;
+    /// Hash of the changed path before the change (ExtendPath, SplitPath, RemovePath).
+    quint32 hash = 0;
+    /// Tool of the path (AddPath).
+    FullDrawTool tool{NoTool, Qt::black, 0., {0.}};
+    /// Number of nodes of the path which are not contained in x and y (ExtendPath).
+    /// If start is 0, x and y contain all nodes of the path.
+    int start = 0;
+    /// Position at which the path is inserted, or -1 to append the path (AddPath).
+    int index = -1;
+    /// Coordinates of new nodes (AddPath, ExtendPath).
+    QVector<float> x;
+    QVector<float> y;
+    /// Encoded pressure of new nodes (AddPath, ExtendPath). Empty in journals of version 1.
+    QVector<quint8> pressure;
+    /// Node ranges of the pieces (SplitPath).
+    QVector<QPair<int, int>> pieces;
+};
+
+/// Append-only log of all changes of the paths, which protects drawings against crashes.
+/// The records are created in the GUI thread and written by this thread in batches:
+/// when a record arrives, the thread waits for syncInterval, writes all records which
+/// have arrived meanwhile and synchronizes the file to disk once.
+///
+/// The journal belongs to a main drawing file (see AnnotationFile). Both carry a generation number.
+/// The journal contains the changes since the main file with the same generation was written.
+/// Compacting writes a new main file and then replaces the journal by an empty journal with
+/// the next generation. A journal with a different generation than the main file is outdated.
+/// Both files are written by this thread. If one of them cannot be written, the records are
+/// kept in the old journal and the generation is not changed.
+///
+/// File format: magic (8 bytes), quint32 version, quint32 generation, followed by records.
+/// Each record is quint32 size, quint32 CRC-32 and size bytes of little endian data.
+/// Records which are damaged (e.g. by a crash while writing) and all following records are ignored.
+class Journal : public QThread
+{
+    Q_OBJECT
+
+public:
+    /// Snapshot of the drawings which is written to the main file by the writer thread.
+    struct Snapshot {
+        /// Path of the main file.
+        QString file;
+        AnnotationFile::Document presentation;
+        AnnotationFile::Document notes;
+        /// Copies of the paths (see DrawingExport::snapshot), which are deleted with the snapshot.
+        QMap<QString, QList<DrawPath*>> paths;
+        /// Pages of a binary drawing file which have not been read (see AnnotationFile::pageData).
+        QMap<QString, QByteArray> rawPages;
+        ~Snapshot();
+    };
+
+private:
+    /// Time in ms during which records are collected before they are written.
+    static int const syncInterval = 200;
+    /// Path of the journal file.
+    QString const filename;
+    /// Generation of the journal. Only accessed in the writer thread after it has been started.
+    quint32 generation;
+    /// Number of nodes of each unfinished path (identified by hash) which have been recorded.
+    /// This allows to record only new nodes when a path is extended.
+    QHash<quint32, int> recordedNodes;
+
+    // Shared with the writer thread, protected by mutex.
+    mutable QMutex mutex;
+    QWaitCondition condition;
+    /// Records which have not been written yet.
+    QByteArray pending;
+    /// Snapshot which should be written to the main file, or nullptr.
+    Snapshot* pendingSnapshot = nullptr;
+    /// Number of bytes at the beginning of pending which are contained in pendingSnapshot.
+    int snapshotRecords = 0;
+    /// Are there records which have not been compacted into the main file?
+    bool changed = false;
+    bool stopping = false;
+
+    /// Add a record to the queue of the writer thread.
+    void queue(QByteArray const& record);
+    /// Write the main file of snapshot and replace the journal by a journal of the next generation
+    /// containing records. Return false if the generation could not be changed.
+    bool writeSnapshot(QFile& file, Snapshot const& snapshot, QByteArray const& records);
+    /// Encode a path as tool and nodes.
+    static void encodePath(QDataStream& stream, FullDrawTool const& tool, float const* x, float const* y, quint8 const* pressure, int const number);
+
+public:
+    /// First 8 bytes of every journal file.
+    static char const magic[8];
+    /// Version 2 added the pressure of the nodes.
+    static quint32 const version = 2;
+
+    /// Create a journal for filename with given generation.
+    /// The file is replaced when the thread starts, except if compact is called before.
+    Journal(QString const& filename, quint32 const generation, QObject* parent = nullptr);
+    ~Journal();
+
+    /// Read all valid records from filename. Return false if the file is not a journal.
+    static bool read(QString const& filename, quint32& generation, QVector<JournalRecord>& records);
+
+    // The following functions must be called in the GUI thread.
+    /// Record an operation which has been applied to the paths.
+    void recordOp(StrokeOp const& op);
+    /// Record that all paths of a page have been replaced by list.
+    void recordPage(QString const& label, QList<DrawPath*> const& list);
+    /// Record that all paths have been removed.
+    void recordClearAll();
+    /// Are there records which have not been compacted into the main file?
+    bool hasChanges() const;
+    /// Write snapshot, which must contain all recorded changes, to its main file and start a new
+    /// journal with the next generation. The journal takes ownership of snapshot.
+    /// The snapshot is serialized in the writer thread.
+    void compact(Snapshot* snapshot);
+    /// Write all records and stop the thread.
+    void stop();
+
+protected:
+    /// Write records until stop is called.
+    void run() override;
+};
+
+#endif // JOURNAL_H
@@ -0,0 +1,92 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <QPainter>
+#ifdef DEBUG_DRAWING
+#include <QtDebug>
+#include <QElapsedTimer>
+#endif
+
+#include "layerrenderer.h"
+
+LayerRenderer::LayerRenderer(QString const& label, QList<DrawPath*> const& paths, QSize const& size, QTransform const& transform, QObject* parent) :
+    QThread(parent),
+    label(label),
+    paths(paths),
+    size(size),
+    transform(transform)
+{
+    hashes.reserve(paths.length());
+    for (QList<DrawPath*>::const_iterator path_it=paths.cbegin(); path_it!=paths.cend(); path_it++)
+        hashes.append((*path_it)->getHash());
+}
+
+LayerRenderer::~LayerRenderer()
+{
+    requestInterruption();
+    wait();
+    qDeleteAll(paths);
+}
+
+bool LayerRenderer::matches(QList<DrawPath*> const& list) const
+{
+    if (list.length() < hashes.length())
+        return false;
+    for (int i=0; i<hashes.length(); i++) {
+        if (list[i]->getHash() != hashes[i])
+            return false;
+    }
+    return true;
+}
+
+void LayerRenderer::run()
+{
+#ifdef DEBUG_DRAWING
+    QElapsedTimer timer;
+    timer.start();
+#endif
+    // Like in PathOverlay::cachePage, the image for highlighters is only created if the page contains highlighters.
+    pens = QImage(size, QImage::Format_ARGB32_Premultiplied);
+    pens.fill(QColor(0,0,0,0));
+    QPainter painter;
+    for (DrawTool const pathTool : {Pen, Highlighter}) {
+        for (QList<DrawPath*>::const_iterator path_it=paths.cbegin(); path_it!=paths.cend(); path_it++) {
+            if ((*path_it)->getTool().tool != pathTool)
+                continue;
+            if (isInterruptionRequested())
+                break;
+            if (!painter.isActive()) {
+                QImage& image = pathTool == Pen ? pens : highlighters;
+                if (image.isNull()) {
+                    image = QImage(size, QImage::Format_ARGB32_Premultiplied);
+                    image.fill(QColor(0,0,0,0));
+                }
+                painter.begin(&image);
+                painter.setRenderHint(QPainter::Antialiasing);
+                // Highlighters darken everything below them.
+                painter.setCompositionMode(pathTool == Highlighter ? QPainter::CompositionMode_Darken : QPainter::CompositionMode_SourceOver);
+                painter.setWorldTransform(transform);
+            }
+            (*path_it)->draw(painter);
+        }
+        if (painter.isActive())
+            painter.end();
+    }
+#ifdef DEBUG_DRAWING
+    qDebug() << "Rendered layer" << label << "with" << paths.length() << "paths in" << timer.nsecsElapsed()/1000 << "us";
+#endif
+}
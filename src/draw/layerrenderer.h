@@ -0,0 +1,76 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LAYERRENDERER_H
+#define LAYERRENDERER_H
+
+#include <QThread>
+#include <QList>
+#include <QVector>
+#include <QImage>
+#include <QSize>
+#include <QTransform>
+#include "drawpath.h"
+
+/// Thread drawing the paths of one page into images, such that the layer of an upcoming page
+/// is prepared without blocking the GUI thread (see PathOverlay::prepareNextPage).
+/// Pixmaps can only be painted in the GUI thread. The images are converted to pixmaps when
+/// the layer is installed.
+class LayerRenderer : public QThread
+{
+    Q_OBJECT
+
+public:
+    /// Create a renderer for the page with given label. paths are copies which share the nodes with
+    /// the original paths (see DrawingExport::snapshot). The renderer takes ownership of them.
+    /// size and transform are the geometry of the layer.
+    LayerRenderer(QString const& label, QList<DrawPath*> const& paths, QSize const& size, QTransform const& transform, QObject* parent = nullptr);
+    /// Stop drawing and delete the paths.
+    ~LayerRenderer();
+
+    QString const& getLabel() const {return label;}
+    QSize const& getSize() const {return size;}
+    QTransform const& getTransform() const {return transform;}
+    /// Number of paths contained in the images.
+    int getEnd() const {return paths.length();}
+    /// Return true if the paths in list with index < getEnd() are the paths which were drawn.
+    bool matches(QList<DrawPath*> const& list) const;
+
+    // The following functions must only be called after the thread has finished.
+    /// Pens.
+    QImage const& getPens() const {return pens;}
+    /// Highlighters, or a null image if the page contains no highlighters.
+    QImage const& getHighlighters() const {return highlighters;}
+
+protected:
+    /// Draw the paths to the images.
+    void run() override;
+
+private:
+    QString const label;
+    /// Copies of the paths referencing copies of the arenas.
+    QList<DrawPath*> paths;
+    /// Hashes of the original paths.
+    QVector<quint32> hashes;
+    QSize const size;
+    QTransform const transform;
+    QImage pens;
+    QImage highlighters;
+};
+
+#endif // LAYERRENDERER_H
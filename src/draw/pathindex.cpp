@@ -0,0 +1,162 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cmath>
+#include <algorithm>
+
+#include "pathindex.h"
+
+void PathIndex::build(QList<DrawPath*> const& list)
+{
+    clear();
+    for (QList<DrawPath*>::const_iterator it = list.cbegin(); it != list.cend(); it++)
+        insert(*it, ++top);
+}
+
+void PathIndex::clear()
+{
+    cells.clear();
+    entries.clear();
+    bounds = QRect();
+    top = 0;
+}
+
+void PathIndex::append(DrawPath* path)
+{
+    insert(path, ++top);
+}
+
+void PathIndex::insert(DrawPath* path, quint64 const z)
+{
+    Entry& entry = entries[path];
+    entry.z = z;
+    entry.indexed = 0;
+    entry.cells.clear();
+    addSegments(path, entry);
+}
+
+void PathIndex::extend(DrawPath* path)
+{
+    QHash<DrawPath const*, Entry>::iterator it = entries.find(path);
+    if (it == entries.end())
+        append(path);
+    else
+        addSegments(path, *it);
+}
+
+void PathIndex::addSegments(DrawPath* path, Entry& entry)
+{
+    int const number = path->number();
+    if (number == 0)
+        return;
+    float const* const px = path->x();
+    float const* const py = path->y();
+    qreal const margin = path->getTool().size/2 + 1.;
+    // Register the segments ending at the nodes which have not been indexed yet.
+    // A path consisting of a single node is treated as a segment of length 0.
+    for (int i = entry.indexed; i < number; i++) {
+        int const j = i == 0 ? 0 : i-1;
+        addSegment(path, entry, QRectF(QPointF(px[j], py[j]), QPointF(px[i], py[i])).normalized(), margin);
+    }
+    entry.indexed = number;
+    // The segment from the last node to the tail is drawn, but the tail can still change.
+    // Cells which are only touched by previous tails stay registered, this does not affect the results.
+    if (path->hasTail())
+        addSegment(path, entry, QRectF(QPointF(px[number-1], py[number-1]), path->getTail()).normalized(), margin);
+}
+
+void PathIndex::addSegment(DrawPath* path, Entry& entry, QRectF const& rect, qreal const margin)
+{
+    int const left   = int(std::floor((rect.left() - margin) / cellSize));
+    int const right  = int(std::floor((rect.right() + margin) / cellSize));
+    int const upper  = int(std::floor((rect.top() - margin) / cellSize));
+    int const lower  = int(std::floor((rect.bottom() + margin) / cellSize));
+    bounds |= QRect(QPoint(left, upper), QPoint(right, lower));
+    for (int x = left; x <= right; x++) {
+        for (int y = upper; y <= lower; y++) {
+            quint32 const k = key(x, y);
+            if (entry.cells.contains(k))
+                continue;
+            entry.cells.insert(k);
+            cells[k].append(path);
+        }
+    }
+}
+
+void PathIndex::replace(DrawPath const* path, QList<DrawPath*> const& pieces)
+{
+    quint64 const z = stackingKey(path);
+    remove(path);
+    for (QList<DrawPath*>::const_iterator it = pieces.cbegin(); it != pieces.cend(); it++)
+        insert(*it, z);
+}
+
+void PathIndex::remove(DrawPath const* path)
+{
+    QHash<DrawPath const*, Entry>::iterator it = entries.find(path);
+    if (it == entries.end())
+        return;
+    for (quint32 const k : it->cells) {
+        QHash<quint32, QVector<DrawPath*>>::iterator cell = cells.find(k);
+        if (cell == cells.end())
+            continue;
+        cell->removeOne(const_cast<DrawPath*>(path));
+        if (cell->isEmpty())
+            cells.erase(cell);
+    }
+    entries.erase(it);
+}
+
+quint64 PathIndex::stackingKey(DrawPath const* path) const
+{
+    QHash<DrawPath const*, Entry>::const_iterator it = entries.constFind(path);
+    if (it == entries.cend())
+        return 0;
+    return it->z;
+}
+
+QVector<DrawPath*> const PathIndex::candidates(QRectF const& rect, quint64 const minKey) const
+{
+    QVector<QPair<quint64, DrawPath*>> found;
+    if (entries.isEmpty() || rect.isEmpty())
+        return QVector<DrawPath*>();
+    QRect const range = QRect(
+                QPoint(int(std::floor(rect.left() / cellSize)), int(std::floor(rect.top() / cellSize))),
+                QPoint(int(std::floor(rect.right() / cellSize)), int(std::floor(rect.bottom() / cellSize)))
+                ) & bounds;
+    for (int x = range.left(); x <= range.right(); x++) {
+        for (int y = range.top(); y <= range.bottom(); y++) {
+            QHash<quint32, QVector<DrawPath*>>::const_iterator cell = cells.constFind(key(x, y));
+            if (cell == cells.cend())
+                continue;
+            for (DrawPath* const path : *cell) {
+                quint64 const z = entries.constFind(path)->z;
+                if (z >= minKey)
+                    found.append(qMakePair(z, path));
+            }
+        }
+    }
+    // Sort by stacking key and remove duplicates (paths which are contained in several cells).
+    std::sort(found.begin(), found.end());
+    QVector<DrawPath*> result;
+    result.reserve(found.size());
+    for (int i = 0; i < found.size(); i++) {
+        if (i == 0 || found[i].second != found[i-1].second || found[i].first != found[i-1].first)
+            result.append(found[i].second);
+    }
+    return result;
+}
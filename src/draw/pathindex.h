@@ -0,0 +1,87 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PATHINDEX_H
+#define PATHINDEX_H
+
+#include <QHash>
+#include <QSet>
+#include <QVector>
+#include <QList>
+#include <QRect>
+#include <QRectF>
+#include "drawpath.h"
+
+/// Spatial index for the paths on one page.
+/// The area is divided in a uniform grid. Each path is registered in all grid cells
+/// which are touched by the bounding box of one of its segments.
+/// Every path has a stacking key, which does not decrease along the list of paths of the page.
+/// This allows to return the paths in a region in the order in which they are drawn.
+class PathIndex
+{
+private:
+    struct Entry {
+        /// Stacking key: paths with a larger key are drawn later.
+        quint64 z;
+        /// Number of nodes which have already been registered in the grid.
+        int indexed;
+        /// Keys of all grid cells containing this path.
+        /// A set, because every segment of a long path checks whether its cells are registered.
+        QSet<quint32> cells;
+    };
+    /// Width and height of a grid cell in points.
+    qreal const cellSize;
+    /// Stacking key of the path on top.
+    quint64 top = 0;
+    /// Range of cell coordinates which contain any path.
+    QRect bounds;
+    /// Paths registered in each grid cell.
+    QHash<quint32, QVector<DrawPath*>> cells;
+    QHash<DrawPath const*, Entry> entries;
+
+    static quint32 key(int const x, int const y) {return (quint32(quint16(x)) << 16) | quint16(y);}
+    /// Register path with given stacking key.
+    void insert(DrawPath* path, quint64 const z);
+    /// Register all segments of path which have not been registered yet.
+    void addSegments(DrawPath* path, Entry& entry);
+    /// Register path in all cells touched by rect enlarged by margin.
+    void addSegment(DrawPath* path, Entry& entry, QRectF const& rect, qreal const margin);
+
+public:
+    explicit PathIndex(qreal const cellSize = 32.) : cellSize(cellSize) {}
+
+    /// Clear the index and register all paths in list.
+    void build(QList<DrawPath*> const& list);
+    void clear();
+    /// Register a new path on top of all other paths.
+    void append(DrawPath* path);
+    /// Register nodes which have been appended to path since it was indexed.
+    void extend(DrawPath* path);
+    /// Replace path by the pieces obtained from splitting it. The pieces inherit the stacking key of path.
+    void replace(DrawPath const* path, QList<DrawPath*> const& pieces);
+    void remove(DrawPath const* path);
+
+    bool contains(DrawPath const* path) const {return entries.contains(path);}
+    int size() const {return entries.size();}
+    /// Stacking key of path or 0 if path is not indexed.
+    quint64 stackingKey(DrawPath const* path) const;
+    /// All paths with stacking key >= minKey which might intersect rect, in drawing order.
+    QVector<DrawPath*> const candidates(QRectF const& rect, quint64 const minKey = 0) const;
+};
+
+#endif // PATHINDEX_H
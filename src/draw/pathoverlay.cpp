@@ -16,8 +16,16 @@
  * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
  */
 #include <cmath>
+#include <QSet>
+#include <QScreen>
+#include <QXmlStreamReader>
+#ifdef DEBUG_DRAWING
+#include <QElapsedTimer>
+#endif
 
 #include "pathoverlay.h"
+#include "gzipdevice.h"
+#include "drawingexport.h"
 #include "../slide/drawslide.h"
 #include "../names.h"
 
@@ -39,44 +47,134 @@ bool operator<(FullDrawTool tool1, FullDrawTool tool2)
 }
 
 
+/// Number of path overlays which have been created. Used to identify the sender of operations.
+static quint32 overlayCounter = 0;
+
+/// Input points which are more than this time (in ms) apart are not used for predicting strokes.
+static ulong const maxPredictionGap = 50;
+
+/// Time (in ms) without changes of the current page after which the layer of the next page is prepared.
+static int const prepareDelay = 200;
+
+/// Image of an antialiased disc with given radius and color, centered in an image of even size with at least margin pixels around the disc.
+static QImage const discSprite(qreal const radius, QColor const& color, int const margin = 1)
+{
+    int const size = 2*(int(std::ceil(radius)) + margin);
+    QImage image(size, size, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setPen(Qt::NoPen);
+    painter.setBrush(color);
+    painter.drawEllipse(QPointF(size/2., size/2.), radius, radius);
+    return image;
+}
+
+/// Do the sprites rendered for tool1 also show tool2?
+static bool sameSprite(FullDrawTool const& tool1, FullDrawTool const& tool2)
+{
+    if (tool1.tool != tool2.tool || tool1.color != tool2.color || tool1.size != tool2.size)
+        return false;
+    if (tool1.tool == Pointer)
+        return tool1.extras.pointer.alpha == tool2.extras.pointer.alpha
+                && tool1.extras.pointer.composition == tool2.extras.pointer.composition
+                && tool1.extras.pointer.inner == tool2.extras.pointer.inner;
+    return true;
+}
+
+/// Description of a PDF document for a binary drawing file.
+static AnnotationFile::Document const annotationDocument(PdfDoc const* doc)
+{
+    AnnotationFile::Document document;
+    document.file = QFileInfo(doc->getPath()).absoluteFilePath();
+    document.modified = doc->getLastModified().toString("yyyy-MM-dd hh:mm:ss");
+    document.pages = quint32(doc->getDoc()->numPages());
+    return document;
+}
+
 PathOverlay::PathOverlay(DrawSlide* parent) :
     QWidget(parent),
-    master(parent)
+    master(parent),
+    overlayId(++overlayCounter)
 {
     setAttribute(Qt::WA_TranslucentBackground);
     setAttribute(Qt::WA_AlwaysStackOnTop);
     setAttribute(Qt::WA_AcceptTouchEvents);
     if (!master->isPresentation())
         setMouseTracking(true);
+    // Operations from the other path overlay are applied at most once per frame.
+    syncTimer.setSingleShot(true);
+    QScreen const* screen = QGuiApplication::primaryScreen();
+    syncTimer.setInterval(screen != nullptr && screen->refreshRate() > 1. ? int(1000/screen->refreshRate()) : 16);
+    connect(&syncTimer, &QTimer::timeout, this, &PathOverlay::applyStrokeOps);
+    frameTimer.setSingleShot(true);
+    frameTimer.setInterval(syncTimer.interval());
+    connect(&frameTimer, &QTimer::timeout, this, &PathOverlay::flushInput);
+    connect(&journalTimer, &QTimer::timeout, this, &PathOverlay::compactJournal);
+    prepareTimer.setSingleShot(true);
+    prepareTimer.setInterval(prepareDelay);
+    connect(&prepareTimer, &QTimer::timeout, this, &PathOverlay::prepareNextPage);
 }
 
 PathOverlay::~PathOverlay()
 {
+    closeJournal();
+    delete layerRenderer;
     clearAllAnnotations();
     delete enlargedPageRenderer;
+    delete latency;
+}
+
+void PathOverlay::setLatencyLog(bool const enable)
+{
+    if (enable && latency == nullptr)
+        latency = new InputLatency(master->isPresentation() ? "presentation" : "control screen");
+    else if (!enable) {
+        delete latency;
+        latency = nullptr;
+    }
 }
 
 void PathOverlay::clearAllAnnotations()
 {
+    applyStrokeOps();
     for (QMap<QString, QList<DrawPath*>>::iterator it=paths.begin(); it!=paths.end(); it++) {
         qDeleteAll(*it);
         it->clear();
     }
     paths.clear();
-    end_cache = -1;
-    if (!pixpaths.isNull())
-        pixpaths = QPixmap();
+    clearHistory();
+    arenas.clear();
+    invalidatePathIndex();
+    layers.clear();
+    lazyPages.clear();
+    lazyLabels.clear();
+    delete xmlLoader;
+    xmlLoader = nullptr;
+    xmlLoaderPaths.clear();
+    if (journal != nullptr)
+        journal->recordClearAll();
     update();
 }
 
 void PathOverlay::clearPageAnnotations()
 {
-    end_cache = -1;
-    if (!pixpaths.isNull())
-        pixpaths = QPixmap();
+    applyStrokeOps();
+    if (master->page != nullptr)
+        removeLazyPage(master->page->label());
+    if (master->page != nullptr && xmlLoader != nullptr) {
+        xmlLoader->remove(master->page->label());
+        xmlLoaderPaths.remove(master->page->label());
+    }
+    if (master->page != nullptr && journal != nullptr)
+        journal->recordPage(master->page->label(), QList<DrawPath*>());
     if (master->page != nullptr && paths.contains(master->page->label())) {
         qDeleteAll(paths[master->page->label()]);
         paths[master->page->label()].clear();
+        clearHistory(master->page->label());
+        layers.remove(master->page->label());
+        arenas.remove(master->page->label());
+        invalidatePathIndex(master->page->label());
         update();
         updateEnlargedPage();
     }
@@ -91,74 +189,21 @@ void PathOverlay::paintEvent(QPaintEvent* event)
 #endif
     QPainter painter(this);
     painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-    if (end_cache >= 0)
-        painter.drawPixmap(0, 0, pixpaths);
     if (master->page == nullptr)
         return;
     painter.setRenderHint(QPainter::Antialiasing);
     drawPaths(painter, master->page->label(), event->region());
     if (!pointerPosition.isNull() || !stylusPosition.isNull()) {
-        FullDrawTool const* thetool = &tool;
-        QPointF const* position = &pointerPosition;
         // Choose stylus as current tool if it has nonzero position.
-        if (!stylusPosition.isNull()) {
-            thetool = &stylusTool;
-            position = &stylusPosition;
-        }
-        switch (thetool->tool) {
-        case Pointer:
-            if (thetool->extras.pointer.alpha > 0 && thetool->extras.pointer.composition != 0) {
-                if (thetool->extras.pointer.composition == 1)
-                    painter.setCompositionMode(QPainter::CompositionMode_Lighten);
-                else
-                    painter.setCompositionMode(QPainter::CompositionMode_Darken);
-                QColor color = thetool->color;
-                color.setAlpha(thetool->extras.pointer.alpha);
-                painter.setPen(QPen(color, thetool->size, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
-                painter.drawPoint(*position);
-            }
-            if (thetool->extras.pointer.inner) {
-                painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-                painter.setPen(QPen(thetool->color, thetool->size/3, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
-                painter.drawPoint(*position);
-            }
-            if (thetool->extras.pointer.composition == 1)
-                painter.setCompositionMode(QPainter::CompositionMode_Darken);
-            else if (thetool->extras.pointer.composition == -1)
-                painter.setCompositionMode(QPainter::CompositionMode_Lighten);
-            else
-                painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-            painter.setPen(QPen(thetool->color, thetool->size, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
-            painter.drawPoint(*position);
-            break;
-        case Torch:
-        {
-            painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-            QPainterPath rectpath;
-            rectpath.addRect(master->shiftx, master->shifty, master->pixmap.width(), master->pixmap.height());
-            QPainterPath circpath;
-            circpath.addEllipse(*position, thetool->size, thetool->size);
-            painter.fillPath(rectpath-circpath, thetool->color);
-            break;
-        }
-        case Magnifier:
-            if (!enlargedPage.isNull()) {
-                painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-                painter.setClipping(true);
-                QPainterPath path;
-                path.addEllipse(*position, thetool->size, thetool->size);
-                painter.setClipPath(path, Qt::ReplaceClip);
-                painter.drawPixmap(QRectF(position->x()-thetool->size, position->y()-thetool->size, 2*thetool->size, 2*thetool->size),
-                                  enlargedPage,
-                                  QRectF(thetool->extras.magnification*position->x() - thetool->size, thetool->extras.magnification*position->y() - thetool->size, 2*thetool->size, 2*thetool->size));
-                painter.setPen(QPen(thetool->color, 2));
-                painter.drawEllipse(*position, thetool->size, thetool->size);
-            }
-            break;
-        default:
-            break;
-        }
+        if (!stylusPosition.isNull() && stylusTool.tool == Magnifier)
+            drawMagnifier(painter, stylusTool, stylusPosition);
+        else if (stylusPosition.isNull() && tool.tool == Magnifier)
+            drawMagnifier(painter, tool, pointerPosition);
+        else
+            drawPointer(painter);
     }
+    if (latency != nullptr)
+        latency->painted();
 #ifdef DEBUG_PAINT_EVENTS
     qDebug() << "end paint path overlays" << this;
 #endif
@@ -166,15 +211,15 @@ void PathOverlay::paintEvent(QPaintEvent* event)
 
 void PathOverlay::rescale(qint16 const oldshiftx, qint16 const oldshifty, double const oldRes)
 {
-    end_cache = -1;
+    // Paths are stored in page coordinates and need no adjustment.
+    Q_UNUSED(oldshiftx)
+    Q_UNUSED(oldshifty)
+    // Cached layers do not match the new geometry.
+    layers.clear();
     enlargedPage = QPixmap();
     delete enlargedPageRenderer;
     enlargedPageRenderer = nullptr;
     eraserSize *= master->getResolution()/oldRes;
-    QPointF shift = QPointF(master->shiftx, master->shifty) - master->resolution/oldRes*QPointF(oldshiftx, oldshifty);
-    for (QMap<QString, QList<DrawPath*>>::iterator page_it = paths.begin(); page_it != paths.end(); page_it++)
-        for (QList<DrawPath*>::iterator path_it = page_it->begin(); path_it != page_it->end(); path_it++)
-            (*path_it)->transform(shift, master->resolution/oldRes);
 }
 
 void PathOverlay::setTool(FullDrawTool const& newtool, qreal const resolution)
@@ -246,110 +291,235 @@ void PathOverlay::updatePathCache()
 {
     if (master->page == nullptr)
         return;
+    // The cache must contain all paths which the other overlay has finished.
+    applyStrokeOps();
+    cachePage(master->page->label());
+    // The next page is prepared when the current page has not changed for a while.
+    prepareTimer.start();
+}
+
+void PathOverlay::prepareNextPage()
+{
+    if (master->page == nullptr || !isVisible())
+        return;
+    applyStrokeOps();
+    QString const& label = master->doc->getLabel(master->doc->getNextSlideIndex(master->page->label()));
+    if (label == master->page->label())
+        return;
+    // Pages which have not been parsed yet are prepared when they are shown.
+    loadPage(label, false);
+    if (paths.value(label).isEmpty())
+        return;
 #ifdef DEBUG_DRAWING
-    qDebug() << "update path cache" << end_cache << this;
+    qDebug() << "prepare path cache" << label << this;
 #endif
-    if (paths[master->page->label()].isEmpty()) {
-        end_cache = -1;
-        if (!pixpaths.isNull())
-            pixpaths = QPixmap();
+    if (pageLayer(label) != nullptr) {
+        // Only the paths added since the layer was drawn are missing.
+        cachePage(label);
+        return;
     }
-    else {
-        if (pixpaths.isNull())
-            end_cache = -1;
-        if (end_cache == -1) {
-            pixpaths = QPixmap(size());
-            pixpaths.fill(QColor(0,0,0,0));
-        }
-        QPainter painter;
-        painter.begin(&pixpaths);
-        painter.setRenderHint(QPainter::Antialiasing);
-        drawPaths(painter, master->page->label(), QRegion(rect()), false, true);
+    // The next page is prepared again when the running renderer has finished (see installLayer).
+    if (layerRenderer != nullptr)
+        return;
+    // The renderer draws copies of the paths, such that the paths can be changed in the meantime.
+    QMap<QString, QList<DrawPath*>> page;
+    page.insert(label, paths[label]);
+    layerRenderer = new LayerRenderer(label, DrawingExport::snapshot(page).value(label), size(), pageTransform(), this);
+    connect(layerRenderer, &QThread::finished, this, &PathOverlay::installLayer);
+    layerRenderer->start(QThread::LowPriority);
+}
+
+void PathOverlay::installLayer()
+{
+    if (layerRenderer == nullptr || layerRenderer->isRunning())
+        return;
+    LayerRenderer* const renderer = layerRenderer;
+    layerRenderer = nullptr;
+    QString const label = renderer->getLabel();
+    // The paths or the geometry may have changed while the layer was drawn.
+    if (renderer->getSize() == size() && renderer->getTransform() == pageTransform() && pageLayer(label) == nullptr && renderer->matches(paths.value(label))) {
+        PathLayer& layer = layers[label];
+        layer.pixmap = QPixmap::fromImage(renderer->getPens());
+        if (!renderer->getHighlighters().isNull())
+            layer.highlight = QPixmap::fromImage(renderer->getHighlighters());
+        layer.highlightArea = highlighterArea(label, 0, renderer->getEnd(), QRegion(rect()));
+        layer.transform = renderer->getTransform();
+        layer.end = renderer->getEnd();
+        layer.lastUse = ++layerClock;
+        limitLayerMemory();
+        if (master->page != nullptr && master->page->label() == label)
+            update();
     }
+    delete renderer;
+    // The page may have changed while the layer was drawn.
+    if (master->page != nullptr && label != master->doc->getLabel(master->doc->getNextSlideIndex(master->page->label())))
+        prepareTimer.start();
 }
 
-void PathOverlay::drawPaths(QPainter &painter, QString const& label, QRegion const& region, bool const plain, bool const toCache)
+void PathOverlay::cachePage(QString const& label)
 {
+    // Drawing the page must not wait for the XML file.
+    loadPage(label, false);
 #ifdef DEBUG_DRAWING
-    qDebug() << "draw paths" << label << plain << toCache << end_cache << this;
+    qDebug() << "update path cache" << label << layers.value(label).end << this;
 #endif
-    // TODO: reorganize the different conditions (especially plain)
-
-    // Draw edges of the slide: If they are not drawn explicitly, they can be transparent.
-    // Drawing with the highlighter on transparent edges can look ugly.
-    painter.setCompositionMode(QPainter::CompositionMode_DestinationOver);
-
-    // Draw the paths.
-    if (paths.contains(label)) {
-        QList<DrawPath*>::const_iterator path_it = paths[label].cbegin();
-        if (!plain) {
-            // If end_cache >= 0: some paths have been drawn already. Skip them.
-            if (label == master->page->label() && end_cache > 0)
-                path_it += end_cache;
+    QList<DrawPath*> const& list = paths[label];
+    if (list.isEmpty()) {
+        layers.remove(label);
+        return;
+    }
+    PathLayer& layer = layers[label];
+    if (layer.pixmap.size() != size() || layer.transform != pageTransform()) {
+        layer.pixmap = QPixmap(size());
+        layer.pixmap.fill(QColor(0,0,0,0));
+        layer.highlight = QPixmap();
+        layer.highlightArea = QRegion();
+        layer.transform = pageTransform();
+        layer.end = 0;
+        layer.damage = QRegion();
+    }
+    layer.lastUse = ++layerClock;
+    if (layer.damage.isEmpty())
+        layer.highlightArea += highlighterArea(label, layer.end, list.length(), QRegion(rect()));
+    else
+        layer.highlightArea = highlighterArea(label, 0, list.length(), QRegion(rect()));
+    QPainter painter;
+    for (DrawTool const pathTool : {Pen, Highlighter}) {
+        QPixmap& pixmap = pathTool == Pen ? layer.pixmap : layer.highlight;
+        // The pixmap for highlighters is only created when the first highlighter is cached.
+        bool const created = pathTool == Highlighter && pixmap.isNull();
+        if (created) {
+            if (layer.highlightArea.isEmpty())
+                continue;
+            pixmap = QPixmap(size());
+            pixmap.fill(QColor(0,0,0,0));
         }
-        // Iterate over all remaining paths.
-        for (; path_it!=paths[label].cend(); path_it++) {
-            if (region.intersects((*path_it)->getOuterDrawing().toAlignedRect())) {
-                FullDrawTool const& tool = (*path_it)->getTool();
-                switch (tool.tool) {
-                case Pen:
-                    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-                    painter.setPen(QPen(tool.color, tool.size, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
-                    painter.drawPolyline((*path_it)->data(), (*path_it)->number());
-                    break;
-                case Highlighter:
-                {
-                    if (!plain) {
-                        // Highlighter needs a background to draw on (because of CompositionMode_Darken).
-                        // Drawing this background is only reasonable if there is no video widget in the background.
-                        // Check this.
-                        QRect const outer = (*path_it)->getOuterDrawing().toAlignedRect();
-                        if (hasVideoOverlap(outer)) {
-                            if (toCache) {
-                                end_cache = path_it - paths[label].cbegin();
+        painter.begin(&pixmap);
+        painter.setRenderHint(QPainter::Antialiasing);
+        if (!created && !layer.damage.isEmpty()) {
+            // Only the damaged region is cleared and drawn again.
 #ifdef DEBUG_DRAWING
-                                qDebug() << "Stopped caching paths:" << end_cache;
+            qDebug() << "Repair path cache" << pathTool << layer.damage.boundingRect();
 #endif
-                                return;
-                            }
-                        }
-                        else {
-                            // Draw the background form master->pixmap.
-                            painter.setCompositionMode(QPainter::CompositionMode_DestinationOver);
-                            painter.drawPixmap(outer, master->pixmap, outer.translated(-master->shiftx, -master->shifty));
-                            if (
-                                    (master->shiftx > 0 && ( outer.left() < master->shiftx || outer.right() > master->shiftx + master->pixmap.width() ) )
-                                    || (master->shifty > 0 && ( outer.top() < master->shifty || outer.bottom() > master->shifty + master->pixmap.height() ) )
-                                 ) {
-                                painter.fillRect(outer, QBrush(master->parentWidget()->palette().base()));
-                            }
-                        }
-                    }
-                    // Draw the highlighter path.
-                    painter.setCompositionMode(QPainter::CompositionMode_Darken);
-                    painter.setPen(QPen(tool.color, tool.size, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
-                    painter.drawPolyline((*path_it)->data(), (*path_it)->number());
+            painter.setClipRegion(layer.damage);
+            painter.setCompositionMode(QPainter::CompositionMode_Clear);
+            painter.fillRect(layer.damage.boundingRect(), QColor(0,0,0,0));
+            drawPathRange(painter, label, 0, layer.end, layer.damage, pathTool);
+            painter.setClipping(false);
+        }
+        // Paths which are not contained in the layer yet are added on top.
+        drawPathRange(painter, label, created ? 0 : layer.end, list.length(), QRegion(rect()), pathTool);
+        painter.end();
+    }
+    layer.damage = QRegion();
+    layer.end = list.length();
+    limitLayerMemory();
+}
+
+void PathOverlay::drawPaths(QPainter &painter, QString const& label, QRegion const& region, bool const plain)
+{
+#ifdef DEBUG_DRAWING
+    qDebug() << "draw paths" << label << plain << this;
+#endif
+    // Pages of an XML file which are not parsed yet are added when they are parsed (see xmlPageParsed).
+    loadPage(label, false);
+    if (!paths.contains(label))
+        return;
+    PathLayer* const layer = plain ? nullptr : pageLayer(label);
+    int const first = layer == nullptr ? 0 : layer->end;
+    int const end = paths[label].length();
+    if (!plain) {
+        // Highlighters need a background to draw on (because of CompositionMode_Darken).
+        // The slide is copied once below all highlighters, except where it is covered by videos.
+        QRegion background = highlighterArea(label, first, end, region);
+        if (layer != nullptr)
+            background += layer->highlightArea & region;
+        for (QList<QRect>::const_iterator video=master->videoPositions.cbegin(); video!=master->videoPositions.cend(); video++)
+            background -= *video;
+        if (!background.isEmpty()) {
+            painter.save();
+            painter.setClipRegion(background, Qt::IntersectClip);
+            painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+            // Edges of the slide must be drawn explicitly. Drawing with the highlighter on transparent edges can look ugly.
+            painter.fillRect(background.boundingRect(), QBrush(master->parentWidget()->palette().base()));
+            painter.drawPixmap(master->shiftx, master->shifty, master->pixmap);
+            painter.restore();
+        }
+    }
+    if (layer != nullptr)
+        layer->lastUse = ++layerClock;
+    // Highlighters are drawn below pens.
+    for (DrawTool const pathTool : {Highlighter, Pen}) {
+        if (layer != nullptr) {
+            QPixmap const& pixmap = pathTool == Pen ? layer->pixmap : layer->highlight;
+            painter.setCompositionMode(pathTool == Pen ? QPainter::CompositionMode_SourceOver : QPainter::CompositionMode_Darken);
+            if (layer->damage.isEmpty()) {
+                if (!pixmap.isNull())
+                    painter.drawPixmap(0, 0, pixmap);
+            }
+            else {
+                // The layer is outdated in the damaged region. Draw the paths contained in the layer directly there.
+                QRegion const damaged = region & layer->damage;
+                if (!pixmap.isNull()) {
+                    painter.save();
+                    painter.setClipRegion(region - layer->damage, Qt::IntersectClip);
+                    painter.drawPixmap(0, 0, pixmap);
+                    painter.restore();
                 }
-                    break;
-                default:
-                    break;
+                if (!damaged.isEmpty()) {
+                    painter.save();
+                    painter.setClipRegion(damaged, Qt::IntersectClip);
+                    drawPathRange(painter, label, 0, layer->end, damaged, pathTool);
+                    painter.restore();
                 }
             }
         }
+        drawPathRange(painter, label, first, end, region, pathTool);
     }
-    if (toCache)
-        end_cache = paths[master->page->label()].length();
 }
 
-bool PathOverlay::hasVideoOverlap(QRectF const& rect) const
+void PathOverlay::drawPathRange(QPainter& painter, QString const& label, int const first, int const end, QRegion const& region, DrawTool const tool)
 {
-    if (master->videoPositions.isEmpty())
-        return false;
-    for (auto pos: master->videoPositions) {
-        if (rect.intersects(pos))
-            return true;
+    QList<DrawPath*> const& list = paths[label];
+    if (first >= end)
+        return;
+    // Small regions (as used while drawing or erasing) only require the paths
+    // which the spatial index finds close to the region.
+    // The index returns all paths from first to the end of the list in drawing order.
+    QRect const bounding = region.boundingRect();
+    bool const useIndex = end == list.length() && 4*bounding.width()*bounding.height() < width()*height();
+    QVector<DrawPath*> candidates;
+    if (useIndex) {
+        PathIndex const* index = pathIndex(label);
+        candidates = index->candidates(toPage(bounding), index->stackingKey(list[first]));
     }
-    return false;
+    // Highlighters darken everything below them.
+    painter.setCompositionMode(tool == Highlighter ? QPainter::CompositionMode_Darken : QPainter::CompositionMode_SourceOver);
+    // Paths are drawn in page coordinates.
+    QTransform const widgetTransform = painter.worldTransform();
+    painter.setWorldTransform(pageTransform(), true);
+    int const number = useIndex ? candidates.length() : end - first;
+    // Iterate over all remaining paths.
+    for (int i=0; i<number; i++) {
+        DrawPath const* path = useIndex ? candidates[i] : list[first+i];
+        if (path->getTool().tool == tool && region.intersects(toWidget(path->getOuterDrawing())))
+            path->draw(painter);
+    }
+    painter.setWorldTransform(widgetTransform);
+}
+
+QRegion const PathOverlay::highlighterArea(QString const& label, int const first, int const end, QRegion const& region) const
+{
+    QRegion area;
+    QList<DrawPath*> const list = paths.value(label);
+    for (int i=first; i<end && i<list.length(); i++) {
+        if (list[i]->getTool().tool == Highlighter) {
+            QRect const outer = toWidget(list[i]->getOuterDrawing());
+            if (region.intersects(outer))
+                area += outer;
+        }
+    }
+    return area;
 }
 
 bool PathOverlay::event(QEvent *event)
@@ -381,8 +551,11 @@ bool PathOverlay::event(QEvent *event)
 #ifdef DEBUG_INPUT
         qDebug() << tabletEvent;
 #endif
+        // Changes from previous move events are sent before the press.
+        flushInput();
         if (tabletEvent->pointerType() == QTabletEvent::Eraser) {
-            erase(tabletEvent->posF());
+            stylusEraserPosition = tabletEvent->posF();
+            erase(stylusEraserPosition, stylusEraserPosition, true);
             update();
         }
         else {
@@ -390,12 +563,21 @@ bool PathOverlay::event(QEvent *event)
             {
             case Pen:
             case Highlighter:
+                applyStrokeOps();
                 if (!paths.contains(master->page->label()))
                     paths[master->page->label()] = QList<DrawPath*>();
-                paths[master->page->label()].append(new DrawPath(stylusTool, tabletEvent->posF()));
+                paths[master->page->label()].append(new DrawPath(pageArena(master->page->label()), pageTool(stylusTool), toPage(tabletEvent->posF()), tabletEvent->pressure()));
+                if (pathIndices.contains(master->page->label()))
+                    pathIndices[master->page->label()]->append(paths[master->page->label()].last());
+                inputSamples = {{toPage(tabletEvent->posF()), tabletEvent->timestamp()}};
+                if (latency != nullptr)
+                    latency->input(latency->eventTime(tabletEvent->timestamp()));
+                sendAddPath(master->page->label(), paths[master->page->label()].last());
+                addHistoryStep(master->page->label(), {paths[master->page->label()].length() - 1, {}, {paths[master->page->label()].last()}});
                 break;
             case Eraser:
-                erase(tabletEvent->posF());
+                stylusEraserPosition = tabletEvent->posF();
+                erase(stylusEraserPosition, stylusEraserPosition, true);
                 update();
                 break;
             case Magnifier:
@@ -419,11 +601,11 @@ bool PathOverlay::event(QEvent *event)
         QTabletEvent* tabletEvent = static_cast<QTabletEvent*>(event);
         if (tabletEvent->pressure() == 0) {
             if (stylusTool.tool == Pointer) {
-                QRegion region = QRegion(stylusPosition.x()-stylusTool.size, stylusPosition.y()-stylusTool.size, 2*stylusTool.size+2, 2*stylusTool.size+2);
+                inputDamage += QRect(stylusPosition.x()-stylusTool.size, stylusPosition.y()-stylusTool.size, 2*stylusTool.size+2, 2*stylusTool.size+2);
                 stylusPosition = tabletEvent->posF();
-                region += QRect(stylusPosition.x()-stylusTool.size, stylusPosition.y()-stylusTool.size, 2*stylusTool.size+2, 2*stylusTool.size+2);
-                emit stylusPositionChanged(stylusPosition, master->shiftx, master->shifty, master->resolution);
-                update(region);
+                inputDamage += QRect(stylusPosition.x()-stylusTool.size, stylusPosition.y()-stylusTool.size, 2*stylusTool.size+2, 2*stylusTool.size+2);
+                stylusMoved = true;
+                scheduleInputFlush();
             }
             event->accept();
             return true;
@@ -431,7 +613,8 @@ bool PathOverlay::event(QEvent *event)
         switch (tabletEvent->pointerType())
         {
         case QTabletEvent::Eraser:
-            erase(tabletEvent->posF());
+            erase(tabletEvent->posF(), stylusEraserPosition, false);
+            stylusEraserPosition = tabletEvent->posF();
             break;
         default:
             switch (stylusTool.tool)
@@ -440,33 +623,29 @@ bool PathOverlay::event(QEvent *event)
             case Highlighter:
                 // TODO: handle pointer simultaneously
                 if (!paths[master->page->label()].isEmpty()) {
-                    paths[master->page->label()].last()->append(tabletEvent->posF());
-                    update(paths[master->page->label()].last()->getOuterLast());
-                    emit pathsChangedQuick(master->page->label(), paths[master->page->label()], master->shiftx, master->shifty, master->resolution);
+                    DrawPath* const path = paths[master->page->label()].last();
+                    quint32 const hash = path->getHash();
+                    path->append(toPage(tabletEvent->posF()), strokeTolerance, strokeSmoothing, tabletEvent->pressure());
+                    if (pathIndices.contains(master->page->label()))
+                        pathIndices[master->page->label()]->extend(path);
+                    inputDamage += toWidget(path->getOuterLast() | predictStroke(path, toPage(tabletEvent->posF()), tabletEvent->timestamp()));
+                    registerInput(tabletEvent->timestamp());
+                    sendExtendPath(master->page->label(), hash, path);
                 }
                 break;
             case Eraser:
-                erase(tabletEvent->posF());
+                erase(tabletEvent->posF(), stylusEraserPosition, false);
+                stylusEraserPosition = tabletEvent->posF();
                 break;
             case Torch:
             case Magnifier:
-            {
-                QRegion region = QRegion(stylusPosition.x()-stylusTool.size, stylusPosition.y()-stylusTool.size, 2*stylusTool.size+2, 2*stylusTool.size+2);
-                stylusPosition = tabletEvent->posF();
-                region += QRect(stylusPosition.x()-stylusTool.size, stylusPosition.y()-stylusTool.size, 2*stylusTool.size+2, 2*stylusTool.size+2);
-                update(region);
-                emit stylusPositionChanged(stylusPosition, master->shiftx, master->shifty, master->resolution);
-                break;
-            }
             case Pointer:
-            {
-                QRegion region = QRegion(stylusPosition.x()-stylusTool.size, stylusPosition.y()-stylusTool.size, 2*stylusTool.size+2, 2*stylusTool.size+2);
+                inputDamage += QRect(stylusPosition.x()-stylusTool.size, stylusPosition.y()-stylusTool.size, 2*stylusTool.size+2, 2*stylusTool.size+2);
                 stylusPosition = tabletEvent->posF();
-                region += QRect(stylusPosition.x()-stylusTool.size, stylusPosition.y()-stylusTool.size, 2*stylusTool.size+2, 2*stylusTool.size+2);
-                emit stylusPositionChanged(stylusPosition, master->shiftx, master->shifty, master->resolution);
-                update(region);
+                inputDamage += QRect(stylusPosition.x()-stylusTool.size, stylusPosition.y()-stylusTool.size, 2*stylusTool.size+2, 2*stylusTool.size+2);
+                stylusMoved = true;
+                scheduleInputFlush();
                 break;
-            }
             default:
                 if (cursor().shape() != Qt::BlankCursor) {
                     if (master->hoverLink(tabletEvent->pos()))
@@ -486,6 +665,7 @@ bool PathOverlay::event(QEvent *event)
 #ifdef DEBUG_INPUT
         qDebug() << tabletEvent;
 #endif
+        flushInput();
         if (stylusTool.tool != Pointer) {
             if (!stylusPosition.isNull()) {
                 stylusPosition = QPointF();
@@ -515,12 +695,17 @@ bool PathOverlay::event(QEvent *event)
                 break;
             case Pen:
             case Highlighter:
+            {
                 if (!paths.contains(master->page->label()) || paths[master->page->label()].isEmpty())
                     return false;
-                paths[master->page->label()].last()->endDrawing();
-                emit pathsChangedQuick(master->page->label(), paths[master->page->label()], master->shiftx, master->shifty, master->resolution);
+                DrawPath* const path = paths[master->page->label()].last();
+                quint32 const hash = path->getHash();
+                path->endDrawing();
+                sendExtendPath(master->page->label(), hash, path);
+                sendExtendedPath();
                 update();
-                [[clang::fallthrough]];
+            }
+            [[clang::fallthrough]];
             case Eraser:
                 updatePathCache();
                 emit sendUpdatePathCache();
@@ -542,6 +727,7 @@ bool PathOverlay::event(QEvent *event)
     case QEvent::TabletEnterProximity:
         break;
     case QEvent::TabletLeaveProximity:
+        flushInput();
         if (!stylusPosition.isNull()) {
             stylusPosition = QPointF();
             emit stylusPositionChanged(stylusPosition, 0, 0, 0.);
@@ -560,6 +746,8 @@ void PathOverlay::mousePressEvent(QMouseEvent *event)
 {
     if (master->page == nullptr)
         return;
+    // Changes from previous move events are sent before the press.
+    flushInput();
     switch (event->buttons())
     {
     case Qt::LeftButton:
@@ -568,12 +756,21 @@ void PathOverlay::mousePressEvent(QMouseEvent *event)
         {
         case Pen:
         case Highlighter:
+            applyStrokeOps();
             if (!paths.contains(master->page->label()))
                 paths[master->page->label()] = QList<DrawPath*>();
-            paths[master->page->label()].append(new DrawPath(tool, event->localPos()));
+            paths[master->page->label()].append(new DrawPath(pageArena(master->page->label()), pageTool(tool), toPage(event->localPos())));
+            if (pathIndices.contains(master->page->label()))
+                pathIndices[master->page->label()]->append(paths[master->page->label()].last());
+            inputSamples = {{toPage(event->localPos()), event->timestamp()}};
+            if (latency != nullptr)
+                latency->input(latency->eventTime(event->timestamp()));
+            sendAddPath(master->page->label(), paths[master->page->label()].last());
+            addHistoryStep(master->page->label(), {paths[master->page->label()].length() - 1, {}, {paths[master->page->label()].last()}});
             break;
         case Eraser:
-            erase(event->localPos());
+            eraserPosition = event->localPos();
+            erase(eraserPosition, eraserPosition, true);
             update();
             break;
         case Magnifier:
@@ -594,7 +791,8 @@ void PathOverlay::mousePressEvent(QMouseEvent *event)
         }
         break;
     case Qt::RightButton:
-        erase(event->localPos());
+        eraserPosition = event->localPos();
+        erase(eraserPosition, eraserPosition, true);
         update();
         break;
     default:
@@ -608,6 +806,7 @@ void PathOverlay::mouseReleaseEvent(QMouseEvent *event)
     // TODO: Handle case that mouse is pressed during slide change. Currently this leads to unexpected behavior.
     if (master->page == nullptr)
         return;
+    flushInput();
     switch (event->button())
     {
     case Qt::RightButton:
@@ -633,12 +832,17 @@ void PathOverlay::mouseReleaseEvent(QMouseEvent *event)
             break;
         case Pen:
         case Highlighter:
+        {
             if (!paths.contains(master->page->label()) || paths[master->page->label()].isEmpty())
                 break;
-            paths[master->page->label()].last()->endDrawing();
-            emit pathsChangedQuick(master->page->label(), paths[master->page->label()], master->shiftx, master->shifty, master->resolution);
+            DrawPath* const path = paths[master->page->label()].last();
+            quint32 const hash = path->getHash();
+            path->endDrawing();
+            sendExtendPath(master->page->label(), hash, path);
+            sendExtendedPath();
             update();
-            [[clang::fallthrough]];
+        }
+        [[clang::fallthrough]];
         case Eraser:
             updatePathCache();
             emit sendUpdatePathCache();
@@ -669,13 +873,15 @@ void PathOverlay::mouseMoveEvent(QMouseEvent* event)
     if (master->page == nullptr)
         return;
     if (tool.tool == Pointer) {
-        QRegion region = QRegion(pointerPosition.x()-tool.size, pointerPosition.y()-tool.size, 2*tool.size+2, 2*tool.size+2);
+        inputDamage += QRect(pointerPosition.x()-tool.size, pointerPosition.y()-tool.size, 2*tool.size+2, 2*tool.size+2);
         pointerPosition = event->localPos();
-        region += QRect(pointerPosition.x()-tool.size, pointerPosition.y()-tool.size, 2*tool.size+2, 2*tool.size+2);
-        emit pointerPositionChanged(pointerPosition, master->shiftx, master->shifty, master->resolution);
-        stylusPosition = QPointF();
-        emit stylusPositionChanged(stylusPosition, 0, 0, 0.);
-        update(region);
+        inputDamage += QRect(pointerPosition.x()-tool.size, pointerPosition.y()-tool.size, 2*tool.size+2, 2*tool.size+2);
+        pointerMoved = true;
+        if (!stylusPosition.isNull()) {
+            stylusPosition = QPointF();
+            stylusMoved = true;
+        }
+        scheduleInputFlush();
     }
     switch (event->buttons())
     {
@@ -693,24 +899,28 @@ void PathOverlay::mouseMoveEvent(QMouseEvent* event)
         case Pen:
         case Highlighter:
             if (!paths[master->page->label()].isEmpty()) {
-                paths[master->page->label()].last()->append(event->localPos());
-                update(paths[master->page->label()].last()->getOuterLast());
-                emit pathsChangedQuick(master->page->label(), paths[master->page->label()], master->shiftx, master->shifty, master->resolution);
+                DrawPath* const path = paths[master->page->label()].last();
+                quint32 const hash = path->getHash();
+                path->append(toPage(event->localPos()), strokeTolerance, strokeSmoothing);
+                if (pathIndices.contains(master->page->label()))
+                    pathIndices[master->page->label()]->extend(path);
+                inputDamage += toWidget(path->getOuterLast() | predictStroke(path, toPage(event->localPos()), event->timestamp()));
+                registerInput(event->timestamp());
+                sendExtendPath(master->page->label(), hash, path);
             }
             break;
         case Eraser:
-            erase(event->localPos());
+            erase(event->localPos(), eraserPosition, false);
+            eraserPosition = event->localPos();
             break;
         case Torch:
         case Magnifier:
-        {
-            QRegion region = QRegion(pointerPosition.x()-tool.size, pointerPosition.y()-tool.size, 2*tool.size+2, 2*tool.size+2);
+            inputDamage += QRect(pointerPosition.x()-tool.size, pointerPosition.y()-tool.size, 2*tool.size+2, 2*tool.size+2);
             pointerPosition = event->localPos();
-            region += QRect(pointerPosition.x()-tool.size, pointerPosition.y()-tool.size, 2*tool.size+2, 2*tool.size+2);
-            update(region);
-            emit pointerPositionChanged(pointerPosition, master->shiftx, master->shifty, master->resolution);
+            inputDamage += QRect(pointerPosition.x()-tool.size, pointerPosition.y()-tool.size, 2*tool.size+2, 2*tool.size+2);
+            pointerMoved = true;
+            scheduleInputFlush();
             break;
-        }
         case Pointer:
             break;
         default:
@@ -723,107 +933,99 @@ void PathOverlay::mouseMoveEvent(QMouseEvent* event)
         }
         break;
     case Qt::RightButton:
-        erase(event->localPos());
+        erase(event->localPos(), eraserPosition, false);
+        eraserPosition = event->localPos();
         break;
     }
     event->accept();
 }
 
-void PathOverlay::erase(const QPointF &point)
+void PathOverlay::erase(QPointF const& point, QPointF const& previous, bool const begin)
 {
-    if (master->page == nullptr || paths[master->page->label()].isEmpty())
+    if (master->page == nullptr)
         return;
-    QList<DrawPath*>& path_list = paths[master->page->label()];
-    int const oldsize = path_list.size();
+    applyStrokeOps();
+    if (paths[master->page->label()].isEmpty())
+        return;
+#ifdef DEBUG_DRAWING
+    QElapsedTimer timer;
+    timer.start();
+    int checkedNodes = 0;
+#endif
+    QString const label = master->page->label();
+    QList<DrawPath*>& path_list = paths[label];
+    PathIndex* index = pathIndex(label);
+    // The eraser sweeps over the line from the previous to the current position.
+    // Eraser size and positions are converted to page coordinates.
+    qreal const size = (tool.tool == Eraser ? tool.size : eraserSize) / master->resolution;
+    QPointF const end = toPage(point);
+    QPointF const start = previous.isNull() ? end : toPage(previous);
     QRegion updateRegion;
-    for (int i=0; i<oldsize; i++) {
-        QVector<int> splits = path_list[i]->intersects(point, tool.tool == Eraser ? tool.size : eraserSize);
-        if (splits.isEmpty())
-            continue;
-        updateRegion += path_list[i]->getOuterDrawing().toAlignedRect();
-        if (splits.first() > 1)
-            path_list.insert(i+1, path_list[i]->split(0, splits.first()-1));
-        for (int s=0; s<splits.size()-1; s++) {
-            if (splits[s+1]-splits[s] > 3) {
-                path_list.insert(i+1, path_list[i]->split(splits[s]+1, splits[s+1]-1));
-                s++;
-            }
-        }
-        if (splits.last() < path_list[i]->number()-2)
-            path_list.insert(i+1, path_list[i]->split(splits.last()+1, path_list[i]->number()));
-        delete path_list[i];
-        path_list[i] = nullptr;
-    }
-    for (int i=0; i<path_list.size();) {
-        if (path_list[i] == nullptr)
-            path_list.removeAt(i);
+    // Pressing the eraser begins a new command in the history.
+    // All paths erased while the eraser is moved are restored together.
+    bool newCommand = begin;
+    // Only paths registered in grid cells close to the eraser need to be checked.
+    QVector<DrawPath*> const candidates = index->candidates(QRectF(start, end).normalized().adjusted(-size, -size, size, size));
+    for (DrawPath* path : candidates) {
 #ifdef DEBUG_DRAWING
-        // TODO: check again:
-        else if (path_list[i]->isEmpty()) { // this should never happen...
-            qDebug() << "this should never happen.";
-            delete path_list[i];
-            path_list.removeAt(i);
-        }
+        checkedNodes += path->number();
 #endif
-        else
-            i++;
-    }
-    if (!updateRegion.isEmpty()) {
-        end_cache = -1;
-        update(updateRegion);
-        emit pathsChanged(master->page->label(), path_list, master->shiftx, master->shifty, master->resolution);
-    }
-}
-
-void PathOverlay::setPathsQuick(QString const pagelabel, QList<DrawPath*> const& list, qint16 const refshiftx, qint16 const refshifty, double const refresolution)
-{
-    QPointF shift = QPointF(master->shiftx, master->shifty) - master->resolution/refresolution*QPointF(refshiftx, refshifty);
-    int const diff = list.length() - paths[pagelabel].length();
-    if (diff == 0) {
-        QRect const rect = paths[pagelabel].last()->update(*list.last(), shift, master->resolution/refresolution);
-        if (rect.isValid())
-            update(rect);
-        else
-            setPaths(pagelabel, list, refshiftx, refshifty, refresolution);
-    }
-    else if (diff == 1) {
-        paths[pagelabel].append(new DrawPath(*list.last(), shift, master->resolution/refresolution));
-        update(paths[pagelabel].last()->getOuterDrawing().toAlignedRect());
-    }
-    else if (diff < 0) {
-        if (diff == -1 && paths[pagelabel].length() >= 1) {
-           DrawPath* path = paths[pagelabel].takeLast();
-           update(path->getOuterDrawing().toAlignedRect());
-           delete path;
-        }
-        else if (-diff >= paths[pagelabel].length()) {
-            qDeleteAll(paths[pagelabel]);
-            paths[pagelabel].clear();
-            update();
+        // Indices of the segments which are hit by the eraser.
+        QVector<int> const hits = path->intersects(start, end, size);
+        if (hits.isEmpty())
+            continue;
+        int const i = path_list.indexOf(path);
+        if (i < 0) {
+            qWarning() << "Spatial index of paths is inconsistent.";
+            index->remove(path);
+            continue;
         }
-        else {
-            for (int i=diff; i++<0;)
-                delete paths[pagelabel].takeLast();
-            update();
+        updateRegion += toWidget(path->getOuterDrawing());
+        // Keep the parts of the path between the segments which are hit.
+        StrokeOp op{StrokeOp::SplitPath, 0, 0, label, path->getHash(), 0, QSharedPointer<StrokeArena>(), 0, 0, nullptr, i, {}, {}, !newCommand};
+        QList<DrawPath*> pieces;
+        int first = 0;
+        for (int const hit : hits) {
+            if (hit > first)
+                op.pieces.append(qMakePair(first, hit+1));
+            first = hit + 1;
         }
-        end_cache = -1;
-        pixpaths = QPixmap();
+        if (first < path->number() - 1)
+            op.pieces.append(qMakePair(first, path->number()));
+        for (QPair<int, int> const& range : op.pieces)
+            pieces.append(path->split(range.first, range.second));
+        for (int p=0; p<pieces.length(); p++)
+            path_list.insert(i+1+p, pieces[p]);
+        index->replace(path, pieces);
+        path_list.removeAt(i);
+        damageLayer(label, i, path->getOuterDrawing(), pieces.length() - 1);
+        // The history keeps the path, which shares its nodes with the pieces.
+        addHistoryStep(label, {i, {path}, pieces}, newCommand);
+        newCommand = false;
+        sendOp(op);
     }
-    else {
 #ifdef DEBUG_DRAWING
-        qDebug() << "set paths quick failed!" << this;
+    qint64 const time = timer.nsecsElapsed();
+    qDebug() << "Eraser checked" << candidates.length() << "paths with" << checkedNodes << "nodes in" << time/1000 << "us";
 #endif
-        setPaths(pagelabel, list, refshiftx, refshifty, refresolution);
+    if (!updateRegion.isEmpty()) {
+        compactArena(label);
+        inputDamage += updateRegion;
+        scheduleInputFlush();
     }
 }
 
-void PathOverlay::setPaths(QString const pagelabel, QList<DrawPath*> const& list, qint16 const refshiftx, qint16 const refshifty, double const refresolution)
+void PathOverlay::setPaths(QString const pagelabel, QList<DrawPath*> const& list)
 {
-    QPointF shift = QPointF(master->shiftx, master->shifty) - master->resolution/refresolution*QPointF(refshiftx, refshifty);
+    // Queued operations are applied first: list can already contain their results.
+    applyStrokeOps();
+    // The history cannot be applied to paths copied from the other overlay.
+    clearHistory(pagelabel);
+    // Paths are copied without copying their nodes.
     if (!paths.contains(pagelabel)) {
         paths[pagelabel] = QList<DrawPath*>();
         for (QList<DrawPath*>::const_iterator it = list.cbegin(); it!=list.cend(); it++)
-            paths[pagelabel].append(new DrawPath(**it, shift, master->resolution/refresolution));
+            paths[pagelabel].append(new DrawPath(**it));
     }
     else {
         // Basic assumption: If list and paths[pagelabel] both contain two elements, then these elements appear in the same order in both lists.
@@ -836,7 +1038,7 @@ void PathOverlay::setPaths(QString const pagelabel, QList<DrawPath*> const& list
                 paths[pagelabel].pop_back();
             }
             while (new_it < list.cend())
-                paths[pagelabel].append(new DrawPath(**(new_it++), shift, master->resolution/refresolution));
+                paths[pagelabel].append(new DrawPath(**(new_it++)));
         }
         else {
             // create look up table for new hashs
@@ -853,20 +1055,328 @@ void PathOverlay::setPaths(QString const pagelabel, QList<DrawPath*> const& list
                 }
                 else {
                     while (new_it < next)
-                        old_it = paths[pagelabel].insert(old_it, new DrawPath(**(new_it++), shift, master->resolution/refresolution)) + 1;
+                        old_it = paths[pagelabel].insert(old_it, new DrawPath(**(new_it++))) + 1;
                     new_it++;
                     old_it++;
                 }
             }
             while (new_it < list.cend())
-                paths[pagelabel].append(new DrawPath(**(new_it++), shift, master->resolution/refresolution));
+                paths[pagelabel].append(new DrawPath(**(new_it++)));
         }
     }
-    end_cache = -1;
+    invalidatePathIndex(pagelabel);
+    compactArena(pagelabel);
+    layers.remove(pagelabel);
+    if (journal != nullptr)
+        journal->recordPage(pagelabel, paths[pagelabel]);
     updatePathCache();
     update();
 }
 
+void PathOverlay::resendPaths(QString const pagelabel)
+{
+    applyStrokeOps();
+    emit pathsChanged(pagelabel, paths[pagelabel]);
+}
+
+void PathOverlay::sendOp(StrokeOp& op)
+{
+    // Operations must arrive in the order in which they were applied.
+    sendExtendedPath();
+    op.origin = overlayId;
+    op.sequence = ++sentSequence;
+    if (journal != nullptr)
+        journal->recordOp(op);
+    emit sendStrokeOp(op);
+}
+
+void PathOverlay::sendAddPath(QString const& label, DrawPath const* path, int const index)
+{
+    StrokeOp op{StrokeOp::AddPath, 0, 0, label, 0, path->getHash(), path->getArena(), path->getFirst(), path->number(), &path->getTool(), index, {}, {}};
+    sendOp(op);
+}
+
+void PathOverlay::sendExtendPath(QString const& label, quint32 const oldHash, DrawPath const* path)
+{
+    if (path != extendedPath || label != extendedLabel) {
+        sendExtendedPath();
+        extendedPath = path;
+        extendedLabel = label;
+        extendedHash = oldHash;
+    }
+    scheduleInputFlush();
+}
+
+void PathOverlay::sendExtendedPath()
+{
+    if (extendedPath == nullptr)
+        return;
+    DrawPath const* const path = extendedPath;
+    extendedPath = nullptr;
+    // The path can have been removed in the meantime. Usually it is the last path of the page.
+    QMap<QString, QList<DrawPath*>>::const_iterator const list = paths.constFind(extendedLabel);
+    if (list == paths.cend() || list->lastIndexOf(const_cast<DrawPath*>(path)) < 0)
+        return;
+    StrokeOp op{StrokeOp::ExtendPath, 0, 0, extendedLabel, extendedHash, path->getHash(), path->getArena(), path->getFirst(), path->number(), &path->getTool(), -1, {}, {}};
+    if (path->hasTail())
+        op.tail.append(path->getTail());
+    if (!path->getPrediction().isNull()) {
+        if (op.tail.isEmpty())
+            op.tail.append(path->node(path->number()-1));
+        op.tail.append(path->getPrediction());
+    }
+    op.inputTime = extendedInputTime;
+    extendedInputTime = -1;
+    sendOp(op);
+}
+
+void PathOverlay::registerInput(ulong const timestamp)
+{
+    if (latency == nullptr)
+        return;
+    qint64 const time = latency->eventTime(timestamp);
+    latency->input(time);
+    if (extendedInputTime < 0 || time < extendedInputTime)
+        extendedInputTime = time;
+}
+
+QRectF const PathOverlay::predictStroke(DrawPath* path, QPointF const& position, ulong const timestamp)
+{
+    // Samples with equal timestamps are merged.
+    if (!inputSamples.isEmpty() && inputSamples.last().time == timestamp)
+        inputSamples.last().position = position;
+    else {
+        if (inputSamples.length() >= 3)
+            inputSamples.removeFirst();
+        inputSamples.append({position, timestamp});
+    }
+    if (strokePrediction <= 0.)
+        return QRectF();
+    int const n = inputSamples.length();
+    // Timestamps are unsigned: a sample which is older than its predecessor yields a large difference.
+    ulong const dt = n > 1 ? inputSamples[n-1].time - inputSamples[n-2].time : 0;
+    if (dt == 0 || dt > maxPredictionGap)
+        return path->setPrediction(QPointF());
+    QPointF const velocity = (inputSamples[n-1].position - inputSamples[n-2].position) / dt;
+    QPointF acceleration;
+    if (n > 2) {
+        ulong const dt0 = inputSamples[n-2].time - inputSamples[n-3].time;
+        if (dt0 > 0 && dt0 <= maxPredictionGap)
+            acceleration = (velocity - (inputSamples[n-2].position - inputSamples[n-3].position) / dt0) / ((dt + dt0) / 2.);
+    }
+    QPointF step = strokePrediction*velocity + strokePrediction*strokePrediction/2*acceleration;
+    // The acceleration is noisy. It may at most double the extrapolated distance.
+    qreal const limit = 2*std::sqrt(QPointF::dotProduct(velocity, velocity))*strokePrediction;
+    qreal const distance = std::sqrt(QPointF::dotProduct(step, step));
+    if (distance > limit)
+        step *= distance > 0. ? limit/distance : 0.;
+    QPointF const base = path->hasTail() ? path->getTail() : path->node(path->number()-1);
+    return path->setPrediction(step.isNull() ? QPointF() : base + step);
+}
+
+void PathOverlay::scheduleInputFlush()
+{
+    // The first input after a pause is shown immediately. Further input is collected until the frame ends.
+    if (!frameTimer.isActive())
+        flushInput();
+}
+
+void PathOverlay::flushInput()
+{
+    if (extendedPath == nullptr && inputDamage.isEmpty() && !pointerMoved && !stylusMoved)
+        return;
+    sendExtendedPath();
+    if (pointerMoved) {
+        pointerMoved = false;
+        if (pointerPosition.isNull())
+            emit pointerPositionChanged(pointerPosition, 0, 0, 0.);
+        else
+            emit pointerPositionChanged(pointerPosition, master->shiftx, master->shifty, master->resolution);
+    }
+    if (stylusMoved) {
+        stylusMoved = false;
+        if (stylusPosition.isNull())
+            emit stylusPositionChanged(stylusPosition, 0, 0, 0.);
+        else
+            emit stylusPositionChanged(stylusPosition, master->shiftx, master->shifty, master->resolution);
+    }
+    if (!inputDamage.isEmpty()) {
+        update(inputDamage);
+        inputDamage = QRegion();
+    }
+    frameTimer.start();
+}
+
+void PathOverlay::sendRemovePath(QString const& label, quint32 const hash)
+{
+    StrokeOp op{StrokeOp::RemovePath, 0, 0, label, hash, 0, QSharedPointer<StrokeArena>(), 0, 0, nullptr, -1, {}, {}};
+    sendOp(op);
+}
+
+void PathOverlay::receiveStrokeOp(StrokeOp const& op)
+{
+    pendingOps.append(op);
+    if (!syncTimer.isActive())
+        syncTimer.start();
+}
+
+void PathOverlay::applyStrokeOps()
+{
+    if (pendingOps.isEmpty())
+        return;
+    syncTimer.stop();
+    // Functions called from here can call this function again.
+    QVector<StrokeOp> ops;
+    ops.swap(pendingOps);
+    QSet<QString> requestPages, erasedPages;
+    QRegion updateRegion;
+    for (int i=0; i<ops.size(); i++) {
+        StrokeOp const& op = ops[i];
+        if (op.origin != receivedOrigin) {
+            // Operations from a new sender: start a new sequence.
+            receivedOrigin = op.origin;
+            receivedSequence = op.sequence - 1;
+        }
+        // Every operation is applied at most once.
+        if (op.sequence <= receivedSequence)
+            continue;
+        if (op.sequence != receivedSequence + 1 || requestPages.contains(op.page)) {
+            // An operation is missing. All paths of this page are requested from the sender.
+            receivedSequence = op.sequence;
+            requestPages.insert(op.page);
+            continue;
+        }
+        // Consecutive extensions of the same path are merged: each of them contains all nodes of the path.
+        int last = i;
+        if (op.type == StrokeOp::ExtendPath) {
+            while (last+1 < ops.size()
+                   && ops[last+1].type == StrokeOp::ExtendPath
+                   && ops[last+1].origin == op.origin
+                   && ops[last+1].sequence == ops[last].sequence + 1
+                   && ops[last+1].page == op.page
+                   && ops[last+1].hash == ops[last].newHash)
+                last++;
+        }
+        StrokeOp merged = ops[last];
+        merged.hash = op.hash;
+        if (applyOp(merged, updateRegion)) {
+            if (journal != nullptr)
+                journal->recordOp(merged);
+            if (merged.type == StrokeOp::SplitPath || merged.type == StrokeOp::RemovePath)
+                erasedPages.insert(merged.page);
+        }
+        else
+            requestPages.insert(op.page);
+        receivedSequence = ops[last].sequence;
+        i = last;
+    }
+#ifdef DEBUG_DRAWING
+    qDebug() << "Applied" << ops.size() << "path operations" << this;
+#endif
+    if (!updateRegion.isEmpty()) {
+        // The paths in the magnifier are drawn again when they are shown.
+        enlargedValid = QRegion();
+        update(updateRegion);
+    }
+    // Like the sender, which compacts its arena after erasing.
+    for (QSet<QString>::const_iterator it = erasedPages.cbegin(); it != erasedPages.cend(); it++)
+        compactArena(*it);
+    for (QSet<QString>::const_iterator it = requestPages.cbegin(); it != requestPages.cend(); it++) {
+        qWarning() << "Paths on page" << *it << "are out of sync and will be copied.";
+        emit sendRequestPaths(*it);
+    }
+}
+
+bool PathOverlay::applyOp(StrokeOp const& op, QRegion& updateRegion)
+{
+    QList<DrawPath*>& list = paths[op.page];
+    bool const visible = master->page != nullptr && master->page->label() == op.page;
+    // Position of the path which is changed. Paths which were changed recently are usually at the end.
+    int i = op.index;
+    if (op.type != StrokeOp::AddPath && (i < 0 || i >= list.length() || list[i]->getHash() != op.hash)) {
+        for (i = list.length() - 1; i >= 0 && list[i]->getHash() != op.hash; i--) {}
+        if (i < 0)
+            return false;
+    }
+    switch (op.type)
+    {
+    case StrokeOp::AddPath:
+    {
+        DrawPath* const path = new DrawPath(op.arena, op.tool, op.first, op.count);
+        if (op.index >= 0 && op.index < list.length()) {
+            // A path restored by undo or redo of the sender. The history of this page does not match anymore.
+            clearHistory(op.page);
+            list.insert(op.index, path);
+            invalidatePathIndex(op.page);
+            damageLayer(op.page, op.index, path->getOuterDrawing(), 1);
+        }
+        else {
+            list.append(path);
+            if (pathIndices.contains(op.page))
+                pathIndices[op.page]->append(path);
+            if (op.index < 0)
+                addHistoryStep(op.page, {list.length() - 1, {}, {path}});
+            else
+                clearHistory(op.page);
+        }
+        if (visible)
+            updateRegion += toWidget(path->getOuterDrawing());
+        break;
+    }
+    case StrokeOp::ExtendPath:
+    {
+        DrawPath* const path = list[i];
+        if (&path->getTool() != op.tool)
+            return false;
+        QRectF rect = path->extend(op.arena, op.first, op.count);
+        if (!rect.isValid())
+            return false;
+        rect |= path->setTail(op.tail);
+        if (pathIndices.contains(op.page))
+            pathIndices[op.page]->extend(path);
+        damageLayer(op.page, i, rect);
+        if (visible) {
+            updateRegion += toWidget(rect);
+            if (latency != nullptr && op.inputTime >= 0)
+                latency->input(op.inputTime);
+        }
+        break;
+    }
+    case StrokeOp::SplitPath:
+    {
+        DrawPath* const path = list[i];
+        QList<DrawPath*> pieces;
+        for (QPair<int, int> const& range : op.pieces)
+            pieces.append(path->split(range.first, range.second));
+        for (int p=0; p<pieces.length(); p++)
+            list.insert(i+1+p, pieces[p]);
+        if (pathIndices.contains(op.page))
+            pathIndices[op.page]->replace(path, pieces);
+        list.removeAt(i);
+        damageLayer(op.page, i, path->getOuterDrawing(), pieces.length() - 1);
+        if (visible)
+            updateRegion += toWidget(path->getOuterDrawing());
+        // The history keeps the path, which shares its nodes with the pieces.
+        addHistoryStep(op.page, {i, {path}, pieces}, !op.continues);
+        break;
+    }
+    case StrokeOp::RemovePath:
+    {
+        // A path removed by undo of the sender. The history of this page does not match anymore.
+        clearHistory(op.page);
+        DrawPath* const path = list.takeAt(i);
+        if (pathIndices.contains(op.page))
+            pathIndices[op.page]->remove(path);
+        damageLayer(op.page, i, path->getOuterDrawing(), -1);
+        if (visible)
+            updateRegion += toWidget(path->getOuterDrawing());
+        delete path;
+        break;
+    }
+    }
+    return true;
+}
+
 void PathOverlay::setPointerPosition(QPointF const point, qint16 const refshiftx, qint16 const refshifty, double const refresolution)
 {
     if (refresolution == 0.) {
@@ -939,376 +1449,549 @@ void PathOverlay::updateEnlargedPage()
         if (QApplication::mouseButtons() != Qt::LeftButton)
             return;
     }
-    // Draw enlargedPage.
-    enlargedPage = QPixmap(thetool->extras.magnification*size());
-    enlargedPage.fill(QColor(0,0,0,0));
+    // The page and the paths are drawn into enlargedPage when the magnifier shows them.
+    QSize const enlargedSize = thetool->extras.magnification*size();
+    if (enlargedPage.size() != enlargedSize)
+        enlargedPage = QPixmap(enlargedSize);
+    enlargedValid = QRegion();
+    update();
+}
+
+void PathOverlay::prepareEnlargedRect(QRect const& rect, qreal const magnification)
+{
+    QRegion const missing = QRegion(rect & enlargedPage.rect()) - enlargedValid;
+    if (missing.isEmpty() || master->page == nullptr)
+        return;
+    QRect const bounding = missing.boundingRect();
     QPainter painter;
     painter.begin(&enlargedPage);
-    // Draw the slide.
-    if (enlargedPageRenderer->resultReady())
-        // If a rendered page is ready in enlargedPageRenderer: show it in enlargedPage.
-        painter.drawPixmap(
-                    int(thetool->extras.magnification*master->shiftx),
-                    int(thetool->extras.magnification*master->shifty),
-                    enlargedPageRenderer->getPixmap()
-                    );
-    else
-        // Otherwise: show a scaled version of the page image.
-        painter.drawPixmap(
-                    int(thetool->extras.magnification*master->shiftx),
-                    int(thetool->extras.magnification*master->shifty),
-                    master->pixmap.scaled(thetool->extras.magnification*master->pixmap.size(), Qt::IgnoreAspectRatio, Qt::SmoothTransformation)
-                    );
-    // Draw annotations.
+    painter.setClipRegion(missing);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.fillRect(bounding, QColor(0,0,0,0));
+    QPoint const shift(int(magnification*master->shiftx), int(magnification*master->shifty));
+    if (enlargedPageRenderer != nullptr && enlargedPageRenderer->resultReady())
+        // Use the enlarged page rendered in a separate thread.
+        painter.drawPixmap(bounding, enlargedPageRenderer->getPixmap(), bounding.translated(-shift));
+    else {
+        // Otherwise: show a scaled version of the page image. Only the clipped region is scaled.
+        painter.save();
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+        painter.scale(magnification, magnification);
+        painter.drawPixmap(master->shiftx, master->shifty, master->pixmap);
+        painter.restore();
+    }
+    // Draw the paths through a scaling transformation. Only paths close to the missing region are drawn.
+    // The highlighters are drawn directly on the page background.
     painter.setRenderHint(QPainter::Antialiasing);
-    if (paths.contains(master->page->label())) {
-        for (QList<DrawPath*>::const_iterator path_it=paths[master->page->label()].cbegin(); path_it!=paths[master->page->label()].cend(); path_it++) {
-            FullDrawTool const& tool = (*path_it)->getTool();
-            switch (tool.tool) {
-            case Pen:
-            {
-                painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-                painter.setPen(QPen(tool.color, thetool->extras.magnification*tool.size));
-                DrawPath tmp(**path_it, QPointF(0,0), thetool->extras.magnification);
-                painter.drawPolyline(tmp.data(), tmp.number());
-                break;
-            }
-            case Highlighter:
-            {
-                painter.setCompositionMode(QPainter::CompositionMode_Darken);
-                painter.setPen(QPen(tool.color, thetool->extras.magnification*tool.size, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
-                DrawPath tmp(**path_it, QPointF(0,0), thetool->extras.magnification);
-                painter.drawPolyline(tmp.data(), tmp.number());
-                break;
-            }
-            default:
-                break;
-            }
-        }
+    painter.scale(magnification, magnification);
+    QRect const widgetRect(QPoint(int(bounding.left()/magnification) - 1, int(bounding.top()/magnification) - 1),
+                           QPoint(int(bounding.right()/magnification) + 1, int(bounding.bottom()/magnification) + 1));
+    QString const label = master->page->label();
+    drawPathRange(painter, label, 0, paths.value(label).length(), QRegion(widgetRect), Highlighter);
+    drawPathRange(painter, label, 0, paths.value(label).length(), QRegion(widgetRect), Pen);
+    painter.end();
+    enlargedValid += missing;
+}
+
+void PathOverlay::loadDrawings(QString const& filename, PdfDoc const* notesDoc)
+{
+    if (AnnotationFile::isAnnotationFile(filename))
+        loadBinary(filename, notesDoc);
+    else
+        loadXML(filename, notesDoc);
+}
+
+void PathOverlay::loadBinary(QString const& filename, PdfDoc const* notesDoc)
+{
+    applyStrokeOps();
+#ifdef DEBUG_DRAWING
+    QElapsedTimer timer;
+    timer.start();
+#endif
+    AnnotationFile* file = new AnnotationFile(filename);
+    if (!file->isValid()) {
+        delete file;
+        return;
     }
+
+    // Check whether the PDF files are as expected and warn otherwise.
+    QFileInfo const presentation_fileinfo(master->doc->getPath());
+    if (file->getPresentation().file != presentation_fileinfo.absoluteFilePath())
+        qWarning() << "This drawing file was generated for a different PDF file path.";
+    if (file->getPresentation().modified != presentation_fileinfo.lastModified().toString("yyyy-MM-dd hh:mm:ss"))
+        qWarning() << "The presentation file has been modified since writing the drawing file.";
+    if (int(file->getPresentation().pages) != master->doc->getDoc()->numPages())
+        qWarning() << "The numbers of pages in the presentation and drawing file do not match!";
+    QFileInfo const notes_fileinfo(notesDoc->getPath());
+    if (file->getNotes().file != notes_fileinfo.absoluteFilePath())
+        qWarning() << "This drawing file was generated for a different PDF file path.";
+    if (file->getNotes().modified != notes_fileinfo.lastModified().toString("yyyy-MM-dd hh:mm:ss"))
+        qWarning() << "The notes file has been modified since writing the drawing file.";
+    if (int(file->getNotes().pages) != notesDoc->getDoc()->numPages())
+        qWarning() << "The numbers of pages in the notes and drawing file do not match!";
+
+    // Pages which were not read from a previously opened file are kept.
+    loadAllPages();
+    // Like in loadXML, the pages contained in the file replace the current paths.
+    QStringList const labels = file->pages();
+    for (QStringList::const_iterator label_it=labels.cbegin(); label_it!=labels.cend(); label_it++) {
+        QMap<QString, QList<DrawPath*>>::iterator page_it = paths.find(*label_it);
+        if (page_it == paths.end())
+            continue;
+        qDeleteAll(*page_it);
+        paths.erase(page_it);
+        clearHistory(*label_it);
+        arenas.remove(*label_it);
+        invalidatePathIndex(*label_it);
+        layers.remove(*label_it);
+        if (journal != nullptr)
+            journal->recordPage(*label_it, QList<DrawPath*>());
+        emit pathsChanged(*label_it, QList<DrawPath*>());
+    }
+    lazyPages = QSharedPointer<AnnotationFile>(file);
+    lazyLabels.clear();
+    for (QStringList::const_iterator label_it=labels.cbegin(); label_it!=labels.cend(); label_it++)
+        lazyLabels.insert(*label_it);
+    lazyPagesJournaled = false;
+    // The pages are not read for the journal: its next main file contains copies of their chunks.
+    if (journal != nullptr)
+        writeJournalMain();
+    if (master->page != nullptr)
+        loadPage(master->page->label());
+#ifdef DEBUG_DRAWING
+    qDebug() << "Opened drawing file" << filename << "with" << labels.length() << "pages in" << timer.nsecsElapsed()/1000 << "us";
+#endif
     update();
 }
 
-void PathOverlay::loadXML(QString const& filename, PdfDoc const* notesDoc)
+void PathOverlay::loadPage(QString const& label, bool const wait)
 {
-    // Load drawings from (compressed) XML.
-    // TODO: use gunzip and open Xournal files directly.
-    qInfo() << "Loading files is experimental. Files might contain errors or might be unreadable for later versions of BeamerPresenter";
-    QFile file(filename);
-    if (!file.exists()) {
-        qCritical() << "Loading file failed: file does not exist.";
+    if (xmlLoader != nullptr && (wait || xmlLoader->isReady(label)))
+        takeXMLPage(label);
+    if (!lazyLabels.contains(label))
         return;
-    }
-    if (!file.open(QIODevice::ReadOnly)) {
-        qCritical() << "Loading file failed: file is not readable.";
+    applyStrokeOps();
+#ifdef DEBUG_DRAWING
+    QElapsedTimer timer;
+    timer.start();
+#endif
+    QList<DrawPath*> const list = lazyPages->readPage(label, pageArena(label));
+    removeLazyPage(label);
+#ifdef DEBUG_DRAWING
+    qDebug() << "Read page" << label << "with" << list.length() << "paths in" << timer.nsecsElapsed()/1000 << "us";
+#endif
+    if (list.isEmpty())
         return;
-    }
-    QDomDocument doc("BeamerPresenter");
-    if (!doc.setContent(&file)) {
-        file.close();
-        file.open(QIODevice::ReadOnly);
-        if (!doc.setContent(qUncompress(file.readAll()))) {
-            file.close();
-            return;
+    // Paths which were drawn on this page before it was read stay on top.
+    QList<DrawPath*>& pagePaths = paths[label];
+    pagePaths = list + pagePaths;
+    // Positions in the history are shifted by the new paths.
+    clearHistory(label);
+    invalidatePathIndex(label);
+    layers.remove(label);
+    if (journal != nullptr && !lazyPagesJournaled)
+        journal->recordPage(label, pagePaths);
+    emit pathsChanged(label, pagePaths);
+    if (master->page != nullptr && master->page->label() == label)
+        update();
+}
+
+void PathOverlay::loadAllPages()
+{
+    takeAllXMLPages();
+    while (!lazyLabels.isEmpty())
+        loadPage(*lazyLabels.cbegin());
+}
+
+void PathOverlay::removeLazyPage(QString const& label)
+{
+    lazyLabels.remove(label);
+    // The file is only kept while it contains pages which have not been read.
+    if (lazyLabels.isEmpty())
+        lazyPages.clear();
+}
+
+void PathOverlay::takeAllXMLPages()
+{
+    while (xmlLoader != nullptr) {
+        QStringList const labels = xmlLoader->remainingPages();
+        if (labels.isEmpty()) {
+            delete xmlLoader;
+            xmlLoader = nullptr;
+            xmlLoaderPaths.clear();
+            break;
         }
+        takeXMLPage(labels.first());
     }
-    QDomElement const root = doc.documentElement();
-    if (root.attribute("creator").contains("beamerpresenter", Qt::CaseInsensitive)) {
+}
 
-        // Check whether the presentation file is as expected and warn otherwise.
-        {
-            QDomElement const pres = root.firstChildElement("presentation");
-            QFileInfo const& presentation_fileinfo = QFileInfo(master->doc->getPath());
-            if (pres.attribute("file") != presentation_fileinfo.absoluteFilePath())
-                qWarning() << "This drawing file was generated for a different PDF file path.";
-            if (pres.attribute("modified") != presentation_fileinfo.lastModified().toString("yyyy-MM-dd hh:mm:ss"))
-                qWarning() << "The presentation file has been modified since writing the drawing file.";
-            if (pres.attribute("pages").toInt() != master->doc->getDoc()->numPages())
-                qWarning() << "The numbers of pages in the presentation and drawing file do not match!";
+void PathOverlay::openJournal(QString const& filename, PdfDoc const* notesDoc, int const interval)
+{
+    if (journal != nullptr)
+        return;
+    applyStrokeOps();
+    quint32 generation = 0;
+    if (QFileInfo::exists(filename)) {
+        if (!AnnotationFile::isAnnotationFile(filename)) {
+            qCritical() << "Autosave file" << filename << "exists but is not a binary drawing file. Drawings will not be saved automatically.";
+            return;
         }
-
-        // Check whether the notes file is as expected and warn otherwise.
         {
-            QDomElement const notes = root.firstChildElement("notes");
-            QFileInfo const& notes_fileinfo = QFileInfo(notesDoc->getPath());
-            if (notes.attribute("file") != notes_fileinfo.absoluteFilePath())
-                qWarning() << "This drawing file was generated for a different PDF file path.";
-            if (notes.attribute("modified") != notes_fileinfo.lastModified().toString("yyyy-MM-dd hh:mm:ss"))
-                qWarning() << "The notes file has been modified since writing the drawing file.";
-            if (notes.attribute("pages").toInt() != notesDoc->getDoc()->numPages())
-                qWarning() << "The numbers of pages in the notes and drawing file do not match!";
-        }
-
-        for (QDomElement page_element = root.firstChildElement("page"); !page_element.isNull(); page_element = page_element.nextSiblingElement("page")) {
-            QString const label = page_element.attribute("label");
-            qreal scale;
-            QPoint shift;
-            Poppler::Page const* page = master->doc->getPage(label);
-            QSizeF size;
-            if (page == nullptr)
-                size = master->page->pageSizeF();
-            else
-                size = page->pageSizeF();
-            if (size.width() * height() >= width() * size.height()) {
-                shift.setY(( height() - size.height()/size.width() * width() )/2);
-                scale = width() / size.width();
-            }
-            else {
-                shift.setX((width() - size.width()/size.height() * height() )/2);
-                scale = height() / size.height();
-            }
-            if (paths.contains(label)) {
-                qDeleteAll(paths[label]);
-                paths[label].clear();
-            }
-            else
-                paths[label] = QList<DrawPath*>();
-            for (QDomElement stroke = page_element.firstChildElement("stroke"); !stroke.isNull(); stroke = stroke.nextSiblingElement("stroke")) {
-                DrawTool const tool = toolNames.key(stroke.attribute("tool"), NoTool);
-                if (tool != NoTool) {
-                    QColor const color = QColor(stroke.attribute("color"));
-                    bool ok;
-                    qreal size = stroke.attribute("width").toDouble(&ok);
-                    if (!ok)
-                        size = defaultToolConfig[tool].size;
-                    QStringList const data = stroke.text().split(" ");
-                    paths[label].append(new DrawPath({tool, color, size, {0.}}, data, shift, scale));
-                }
-            }
-            emit pathsChanged(label, paths[label], master->shiftx, master->shifty, master->resolution);
+            AnnotationFile const header(filename);
+            if (!header.isValid())
+                return;
+            generation = header.getGeneration();
         }
+        loadBinary(filename, notesDoc);
+        lazyPagesJournaled = true;
+    }
+    journalMainFile = filename;
+    journalNotesDoc = notesDoc;
 
+    // The journal contains the changes since the main file was written, unless it is outdated.
+    QString const journalFile = filename + ".journal";
+    QVector<JournalRecord> records;
+    quint32 journalGeneration;
+    if (Journal::read(journalFile, journalGeneration, records) && journalGeneration == generation && !records.isEmpty()) {
+        qInfo() << "Restoring" << records.length() << "unsaved changes of the drawings from" << journalFile;
+        replayJournal(records);
     }
-    else if (root.attribute("creator").contains("xournal", Qt::CaseInsensitive)) {
-        // Try to import strokes from uncompressed Xournal or Xournal++ file
-        // Get filename and compare it to presentation file.
-        {
-            QDomElement const first_page = root.firstChildElement("page");
-            if (!first_page.isNull()) {
-                QDomElement const first_bg = first_page.firstChildElement("background");
-                if (!first_bg.isNull() && first_bg.hasAttribute("filename")) {
-                    QFileInfo const& presentation_fileinfo = QFileInfo(master->doc->getPath());
-                    if (first_bg.attribute("filename") != presentation_fileinfo.absoluteFilePath())
-                        qWarning() << "This Xournal(++) file uses a different PDF file path.";
-                }
-            }
+    else
+        records.clear();
+    journal = new Journal(journalFile, generation);
+    // Restored changes are written to the main file before the old journal is replaced.
+    if (!records.isEmpty())
+        writeJournalMain();
+    journal->start(QThread::LowPriority);
+    // Without interval the journal is only compacted when the program is closed.
+    if (interval > 0)
+        journalTimer.start(1000*interval);
+}
+
+void PathOverlay::replayJournal(QVector<JournalRecord> const& records)
+{
+    QSet<QString> changedPages;
+    for (QVector<JournalRecord>::const_iterator record=records.cbegin(); record!=records.cend(); record++) {
+        if (record->type == JournalRecord::ClearAll) {
+            for (QMap<QString, QList<DrawPath*>>::const_iterator page_it=paths.cbegin(); page_it!=paths.cend(); page_it++)
+                changedPages.insert(page_it.key());
+            clearAllAnnotations();
+            continue;
         }
-        for (QDomElement page_element = root.firstChildElement("page"); !page_element.isNull(); page_element = page_element.nextSiblingElement("page")) {
-            QDomElement bg = page_element.firstChildElement("background");
-            if (bg.isNull())
-                continue;
-            QDomElement layer = page_element.firstChildElement("layer");
-            if (layer.isNull() || !layer.hasChildNodes())
-                continue;
-            bool ok;
-            int const pageno = bg.attribute("pageno").remove(QRegExp("[a-z]")).toInt(&ok) - 1;
-            if (!ok)
+        if (record->type == JournalRecord::ClearPage) {
+            removeLazyPage(record->page);
+            qDeleteAll(paths[record->page]);
+            paths[record->page].clear();
+            clearHistory(record->page);
+            arenas.remove(record->page);
+            changedPages.insert(record->page);
+            continue;
+        }
+        loadPage(record->page);
+        changedPages.insert(record->page);
+        QList<DrawPath*>& list = paths[record->page];
+        if (record->type == JournalRecord::AddPath) {
+            if (record->tool.tool == NoTool || record->x.isEmpty())
                 continue;
-            QString const label = master->doc->getLabel(pageno);
-            // TODO: handle text.
-            qreal scale;
-            QPoint shift;
-            Poppler::Page const* page = master->doc->getPage(label);
-            QSizeF size;
-            if (page == nullptr)
-                size = master->page->pageSizeF();
+            int const start = pageArena(record->page)->append(record->x.constData(), record->y.constData(), record->x.length(), record->pressure.isEmpty() ? nullptr : record->pressure.constData());
+            DrawPath* const path = new DrawPath(arenas[record->page], StrokeArena::toolRecord(record->tool), start, record->x.length());
+            // Paths restored by undo or redo are inserted at their old position.
+            if (record->index >= 0 && record->index < list.length())
+                list.insert(record->index, path);
             else
-                size = page->pageSizeF();
-            if (size.width() * height() >= width() * size.height()) {
-                shift.setY(( height() - size.height()/size.width() * width() )/2);
-                scale = width() / size.width();
-            }
-            else {
-                shift.setX((width() - size.width()/size.height() * height() )/2);
-                scale = height() / size.height();
-            }
-            for (QDomElement stroke = layer.firstChildElement("stroke"); !stroke.isNull(); stroke = stroke.nextSiblingElement("stroke")) {
-                // This requires that tool names are compatible with those used by Xournal(++).
-                // But since the only stroke tools are "pen" and "highlighter", this is not a problem.
-                DrawTool const tool = toolNames.key(stroke.attribute("tool"), NoTool);
-                if (tool != NoTool) {
-                    QString colorstr = stroke.attribute("color");
-                    // Colors are saved by xournal in the format #RRGGBBAA, but Qt uses #AARRGGBB.
-                    // Try to convert between the two formats.
-                    if (colorstr[0] == '#' && colorstr.size() == 9) {
-                        colorstr.insert(1, colorstr.mid(7));
-                        colorstr.truncate(9);
-                    }
-                    QColor const color = QColor(colorstr);
-                    bool ok;
-                    qreal size = stroke.attribute("width").toDouble(&ok);
-                    if (!ok)
-                        size = defaultToolConfig[tool].size;
-                    QStringList const data = stroke.text().split(" ");
-                    paths[label].append(new DrawPath({tool, color, size, {0.}}, data, shift, scale));
-                }
-            }
-            emit pathsChanged(label, paths[label], master->shiftx, master->shifty, master->resolution);
+                list.append(path);
+            continue;
+        }
+        int i = list.length() - 1;
+        for (; i >= 0 && list[i]->getHash() != record->hash; i--) {}
+        if (i < 0) {
+            qWarning() << "Journal does not match drawings on page" << record->page;
+            continue;
+        }
+        switch (record->type)
+        {
+        case JournalRecord::ExtendPath:
+        {
+            // Nodes which were recorded before are taken from the path.
+            DrawPath* const path = list[i];
+            int const start = qMin(record->start, path->number());
+            QSharedPointer<StrokeArena> nodes(new StrokeArena());
+            nodes->append(*path->getArena(), path->getFirst(), start);
+            nodes->append(record->x.constData(), record->y.constData(), record->x.length(), record->pressure.isEmpty() ? nullptr : record->pressure.constData());
+            if (!path->extend(nodes, 0, nodes->size()).isValid())
+                qWarning() << "Journal does not match drawings on page" << record->page;
+            break;
+        }
+        case JournalRecord::SplitPath:
+        {
+            DrawPath* const path = list.takeAt(i);
+            for (int p=0; p<record->pieces.length(); p++)
+                list.insert(i+p, path->split(record->pieces[p].first, record->pieces[p].second));
+            delete path;
+            break;
+        }
+        case JournalRecord::RemovePath:
+            delete list.takeAt(i);
+            break;
+        default:
+            break;
         }
     }
-    else {
-        qWarning() << "Could not understand file: Unknown creator" << root.attribute("creator");
+    for (QSet<QString>::const_iterator label=changedPages.cbegin(); label!=changedPages.cend(); label++) {
+        invalidatePathIndex(*label);
+        layers.remove(*label);
+        compactArena(*label);
+        emit pathsChanged(*label, paths[*label]);
     }
-    file.close();
     update();
 }
 
-void PathOverlay::saveXML(QString const& filename, PdfDoc const* notedoc, bool const compress) const
+void PathOverlay::writeJournalMain()
 {
-    // Save drawings in compressed XML.
-    qInfo() << "Saving files is experimental. Files might contain errors or might be unreadable for later versions of BeamerPresenter";
-    QDomDocument doc("BeamerPresenter");
-    QDomElement root = doc.createElement("BeamerPresenter");
-    root.setAttribute("creator", "BeamerPresenter");
-    root.setAttribute("version", APP_VERSION);
-    doc.appendChild(root);
-
-    QString const presentation_file = QFileInfo(master->doc->getPath()).absoluteFilePath();
-    QString const notes_file = QFileInfo(notedoc->getPath()).absoluteFilePath();
-
-    QDomElement pres = doc.createElement("presentation");
-    pres.setAttribute("file", presentation_file);
-    pres.setAttribute("pages", master->doc->getDoc()->numPages());
-    pres.setAttribute("modified", master->doc->getLastModified().toString("yyyy-MM-dd hh:mm:ss"));
-    root.appendChild(pres);
-
-    QDomElement notes = doc.createElement("notes");
-    notes.setAttribute("file", notes_file);
-    notes.setAttribute("pages", notedoc->getDoc()->numPages());
-    notes.setAttribute("modified", notedoc->getLastModified().toString("yyyy-MM-dd hh:mm:ss"));
-    root.appendChild(notes);
+    // Only a snapshot is taken here. It is serialized and written by the journal thread.
+    Journal::Snapshot* const snapshot = new Journal::Snapshot();
+    snapshot->file = journalMainFile;
+    snapshot->presentation = annotationDocument(master->doc);
+    snapshot->notes = annotationDocument(journalNotesDoc);
+    // Pages on which paths were drawn before they were read must be read to combine both.
+    QList<QString> const drawn = lazyLabels.values();
+    for (QList<QString>::const_iterator label_it=drawn.cbegin(); label_it!=drawn.cend(); label_it++) {
+        if (!paths.value(*label_it).isEmpty())
+            loadPage(*label_it);
+    }
+    if (!lazyPages.isNull()) {
+        // Other pages which have not been read are copied to the new main file without parsing them.
+        for (QSet<QString>::const_iterator label_it=lazyLabels.cbegin(); label_it!=lazyLabels.cend(); label_it++)
+            snapshot->rawPages.insert(*label_it, lazyPages->pageData(*label_it));
+        lazyPagesJournaled = true;
+    }
+    snapshot->paths = DrawingExport::snapshot(paths);
+    journal->compact(snapshot);
+}
+
+void PathOverlay::compactJournal()
+{
+    if (journal == nullptr)
+        return;
+    applyStrokeOps();
+    if (journal->hasChanges())
+        writeJournalMain();
+}
+
+void PathOverlay::closeJournal()
+{
+    if (journal == nullptr)
+        return;
+    journalTimer.stop();
+    // The last main file must contain the pages of an XML file which have not been added yet.
+    takeAllXMLPages();
+    compactJournal();
+    journal->stop();
+    journal->wait();
+    delete journal;
+    journal = nullptr;
+}
 
+void PathOverlay::saveBinary(QString const& filename, PdfDoc const* notedoc)
+{
+    startExport(new DrawingExport(DrawingExport::Binary, filename, false, this), notedoc);
+}
+
+void PathOverlay::loadXML(QString const& filename, PdfDoc const* notesDoc)
+{
+    qInfo() << "Loading files is experimental. Files might contain errors or might be unreadable for later versions of BeamerPresenter";
+    applyStrokeOps();
+    if (!QFileInfo::exists(filename)) {
+        qCritical() << "Loading file failed: file does not exist.";
+        return;
+    }
+    // Pages which were not read from a previously opened file are kept.
+    loadAllPages();
+    QStringList labels;
+    for (int i=0; i<master->doc->getDoc()->numPages(); i++)
+        labels.append(master->doc->getLabel(i));
+    // Remember the current paths: the pages in the file replace (BeamerPresenter XML) or extend (Xournal) them.
+    xmlLoaderPaths.clear();
     for (QMap<QString, QList<DrawPath*>>::const_iterator page_it=paths.cbegin(); page_it!=paths.cend(); page_it++) {
-        QDomElement page_element = doc.createElement("page");
-        page_element.setAttribute("label", page_it.key());
-        root.appendChild(page_element);
-        Poppler::Page const* page = master->doc->getPage(page_it.key());
-        /// size of the page in points
-        QSizeF size;
-        if (page == nullptr)
-            size = master->page->pageSizeF();
-        else
-            size = page->pageSizeF();
-        /// scale page in points / pixel
-        qreal scale;
-        /// upper right corner of the page, in pixels
-        QPoint shift;
-        if (size.width() * height() >= width() * size.height()) {
-            shift.setY(( height() - size.height()/size.width() * width() )/2);
-            scale = size.width() / width();
+        QHash<DrawPath const*, quint32>& opened = xmlLoaderPaths[page_it.key()];
+        for (QList<DrawPath*>::const_iterator path_it=page_it->cbegin(); path_it!=page_it->cend(); path_it++)
+            opened.insert(*path_it, (*path_it)->getHash());
+    }
+    // The file is read in a separate thread and the pages are parsed in parallel.
+    xmlLoader = new DrawingLoader(filename, labels, annotationDocument(master->doc), annotationDocument(notesDoc));
+    connect(xmlLoader, &DrawingLoader::pageParsed, this, &PathOverlay::xmlPageParsed);
+    xmlLoader->start();
+    update();
+}
+
+void PathOverlay::takeXMLPage(QString const& label)
+{
+    applyStrokeOps();
+#ifdef DEBUG_DRAWING
+    QElapsedTimer timer;
+    timer.start();
+#endif
+    QList<DrawPath*> list;
+    bool replace;
+    bool const found = xmlLoader->takePage(label, list, replace);
+    if (xmlLoader->isEmpty()) {
+        delete xmlLoader;
+        xmlLoader = nullptr;
+    }
+    if (!found) {
+        if (xmlLoader == nullptr)
+            xmlLoaderPaths.clear();
+        return;
+    }
+#ifdef DEBUG_DRAWING
+    qDebug() << "Took page" << label << "with" << list.length() << "paths in" << timer.nsecsElapsed()/1000 << "us";
+#endif
+    QHash<DrawPath const*, quint32>& opened = xmlLoaderPaths[label];
+    auto const isOpened = [&opened](DrawPath const* path) {
+        QHash<DrawPath const*, quint32>::const_iterator const it = opened.constFind(path);
+        return it != opened.cend() && *it == path->getHash();
+    };
+    // Paths in the history are not contained in the list of paths and cannot be identified.
+    clearHistory(label);
+    QList<DrawPath*>& pagePaths = paths[label];
+    if (replace) {
+        // Remove the paths which the page contained when the file was opened.
+        for (QList<DrawPath*>::iterator path_it=pagePaths.begin(); path_it!=pagePaths.end();) {
+            if (isOpened(*path_it)) {
+                delete *path_it;
+                path_it = pagePaths.erase(path_it);
+            }
+            else
+                path_it++;
         }
-        else {
-            shift.setX((width() - size.width()/size.height() * height() )/2);
-            scale = size.height() / height();
+        opened.clear();
+    }
+    // Paths which were drawn on this page after the file was opened stay on top.
+    int index = 0;
+    while (index < pagePaths.length() && isOpened(pagePaths[index]))
+        index++;
+    for (QList<DrawPath*>::const_iterator path_it=list.cbegin(); path_it!=list.cend(); path_it++) {
+        pagePaths.insert(index++, *path_it);
+        // Following occurrences of this page in the file are placed above these paths or replace them.
+        opened.insert(*path_it, (*path_it)->getHash());
+    }
+    if (xmlLoader == nullptr)
+        xmlLoaderPaths.clear();
+    if (replace)
+        compactArena(label);
+    invalidatePathIndex(label);
+    layers.remove(label);
+    if (journal != nullptr)
+        journal->recordPage(label, pagePaths);
+    emit pathsChanged(label, pagePaths);
+    if (master->page != nullptr && master->page->label() == label)
+        update();
+}
+
+void PathOverlay::xmlPageParsed(QString const label)
+{
+    if (xmlLoader == nullptr)
+        return;
+    // Pages are recorded in the journal when they are added.
+    // With a journal, they are added as soon as they are parsed.
+    if (journal != nullptr)
+        loadPage(label, false);
+    if (master->page == nullptr)
+        return;
+    if (master->page->label() == label) {
+        loadPage(label, false);
+        // The cached layer of the page was removed when the paths were added.
+        cachePage(label);
+    }
+    else
+        prepareTimer.start();
+}
+
+bool PathOverlay::readXMLFileNames(QString const& filename, QString& presentation, QString& notes)
+{
+    GzipDevice file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QXmlStreamReader reader(&file);
+    if (!reader.readNextStartElement())
+        return false;
+    QString const creator = reader.attributes().value("creator").toString();
+    if (creator.contains("beamerpresenter", Qt::CaseInsensitive)) {
+        // File names are given in the first elements. Reading stops before the pages.
+        while (reader.readNextStartElement() && reader.name() != "page") {
+            if (reader.name() == "presentation" && presentation.isEmpty())
+                presentation = reader.attributes().value("file").toString();
+            else if (reader.name() == "notes" && notes.isEmpty())
+                notes = reader.attributes().value("file").toString();
+            reader.skipCurrentElement();
         }
-        for (QList<DrawPath*>::const_iterator path_it=page_it->cbegin(); path_it!=page_it->cend(); path_it++) {
-            QDomElement stroke = doc.createElement("stroke");
-            page_element.appendChild(stroke);
-            FullDrawTool const& tool = (*path_it)->getTool();
-            stroke.setAttribute("tool", toolNames.value(tool.tool, "unkown"));
-            // Colors are saved in #AARRGGBB format.
-            stroke.setAttribute("color", tool.color.name(QColor::HexArgb));
-            // Stroke width is saved in points.
-            stroke.setAttribute("width", tool.size*scale);
-            // Save data as list of x and y coordinates (alternating) in points.
-            QStringList stringList;
-            (*path_it)->toText(stringList, shift, scale);
-            QDomText const data = doc.createTextNode(stringList.join(" "));
-            stroke.appendChild(data);
+    }
+    else if (creator.contains("xournal", Qt::CaseInsensitive)) {
+        // The file name is an attribute of the first background element.
+        while (presentation.isEmpty() && reader.readNextStartElement()) {
+            if (reader.name() == "page")
+                continue;
+            if (reader.name() == "background")
+                presentation = reader.attributes().value("filename").toString();
+            reader.skipCurrentElement();
         }
     }
-
-    QFile file(filename);
-    file.open(QIODevice::WriteOnly);
-    if (compress)
-        file.write(qCompress(doc.toByteArray()));
-        // In order to unzip this compressed file using zlib, you need to remove the first four bytes:
-        // tail -c+5 compressed.bp | zlib-flate -uncompress > uncompressed.bp
     else
-        file.write(doc.toByteArray());
-    file.close();
+        qCritical() << "Failed to understand file: Unknown creator" << creator;
+    return true;
 }
 
-void PathOverlay::saveXournal(QString const& filename) const
+void PathOverlay::saveXML(QString const& filename, PdfDoc const* notedoc, bool const compress)
+{
+    qInfo() << "Saving files is experimental. Files might contain errors or might be unreadable for later versions of BeamerPresenter";
+    startExport(new DrawingExport(DrawingExport::XML, filename, compress, this), notedoc);
+}
+
+void PathOverlay::saveXournal(QString const& filename)
 {
     // Save drawings in a format, which can hopefully be read by Xournal(++).
+    // Files with the extensions used by Xournal(++) are compressed like the files written by Xournal(++).
     qInfo() << "Saving to this Xournal compatibility format is experimental.";
-    QDomDocument doc("Xournal-readable");
-    QDomElement root = doc.createElement("xournal");
-    root.setAttribute("creator", "BeamerPresenter " APP_VERSION);
-    doc.appendChild(root);
+    QString const suffix = QFileInfo(filename).suffix().toLower();
+    DrawingExport* const exporter = new DrawingExport(DrawingExport::Xournal, filename, suffix == "xopp" || suffix == "xoj", this);
+    for (int i=0; i<master->doc->getDoc()->numPages(); i++)
+        exporter->addPage(master->doc->getLabel(i), master->doc->getPageSize(i));
+    startExport(exporter, master->doc);
+}
 
-    // Set title.
-    {
-        QDomElement title = doc.createElement("title");
-        root.appendChild(title);
-        QDomText const title_text = doc.createTextNode("Xournal++ readable XML file created by BeamerPresenter");
-        title.appendChild(title_text);
-    }
-
-    QString presentation_file = QFileInfo(master->doc->getPath()).absoluteFilePath();
-
-    for (int i=0; i<master->doc->getDoc()->numPages(); i++) {
-        QDomElement page = doc.createElement("page");
-        QSizeF const size = master->doc->getPageSize(i);
-        page.setAttribute("width", QString::number(size.width()));
-        page.setAttribute("height", QString::number(size.height()));
-        root.appendChild(page);
-
-        QDomElement bg = doc.createElement("background");
-        bg.setAttribute("type", "pdf");
-        bg.setAttribute("domain", "absolute");
-        bg.setAttribute("filename", master->doc->getPath());
-        bg.setAttribute("pageno", QString::number(i+1) + "ll");
-        page.appendChild(bg);
-
-        QDomElement layer = doc.createElement("layer");
-        page.appendChild(layer);
-
-        /// scale page in points / pixel
-        qreal scale;
-        /// upper right corner of the page, in pixels
-        QPoint shift;
-        if (size.width() * height() >= width() * size.height()) {
-            shift.setY(( height() - size.height()/size.width() * width() )/2);
-            scale = size.width() / width();
-        }
-        else {
-            shift.setX((width() - size.width()/size.height() * height() )/2);
-            scale = size.height() / height();
-        }
-        QList<DrawPath*> const& pathlist = paths.value(master->doc->getLabel(i));
-        for (QList<DrawPath*>::const_iterator path_it=pathlist.cbegin(); path_it!=pathlist.cend(); path_it++) {
-            QDomElement stroke = doc.createElement("stroke");
-            layer.appendChild(stroke);
-            FullDrawTool const& tool = (*path_it)->getTool();
-            stroke.setAttribute("tool", toolNames.value(tool.tool, "pen"));
-            // Colors are saved by xournal in the format #RRGGBBAA, but Qt uses #AARRGGBB.
-            // Convert between the two formats.
-            QString colorstr = tool.color.name(QColor::HexArgb);
-            colorstr.append(colorstr.mid(1, 2));
-            colorstr.remove(1, 2);
-            stroke.setAttribute("color", colorstr);
-            // Stroke width is saved in points.
-            stroke.setAttribute("width", tool.size*scale);
-            // Save data as list of x and y coordinates (alternating) in points.
-            QStringList stringList;
-            (*path_it)->toText(stringList, shift, scale);
-            QDomText const data = doc.createTextNode(stringList.join(" "));
-            stroke.appendChild(data);
-        }
+void PathOverlay::startExport(DrawingExport* exporter, PdfDoc const* notedoc)
+{
+    applyStrokeOps();
+    // Saving must not wait for the XML loader. Pages which are still parsed are not saved.
+    if (xmlLoader != nullptr) {
+        QStringList const parsed = xmlLoader->parsedPages();
+        for (QStringList::const_iterator label_it=parsed.cbegin(); label_it!=parsed.cend(); label_it++)
+            loadPage(*label_it, false);
+        if (xmlLoader != nullptr)
+            qWarning() << "Drawings are still being loaded. Pages which have not been loaded yet are not saved.";
     }
+    exporter->setPaths(paths);
+    // Pages of a binary drawing file which have not been read are read by the export.
+    if (!lazyPages.isNull())
+        exporter->setUnreadPages(lazyPages, lazyLabels.values());
+    exporter->setDocuments(annotationDocument(master->doc), annotationDocument(notedoc));
+    connect(exporter, &DrawingExport::progress, this, &PathOverlay::exportProgress);
+    connect(exporter, &DrawingExport::exportFinished, this, &PathOverlay::exportFinished);
+    connect(exporter, &QThread::finished, exporter, &QObject::deleteLater);
+    exporter->start(QThread::LowPriority);
+}
 
-    QFile file(filename);
-    file.open(QIODevice::WriteOnly);
-    file.write(doc.toByteArray());
-    file.close();
+void PathOverlay::exportFinished(QString const filename, bool const success)
+{
+    if (success)
+        qInfo() << "Saved drawings to" << filename;
+    else
+        qCritical() << "Saving drawings to" << filename << "failed.";
 }
 
 void PathOverlay::drawPointer(QPainter& painter)
 {
-    // This is currently only used during slide transitions.
-    // TODO: check if this still works and whether it is still necessary.
+    // This is also used during slide transitions.
     painter.setOpacity(1.);
     if (!pointerPosition.isNull() || !stylusPosition.isNull()) {
         FullDrawTool const* thetool = &tool;
@@ -1318,21 +2001,21 @@ void PathOverlay::drawPointer(QPainter& painter)
             thetool = &stylusTool;
             position = &stylusPosition;
         }
+        if (thetool->tool != Pointer && thetool->tool != Torch)
+            return;
+        ToolSprite const& sprite = toolSprite(*thetool);
+        QPoint const center = position->toPoint();
         if (thetool->tool == Pointer) {
-            if (thetool->extras.pointer.alpha > 0 && thetool->extras.pointer.composition != 0) {
+            if (!sprite.outer.isNull()) {
                 if (thetool->extras.pointer.composition == 1)
                     painter.setCompositionMode(QPainter::CompositionMode_Lighten);
                 else
                     painter.setCompositionMode(QPainter::CompositionMode_Darken);
-                QColor color = thetool->color;
-                color.setAlpha(thetool->extras.pointer.alpha);
-                painter.setPen(QPen(color, thetool->size, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
-                painter.drawPoint(*position);
+                painter.drawImage(center - QPoint(sprite.outer.width()/2, sprite.outer.height()/2), sprite.outer);
             }
-            if (thetool->extras.pointer.inner) {
+            if (!sprite.inner.isNull()) {
                 painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-                painter.setPen(QPen(thetool->color, thetool->size/3, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
-                painter.drawPoint(*position);
+                painter.drawImage(center - QPoint(sprite.inner.width()/2, sprite.inner.height()/2), sprite.inner);
             }
             if (thetool->extras.pointer.composition == 1)
                 painter.setCompositionMode(QPainter::CompositionMode_Darken);
@@ -1340,44 +2023,365 @@ void PathOverlay::drawPointer(QPainter& painter)
                 painter.setCompositionMode(QPainter::CompositionMode_Lighten);
             else
                 painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-            painter.setPen(QPen(thetool->color, thetool->size, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
-            painter.drawPoint(*position);
+            painter.drawImage(center - QPoint(sprite.main.width()/2, sprite.main.height()/2), sprite.main);
         }
-        else if (thetool->tool == Torch) {
+        else {
+            // The page outside the sprite is filled with rectangles, the sprite contains the edge of the lit circle.
             painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-            QPainterPath rectpath;
-            rectpath.addRect(master->shiftx, master->shifty, master->pixmap.width(), master->pixmap.height());
-            QPainterPath circpath;
-            circpath.addEllipse(*position, thetool->size, thetool->size);
-            painter.fillPath(rectpath-circpath, thetool->color);
+            QRect const page(master->shiftx, master->shifty, master->pixmap.width(), master->pixmap.height());
+            QRect const square(center - QPoint(sprite.main.width()/2, sprite.main.height()/2), sprite.main.size());
+            QRect const shade[4] = {
+                QRect(page.x(), page.y(), page.width(), square.y() - page.y()),
+                QRect(page.x(), square.y() + square.height(), page.width(), page.y() + page.height() - square.y() - square.height()),
+                QRect(page.x(), square.y(), square.x() - page.x(), square.height()),
+                QRect(square.x() + square.width(), square.y(), page.x() + page.width() - square.x() - square.width(), square.height()),
+            };
+            for (QRect const& rect : shade) {
+                // QRect::intersected normalizes rectangles with negative size, which must be skipped here.
+                if (rect.width() > 0 && rect.height() > 0)
+                    painter.fillRect(rect & page, thetool->color);
+            }
+            QRect const target = square & page;
+            if (!target.isEmpty())
+                painter.drawImage(target, sprite.main, target.translated(-square.topLeft()));
+        }
+    }
+}
+
+void PathOverlay::drawMagnifier(QPainter& painter, FullDrawTool const& magnifier, QPointF const& position)
+{
+    if (enlargedPage.isNull())
+        return;
+    ToolSprite const& sprite = toolSprite(magnifier);
+    QPoint const center = position.toPoint();
+    QSize const size = sprite.main.size();
+    // Region of enlargedPage which is shown in the lens. The page is shown in its original resolution.
+    QRect const source(magnifier.extras.magnification*center - QPoint(size.width()/2, size.height()/2), size);
+    prepareEnlargedRect(source, magnifier.extras.magnification);
+    // The enlarged page is cut to the shape of the lens using the mask.
+    if (lensBuffer.size() != size)
+        lensBuffer = QImage(size, QImage::Format_ARGB32_Premultiplied);
+    lensBuffer.fill(Qt::transparent);
+    QPainter lensPainter(&lensBuffer);
+    lensPainter.drawPixmap(QPoint(0, 0), enlargedPage, source);
+    lensPainter.setCompositionMode(QPainter::CompositionMode_DestinationIn);
+    lensPainter.drawImage(0, 0, sprite.main);
+    lensPainter.end();
+    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+    painter.drawImage(center - QPoint(size.width()/2, size.height()/2), lensBuffer);
+    painter.drawImage(center - QPoint(sprite.outer.width()/2, sprite.outer.height()/2), sprite.outer);
+}
+
+PathOverlay::ToolSprite const& PathOverlay::toolSprite(FullDrawTool const& thetool)
+{
+    ToolSprite& sprite = &thetool == &stylusTool ? stylusSprite : pointerSprite;
+    if (sameSprite(sprite.tool, thetool))
+        return sprite;
+#ifdef DEBUG_DRAWING
+    qDebug() << "Rendering sprites of tool" << thetool.tool << thetool.color << thetool.size;
+#endif
+    sprite.tool = thetool;
+    sprite.main = QImage();
+    sprite.outer = QImage();
+    sprite.inner = QImage();
+    switch (thetool.tool)
+    {
+    case Pointer:
+        // The pointer is a point drawn with a round pen of width size.
+        sprite.main = discSprite(thetool.size/2, thetool.color);
+        if (thetool.extras.pointer.alpha > 0 && thetool.extras.pointer.composition != 0) {
+            QColor color = thetool.color;
+            color.setAlpha(thetool.extras.pointer.alpha);
+            sprite.outer = discSprite(thetool.size/2, color);
         }
+        if (thetool.extras.pointer.inner)
+            sprite.inner = discSprite(thetool.size/6, thetool.color);
+        break;
+    case Torch:
+    {
+        sprite.main = discSprite(thetool.size, Qt::black);
+        QPainter painter(&sprite.main);
+        painter.setCompositionMode(QPainter::CompositionMode_SourceOut);
+        painter.fillRect(sprite.main.rect(), thetool.color);
+        break;
+    }
+    case Magnifier:
+    {
+        // Room for the border of width 2 around the lens.
+        sprite.main = discSprite(thetool.size, Qt::black, 2);
+        sprite.outer = QImage(sprite.main.size(), QImage::Format_ARGB32_Premultiplied);
+        sprite.outer.fill(Qt::transparent);
+        QPainter painter(&sprite.outer);
+        painter.setRenderHint(QPainter::Antialiasing);
+        painter.setPen(QPen(thetool.color, 2));
+        painter.drawEllipse(QPointF(sprite.outer.width()/2., sprite.outer.height()/2.), thetool.size, thetool.size);
+        break;
     }
+    default:
+        break;
+    }
+    return sprite;
 }
 
 void PathOverlay::undoPath()
 {
-    if (!paths[master->page->label()].isEmpty()) {
-        undonePaths.append(paths[master->page->label()].takeLast());
-        end_cache = -1;
-        pixpaths = QPixmap();
-        update(undonePaths.last()->getOuterDrawing().toAlignedRect());
-        emit pathsChangedQuick(master->page->label(), paths[master->page->label()], master->shiftx, master->shifty, master->resolution);
+    applyStrokeOps();
+    if (master->page == nullptr)
+        return;
+    QString const label = master->page->label();
+    QMap<QString, PageHistory>::iterator history = histories.find(label);
+    if (history == histories.end() || history->done == 0)
+        return;
+    HistoryCommand const& command = history->commands[--history->done];
+    QRegion updateRegion;
+    for (int i=command.length()-1; i>=0; i--) {
+        if (!replacePaths(label, command[i].index, command[i].inserted, command[i].removed, updateRegion)) {
+            qWarning() << "Undo history does not match the drawings on page" << label;
+            clearHistory(label);
+            break;
+        }
     }
+    update(updateRegion);
 }
 
 void PathOverlay::redoPath()
 {
-    if (!undonePaths.isEmpty()) {
-        DrawPath* path = undonePaths.takeLast();
-        paths[master->page->label()].append(path);
-        update(path->getOuterDrawing().toAlignedRect());
-        emit pathsChangedQuick(master->page->label(), paths[master->page->label()], master->shiftx, master->shifty, master->resolution);
+    applyStrokeOps();
+    if (master->page == nullptr)
+        return;
+    QString const label = master->page->label();
+    QMap<QString, PageHistory>::iterator history = histories.find(label);
+    if (history == histories.end() || history->done >= history->commands.length())
+        return;
+    HistoryCommand const& command = history->commands[history->done++];
+    QRegion updateRegion;
+    for (int i=0; i<command.length(); i++) {
+        if (!replacePaths(label, command[i].index, command[i].removed, command[i].inserted, updateRegion)) {
+            qWarning() << "Undo history does not match the drawings on page" << label;
+            clearHistory(label);
+            break;
+        }
+    }
+    update(updateRegion);
+}
+
+bool PathOverlay::replacePaths(QString const& label, int const index, QList<DrawPath*> const& oldPaths, QList<DrawPath*> const& newPaths, QRegion& updateRegion)
+{
+    QList<DrawPath*>& list = paths[label];
+    if (index < 0 || index + oldPaths.length() > list.length() || list.mid(index, oldPaths.length()) != oldPaths)
+        return false;
+    QRectF rect;
+    for (int i=0; i<oldPaths.length(); i++) {
+        DrawPath* const path = list.takeAt(index);
+        rect |= path->getOuterDrawing();
+        sendRemovePath(label, path->getHash());
+    }
+    for (int i=0; i<newPaths.length(); i++) {
+        list.insert(index + i, newPaths[i]);
+        rect |= newPaths[i]->getOuterDrawing();
+        sendAddPath(label, newPaths[i], index + i < list.length() - 1 ? index + i : -1);
+    }
+    // The spatial index can only append paths on top: paths restored in between require a new index.
+    if (pathIndices.contains(label)) {
+        if (index + newPaths.length() == list.length()) {
+            for (int i=0; i<oldPaths.length(); i++)
+                pathIndices[label]->remove(oldPaths[i]);
+            for (int i=0; i<newPaths.length(); i++)
+                pathIndices[label]->append(newPaths[i]);
+        }
+        else
+            invalidatePathIndex(label);
+    }
+    // Only the region of the changed paths is drawn again.
+    damageLayer(label, index, rect, newPaths.length() - oldPaths.length());
+    updateRegion += toWidget(rect);
+    return true;
+}
+
+void PathOverlay::addHistoryStep(QString const& label, HistoryStep const& step, bool const newCommand)
+{
+    PageHistory& history = histories[label];
+    // Undone commands cannot be redone after a new change.
+    while (history.commands.length() > history.done) {
+        HistoryCommand const command = history.commands.takeLast();
+        for (HistoryCommand::const_iterator step_it=command.cbegin(); step_it!=command.cend(); step_it++)
+            qDeleteAll(step_it->inserted);
+    }
+    if (newCommand || history.commands.isEmpty()) {
+        history.commands.append(HistoryCommand());
+        history.done++;
+    }
+    history.commands.last().append(step);
+    // Limit the memory used by the history: the oldest command is forgotten.
+    if (history.commands.length() > maxHistoryLength) {
+        HistoryCommand const command = history.commands.takeFirst();
+        for (HistoryCommand::const_iterator step_it=command.cbegin(); step_it!=command.cend(); step_it++)
+            qDeleteAll(step_it->removed);
+        history.done--;
+    }
+}
+
+void PathOverlay::clearHistory(QString const& label)
+{
+    for (QMap<QString, PageHistory>::iterator history=histories.begin(); history!=histories.end();) {
+        if (!label.isEmpty() && history.key() != label) {
+            history++;
+            continue;
+        }
+        for (int i=0; i<history->commands.length(); i++) {
+            for (HistoryCommand::const_iterator step_it=history->commands[i].cbegin(); step_it!=history->commands[i].cend(); step_it++)
+                qDeleteAll(i < history->done ? step_it->removed : step_it->inserted);
+        }
+        history = histories.erase(history);
+    }
+}
+
+PathIndex* PathOverlay::pathIndex(QString const& label)
+{
+    PathIndex*& index = pathIndices[label];
+    if (index == nullptr) {
+        index = new PathIndex();
+        index->build(paths.value(label));
+#ifdef DEBUG_DRAWING
+        qDebug() << "Built spatial index of paths" << label << index->size();
+#endif
+    }
+    return index;
+}
+
+void PathOverlay::invalidatePathIndex(QString const& label)
+{
+    if (label.isEmpty()) {
+        qDeleteAll(pathIndices);
+        pathIndices.clear();
+    }
+    else
+        delete pathIndices.take(label);
+}
+
+QTransform const PathOverlay::pageTransform() const
+{
+    return QTransform(master->resolution, 0., 0., master->resolution, master->shiftx, master->shifty);
+}
+
+QPointF const PathOverlay::toPage(QPointF const& point) const
+{
+    return (point - QPointF(master->shiftx, master->shifty)) / master->resolution;
+}
+
+QRectF const PathOverlay::toPage(QRectF const& rect) const
+{
+    return QRectF(toPage(rect.topLeft()), rect.size() / master->resolution);
+}
+
+QRect const PathOverlay::toWidget(QRectF const& rect) const
+{
+    return QRectF(master->resolution*rect.topLeft() + QPointF(master->shiftx, master->shifty), master->resolution*rect.size()).toAlignedRect();
+}
+
+FullDrawTool const PathOverlay::pageTool(FullDrawTool const& widgetTool) const
+{
+    return {widgetTool.tool, widgetTool.color, widgetTool.size / master->resolution, widgetTool.extras};
+}
+
+QSharedPointer<StrokeArena> const& PathOverlay::pageArena(QString const& label)
+{
+    QSharedPointer<StrokeArena>& arena = arenas[label];
+    if (arena.isNull())
+        arena = QSharedPointer<StrokeArena>(new StrokeArena());
+    return arena;
+}
+
+void PathOverlay::compactArena(QString const& label)
+{
+    QList<DrawPath*> list = paths.value(label);
+    // Paths in the history of this page are kept in the arena as well.
+    QMap<QString, PageHistory>::const_iterator const history = histories.constFind(label);
+    if (history != histories.cend()) {
+        for (int i=0; i<history->commands.length(); i++) {
+            for (HistoryCommand::const_iterator step_it=history->commands[i].cbegin(); step_it!=history->commands[i].cend(); step_it++)
+                list += i < history->done ? step_it->removed : step_it->inserted;
+        }
+    }
+    // Paths received from the other overlay can reference nodes in its arena. These are shared
+    // as long as the other overlay uses this arena. When the other overlay has compacted its
+    // arena, only these paths keep the old arena alive and most of its nodes are not used anymore.
+    QHash<StrokeArena const*, int> used;
+    for (QList<DrawPath*>::const_iterator path_it = list.cbegin(); path_it != list.cend(); path_it++)
+        used[(*path_it)->getArena().data()] += (*path_it)->number();
+    // Only copy if a considerable amount of memory can be freed.
+    QSet<StrokeArena const*> compacted;
+    for (QHash<StrokeArena const*, int>::const_iterator it = used.cbegin(); it != used.cend(); it++)
+        if (it.key()->size() >= 2*it.value() + 4096)
+            compacted.insert(it.key());
+    if (compacted.isEmpty())
+        return;
+    // All nodes of this page which are not shared are kept in one arena.
+    QSharedPointer<StrokeArena> const old = arenas.value(label);
+    if (!old.isNull())
+        compacted.insert(old.data());
+    int number = 0;
+    for (QSet<StrokeArena const*>::const_iterator it = compacted.cbegin(); it != compacted.cend(); it++)
+        number += used.value(*it);
+#ifdef DEBUG_DRAWING
+    qDebug() << "Compacting nodes of page" << label << "from" << compacted.size() << "arenas to" << number << "nodes";
+#endif
+    QSharedPointer<StrokeArena> arena(new StrokeArena());
+    arena->reserve(number);
+    for (QList<DrawPath*>::const_iterator path_it = list.cbegin(); path_it != list.cend(); path_it++)
+        if (compacted.contains((*path_it)->getArena().data()))
+            (*path_it)->moveToArena(arena);
+    arenas[label] = arena;
+}
+
+PathOverlay::PathLayer* PathOverlay::pageLayer(QString const& label)
+{
+    QMap<QString, PathLayer>::iterator it = layers.find(label);
+    if (it == layers.end())
+        return nullptr;
+    if (it->pixmap.size() != size() || it->transform != pageTransform()) {
+        layers.erase(it);
+        return nullptr;
+    }
+    return &*it;
+}
+
+void PathOverlay::damageLayer(QString const& label, int const index, QRectF const& rect, int const change)
+{
+    QMap<QString, PathLayer>::iterator it = layers.find(label);
+    if (it == layers.end() || index >= it->end)
+        return;
+    it->end += change;
+    it->damage += toWidget(rect);
+}
+
+void PathOverlay::limitLayerMemory()
+{
+    auto const layerMemory = [](PathLayer const& layer) {
+        return (qint64(layer.pixmap.width()) * layer.pixmap.height() * layer.pixmap.depth()
+                + qint64(layer.highlight.width()) * layer.highlight.height() * layer.highlight.depth()) / 8;
+    };
+    qint64 memory = 0;
+    for (QMap<QString, PathLayer>::const_iterator it = layers.cbegin(); it != layers.cend(); it++)
+        memory += layerMemory(*it);
+    while (memory > maxLayerMemory && layers.size() > 1) {
+        QMap<QString, PathLayer>::iterator oldest = layers.end();
+        for (QMap<QString, PathLayer>::iterator it = layers.begin(); it != layers.end(); it++) {
+            if ((master->page == nullptr || it.key() != master->page->label()) && (oldest == layers.end() || it->lastUse < oldest->lastUse))
+                oldest = it;
+        }
+        if (oldest == layers.end())
+            break;
+#ifdef DEBUG_DRAWING
+        qDebug() << "Remove cached path layer" << oldest.key();
+#endif
+        memory -= layerMemory(*oldest);
+        layers.erase(oldest);
     }
 }
 
 void PathOverlay::resetCache()
 {
-     end_cache = -1;
      if (tool.tool != Magnifier) {
          delete enlargedPageRenderer;
          enlargedPageRenderer = nullptr;
@@ -22,10 +22,23 @@
 #include <QWidget>
 #include <QApplication>
 #include <QRegExp>
+#include <QTransform>
+#include <QImage>
+#include <QTimer>
+#include <QHash>
+#include <QSet>
 #include "drawpath.h"
+#include "pathindex.h"
+#include "strokeop.h"
+#include "annotationfile.h"
+#include "drawingloader.h"
+#include "journal.h"
+#include "layerrenderer.h"
+#include "inputlatency.h"
 #include "../pdf/singlerenderer.h"
 
 class DrawSlide;
+class DrawingExport;
 
 class PathOverlay : public QWidget
 {
@@ -45,31 +58,66 @@ public:
     FullDrawTool const& getStylusTool() const {return stylusTool;}
     SingleRenderer* getEnlargedPageRenderer() {return enlargedPageRenderer;}
 
+    // The save functions take a snapshot of the drawings and write it in a separate thread.
+    // Progress is reported by exportProgress.
+    /// Save drawings to binary BeamerPresenter drawing file (see AnnotationFile).
+    void saveBinary(QString const& filename, PdfDoc const* notedoc);
     /// Save drawings to compressed or uncompressed BeamerPresenter XML file.
-    void saveXML(QString const& filename, PdfDoc const* notedoc, bool const compress = true) const;
+    void saveXML(QString const& filename, PdfDoc const* notedoc, bool const compress = true);
     /// Save drawings to an XML file which should be readable for Xournal(++).
-    void saveXournal(QString const& filename) const;
+    void saveXournal(QString const& filename);
+    /// Load drawings from binary or XML file, depending on the content of the file.
+    void loadDrawings(QString const& filename, PdfDoc const* notesDoc);
+    /// Open binary BeamerPresenter drawing file.
+    /// Only the current page is read immediately, other pages are read when they are needed.
+    void loadBinary(QString const& filename, PdfDoc const* notesDoc);
     /// Load drawings from compressed or uncompressed BeamerPresenter XML file.
-    /// This function also supports reading uncompressed Xournal(++) XML files.
+    /// This function also supports reading compressed and uncompressed Xournal(++) files.
+    /// The file is read and parsed in the background (see DrawingLoader). Pages are added when they are needed.
     void loadXML(QString const& filename, PdfDoc const* nodesDoc);
+    /// Read the PDF file names from a BeamerPresenter XML or Xournal(++) file without reading the drawings.
+    /// Only empty strings are overwritten. Return false if the file is not readable as XML.
+    static bool readXMLFileNames(QString const& filename, QString& presentation, QString& notes);
+    /// Read the paths of the page with given label if they have not been read from the opened drawing files yet.
+    /// If wait is false, pages of an XML file are only added if they have already been parsed.
+    void loadPage(QString const& label, bool const wait = true);
+    /// Read all pages which have not been read from the opened drawing file yet.
+    void loadAllPages();
+    /// Save all changes of the drawings to a journal and regularly (every interval seconds)
+    /// to the binary drawing file filename. Drawings from filename and its journal are restored.
+    void openJournal(QString const& filename, PdfDoc const* notesDoc, int const interval);
+    /// Write all changes to the main file of the journal and stop the journal.
+    void closeJournal();
 
     /// Set size of eraser (in point).
     void setEraserSize(qreal const size) {eraserSize = size;}
     /// Get size of eraser (in point).
     qreal getEraserSize() const {return eraserSize;}
+    /// Set tolerance (in points of the page) and smoothing (between 0 and 1) for storing input points in paths.
+    void setStrokeSimplification(qreal const tolerance, qreal const smoothing) {strokeTolerance = tolerance; strokeSmoothing = smoothing;}
+    qreal getStrokeTolerance() const {return strokeTolerance;}
+    qreal getStrokeSmoothing() const {return strokeSmoothing;}
+    /// Set time (in ms) by which strokes are extrapolated beyond the last input point. 0 disables the prediction.
+    void setStrokePrediction(qreal const time) {strokePrediction = time;}
+    qreal getStrokePrediction() const {return strokePrediction;}
+    /// Enable or disable measuring and logging the input latency (see InputLatency).
+    void setLatencyLog(bool const enable);
+    bool hasLatencyLog() const {return latency != nullptr;}
     /// Draw pointer or torch.
     void drawPointer(QPainter& painter);
-    /// Move the last visible path to hidden paths.
+    /// Draw the magnifier at position.
+    void drawMagnifier(QPainter& painter, FullDrawTool const& magnifier, QPointF const& position);
+    /// Undo the last drawing or erasing action on the current page.
     void undoPath();
-    /// Move the last hidden path to visible paths.
+    /// Redo the last undone action on the current page.
     void redoPath();
-    /// Reset cached pixmap of path overlays.
+    /// Reset cached data which are only valid for the current page.
     void resetCache();
-    /// Draw paths to painter (starting from end_cache).
-    /// TODO: reorganize!
-    void drawPaths(QPainter& painter, QString const& label, QRegion const& region, bool const plain=false, bool const toCache=false);
-    /// Does the given rectangle have any overlap with a video?
-    bool hasVideoOverlap(QRectF const& rect) const;
+    /// Draw paths of the page with given label to painter.
+    /// If the page has a cached layer, it is used for all paths which it contains.
+    /// Highlighters are drawn below pens. They darken the slide, which is copied below them (except for videos).
+    /// plain: draw all paths directly without background for highlighters.
+    void drawPaths(QPainter& painter, QString const& label, QRegion const& region, bool const plain=false);
 
 protected:
     virtual void paintEvent(QPaintEvent*) override;
@@ -78,43 +126,272 @@ protected:
     virtual void mouseMoveEvent(QMouseEvent* event) override;
     /// Overwrite QWidget::event to handle touch and tablet events
     virtual bool event(QEvent* event) override;
-    /// Resize this widget and rescale all paths.
+    /// Resize this widget. Paths are stored in page coordinates and are not changed.
     void rescale(qint16 const oldshiftx, qint16 const oldshifty, double const oldRes);
-    /// Erase paths at given point.
-    void erase(QPointF const& point);
+    /// Erase paths along the line from previous to point.
+    /// If previous is null, only paths close to point are erased.
+    /// begin marks the press of the eraser, which starts a new command in the undo history.
+    void erase(QPointF const& point, QPointF const& previous, bool const begin);
+    /// Spatial index of the paths on the page with given label. The index is built if necessary.
+    PathIndex* pathIndex(QString const& label);
+    /// Transformation from page coordinates (in points) to widget coordinates.
+    QTransform const pageTransform() const;
+    /// Map a point from widget to page coordinates.
+    QPointF const toPage(QPointF const& point) const;
+    /// Map a rectangle from widget to page coordinates.
+    QRectF const toPage(QRectF const& rect) const;
+    /// Map a rectangle from page to widget coordinates.
+    QRect const toWidget(QRectF const& rect) const;
+    /// Tool with stroke width converted from pixels to points, as required for new paths.
+    FullDrawTool const pageTool(FullDrawTool const& widgetTool) const;
+    /// Arena for the nodes of the paths on the page with given label. The arena is created if necessary.
+    QSharedPointer<StrokeArena> const& pageArena(QString const& label);
+    /// Copy the paths of a page to a new arena if most nodes in the current arena, or in an arena of
+    /// the other overlay referenced by paths on this page, are not used anymore.
+    void compactArena(QString const& label);
+    /// Discard the spatial index of the given page or of all pages if label is empty.
+    /// The index will be rebuilt when it is needed.
+    void invalidatePathIndex(QString const& label = QString());
+    /// Number op and send it to the other path overlay.
+    void sendOp(StrokeOp& op);
+    /// Send an operation adding path to the page at the given position (-1 to append the path).
+    void sendAddPath(QString const& label, DrawPath const* path, int const index = -1);
+    /// Send an operation extending the path which had the given hash before it was extended.
+    /// The operation is sent with the next frame (see flushInput). Extensions of the same path until then are merged.
+    void sendExtendPath(QString const& label, quint32 const oldHash, DrawPath const* path);
+    /// Send the extension of extendedPath now.
+    void sendExtendedPath();
+    /// Register an input event with given timestamp (in ms) extending a path for the latency measurement.
+    void registerInput(ulong const timestamp);
+    /// Add an input point (in points of the page) to inputSamples and set the prediction of path.
+    /// The prediction extrapolates the velocity and acceleration of the last input points by strokePrediction.
+    /// Return a rectangle (in points of the page) containing the old and new prediction.
+    QRectF const predictStroke(DrawPath* path, QPointF const& position, ulong const timestamp);
+    /// Flush the input now if no input was flushed during the last frame. Otherwise wait for frameTimer.
+    void scheduleInputFlush();
+    /// Send an operation removing the path with the given hash from the page.
+    void sendRemovePath(QString const& label, quint32 const hash);
+    /// Add the paths of the page parsed by xmlLoader, waiting until the page is parsed.
+    void takeXMLPage(QString const& label);
+    /// Add all pages of xmlLoader, waiting until the file is parsed.
+    void takeAllXMLPages();
+    /// Forget about a page in lazyPages. It will not be read anymore.
+    void removeLazyPage(QString const& label);
+    /// Apply a received operation. Return false if the operation does not match the paths.
+    bool applyOp(StrokeOp const& op, QRegion& updateRegion);
+    /// Take a snapshot of the paths and start writing it in a separate thread.
+    void startExport(DrawingExport* exporter, PdfDoc const* notedoc);
+    /// Apply the records read from a journal.
+    void replayJournal(QVector<JournalRecord> const& records);
+    /// Take a snapshot of all paths, which the journal writes to its main file before it starts a new journal.
+    /// Pages which have not been read from the opened binary drawing file are copied without parsing them.
+    void writeJournalMain();
+    /// Cached images of the paths of one page.
+    /// Pens and highlighters are cached separately, such that the highlighters can be composited with the slide once per frame.
+    struct PathLayer {
+        /// Pens.
+        QPixmap pixmap;
+        /// Highlighters, or a null pixmap if the layer contains no highlighters.
+        QPixmap highlight;
+        /// Region (in widget coordinates) covered by the highlighters in the layer.
+        QRegion highlightArea;
+        /// Transformation from page to widget coordinates for which pixmap was drawn.
+        QTransform transform;
+        /// The paths with index < end in the list of paths of the page are contained in pixmap.
+        int end = 0;
+        /// Region (in widget coordinates) in which pixmap does not show these paths correctly.
+        QRegion damage;
+        /// Value of layerClock when the layer was used. Layers which were not used recently are removed first.
+        quint64 lastUse = 0;
+    };
+    /// Pre-rendered images of a pointing tool (pointer, torch or magnifier), which are drawn centered at its position.
+    /// Moving the tool only requires copying these images instead of stroking or filling paths.
+    struct ToolSprite {
+        /// Tool for which the images were rendered.
+        FullDrawTool tool{NoTool, Qt::black, 0., {0.}};
+        /// Pointer: disc. Torch: tool color with transparent circle. Magnifier: opaque mask of the lens.
+        QImage main;
+        /// Pointer: transparent halo (optional). Magnifier: border of the lens.
+        QImage outer;
+        /// Pointer: inner dot (optional).
+        QImage inner;
+    };
+    /// Return the sprites of thetool, which must be tool or stylusTool. The sprites are rendered if the tool has changed.
+    ToolSprite const& toolSprite(FullDrawTool const& thetool);
+    /// Change of the paths of a page which can be undone:
+    /// the paths removed at index were replaced by the paths inserted.
+    /// Paths obtained by splitting a path reference the same nodes, such that no nodes are copied.
+    struct HistoryStep {
+        int index;
+        QList<DrawPath*> removed;
+        QList<DrawPath*> inserted;
+    };
+    /// Steps caused by one user action (a stroke, or erasing while the eraser is pressed).
+    typedef QVector<HistoryStep> HistoryCommand;
+    /// Undo history of a page.
+    /// The history owns the paths removed by the done commands and inserted by the undone commands.
+    struct PageHistory {
+        QList<HistoryCommand> commands;
+        /// Number of commands which are done. The following commands have been undone and can be redone.
+        int done = 0;
+    };
+    /// Draw the paths with the given tool (Pen or Highlighter) and index from first to end (excluding end) of the page.
+    void drawPathRange(QPainter& painter, QString const& label, int const first, int const end, QRegion const& region, DrawTool const tool);
+    /// Region (in widget coordinates) covered by the highlighters with index from first to end (excluding end) of the page which intersect region.
+    QRegion const highlighterArea(QString const& label, int const first, int const end, QRegion const& region) const;
+    /// Layer of the given page if it exists and matches the current geometry.
+    PathLayer* pageLayer(QString const& label);
+    /// Mark rect (in page coordinates) as damaged in the layer of the page, if the layer contains the path at index.
+    /// change is the number of paths inserted (if positive) or removed (if negative) at this index.
+    void damageLayer(QString const& label, int const index, QRectF const& rect, int const change = 0);
+    /// Remove the least recently used layers until the layers fit in maxLayerMemory.
+    void limitLayerMemory();
+    /// Draw the paths of the page with given label, which are not contained in its layer yet, to the layer.
+    /// The layer is created for the current geometry if necessary.
+    void cachePage(QString const& label);
+    /// Record a change of the paths on a page in its history.
+    /// If newCommand is false, the step is undone together with the previous step.
+    void addHistoryStep(QString const& label, HistoryStep const& step, bool const newCommand = true);
+    /// Forget the history of the given page or of all pages if label is empty.
+    void clearHistory(QString const& label = QString());
+    /// Replace the paths oldPaths at index by newPaths as part of undo or redo, and send this change.
+    /// Return false if the paths on the page do not match oldPaths.
+    bool replacePaths(QString const& label, int const index, QList<DrawPath*> const& oldPaths, QList<DrawPath*> const& newPaths, QRegion& updateRegion);
+    /// Draw the enlarged page and paths in rect (in pixels of enlargedPage) if they are not drawn there yet.
+    void prepareEnlargedRect(QRect const& rect, qreal const magnification);
     /// Radius of eraser in pixel.
     qreal eraserSize = 10.;
+    /// Maximum distance between input points and the stored path in points.
+    qreal strokeTolerance = 0.1;
+    /// Fraction by which input points are moved towards the previous input point.
+    qreal strokeSmoothing = 0.;
+    /// Time in ms by which strokes are extrapolated beyond the last input point.
+    qreal strokePrediction = 0.;
+    /// Input point (in points of the page) and its event timestamp (in ms), used for predicting strokes.
+    struct InputSample {
+        QPointF position;
+        ulong time;
+    };
+    /// Last input points of the stroke which is currently drawn (at most 3).
+    QVector<InputSample> inputSamples;
+    /// Input latency measurement, or nullptr if it is disabled.
+    InputLatency* latency = nullptr;
     /// Current draw tool.
     FullDrawTool tool{NoTool, Qt::black, 0., {0.}};
     /// Tool for tablet events.
     FullDrawTool stylusTool{Pen, Qt::black, 2.5, {0.}};
     /// Currently visible paths.
     QMap<QString, QList<DrawPath*>> paths;
-    /// Undisplayed paths which could be restored.
-    QList<DrawPath*> undonePaths;
+    /// Storage for the nodes of the paths on each page.
+    QMap<QString, QSharedPointer<StrokeArena>> arenas;
+    /// Spatial indices of the paths, created when they are needed.
+    /// An index which exists must be kept up to date with paths.
+    QMap<QString, PathIndex*> pathIndices;
+    /// Maximum number of commands in the history of each page.
+    static int const maxHistoryLength = 100;
+    /// Undo histories of all pages.
+    QMap<QString, PageHistory> histories;
     /// Current position of the pointer.
     /// (0,0) indicates that no pointing tool is currently active.
     QPointF pointerPosition = QPointF();
     /// Current position of the stylus.
     /// (0,0) indicates that no stylus pointing tool is currently active.
     QPointF stylusPosition = QPointF();
-    /// Page enlarged by magnification factor: used for magnifier.
+    /// Last position of the eraser controlled by the mouse.
+    QPointF eraserPosition = QPointF();
+    /// Last position of the eraser controlled by the stylus.
+    QPointF stylusEraserPosition = QPointF();
+    /// Page with paths enlarged by magnification factor: used for magnifier.
+    /// Only the region enlargedValid is drawn, the rest is drawn when the magnifier shows it.
     QPixmap enlargedPage;
+    /// Region of enlargedPage (in pixels of enlargedPage) which shows the current page and paths.
+    QRegion enlargedValid;
+    /// Sprites of tool and stylusTool.
+    ToolSprite pointerSprite;
+    ToolSprite stylusSprite;
+    /// Buffer in which the magnified page is cut to the shape of the lens.
+    QImage lensBuffer;
     /// Renderer for enlarged page: enables rendering of enlarged page in separate thread.
     SingleRenderer* enlargedPageRenderer = nullptr;
-    /// Pixmap containing only paths.
-    QPixmap pixpaths;
-    /// Index of last path (of current slide) which is already rendered to pixpaths.
-    int end_cache = -1;
+    /// Opened binary drawing file containing pages which have not been read yet.
+    /// Exports read these pages from the file in their thread and share the file for this purpose.
+    QSharedPointer<AnnotationFile> lazyPages;
+    /// Labels of the pages in lazyPages which have not been read or removed.
+    QSet<QString> lazyLabels;
+    /// Loader of an XML drawing file containing pages which have not been added yet.
+    DrawingLoader* xmlLoader = nullptr;
+    /// Paths (with their hashes) which each page contained when xmlLoader was created, and paths added from xmlLoader.
+    /// Paths drawn after opening the file stay on top of the paths from the file.
+    QMap<QString, QHash<DrawPath const*, quint32>> xmlLoaderPaths;
+    /// Cached images of the paths on each page.
+    QMap<QString, PathLayer> layers;
+    /// Counter for PathLayer::lastUse.
+    quint64 layerClock = 0;
+    /// Maximum memory used by layers in bytes. The layer of the current page is always kept.
+    qint64 maxLayerMemory = 64*1048576L;
+    /// Timer for preparing the layer of the next page when the overlay is idle.
+    QTimer prepareTimer;
+    /// Thread drawing the layer of the next page, or nullptr.
+    LayerRenderer* layerRenderer = nullptr;
     /// Master slide to which this overlay is attached.
     DrawSlide const* master;
+    /// Operations received from the other path overlay which have not been applied yet.
+    QVector<StrokeOp> pendingOps;
+    /// Timer for applying pendingOps at most once per frame.
+    QTimer syncTimer;
+    /// Timer limiting repaints and signals caused by input events to one per frame.
+    QTimer frameTimer;
+    /// Region (in widget coordinates) changed by input events since the last frame.
+    QRegion inputDamage;
+    /// Path which was extended since its extension was last sent, or nullptr.
+    DrawPath const* extendedPath = nullptr;
+    QString extendedLabel;
+    /// Hash of extendedPath when its extension was last sent.
+    quint32 extendedHash = 0;
+    /// Time of the oldest input event included in the extension of extendedPath (see InputLatency), or -1.
+    qint64 extendedInputTime = -1;
+    /// Have pointerPosition or stylusPosition changed since they were last sent?
+    bool pointerMoved = false;
+    bool stylusMoved = false;
+    /// Identifier of this overlay in the operations it sends.
+    quint32 const overlayId;
+    /// Sequence number of the last operation sent to the other path overlay.
+    quint64 sentSequence = 0;
+    /// Sender and sequence number of the last received operation.
+    quint32 receivedOrigin = 0;
+    quint64 receivedSequence = 0;
+    /// Journal recording all changes of the paths, or nullptr.
+    Journal* journal = nullptr;
+    /// Binary drawing file into which the journal is compacted.
+    QString journalMainFile;
+    PdfDoc const* journalNotesDoc = nullptr;
+    /// Timer for compacting the journal.
+    QTimer journalTimer;
+    /// Are the pages in lazyPages contained in the main file of the journal?
+    /// Otherwise pages are recorded in the journal when they are read.
+    bool lazyPagesJournaled = false;
 
 public slots:
     /// Update enlarged page (required for magnifier) if necessary.
     /// The page is rendered in a separate thread.
     void updateEnlargedPage();
-    void setPaths(QString const pagelabel, QList<DrawPath*> const& list, qint16 const refshiftx, qint16 const refshifty, double const refresolution);
-    void setPathsQuick(QString const pagelabel, QList<DrawPath*> const& list, qint16 const refshiftx, qint16 const refshifty, double const refresolution);
+    /// Replace the paths of a page by copies of the paths in list.
+    void setPaths(QString const pagelabel, QList<DrawPath*> const& list);
+    /// Send all paths of the page with pathsChanged.
+    void resendPaths(QString const pagelabel);
+    /// Queue an operation from the other path overlay. Queued operations are applied once per frame.
+    void receiveStrokeOp(StrokeOp const& op);
+    /// Apply all queued operations immediately.
+    /// This is required before the paths are changed or read in any other way.
+    void applyStrokeOps();
+    /// Repaint the region changed by input events and send path extensions and pointer positions
+    /// collected since the last frame. Input samples are all used for drawing when they arrive,
+    /// but with tablets reporting several hundred samples per second they are only shown once per frame.
+    void flushInput();
+    /// Write the paths to the main file of the journal if they have changed.
+    void compactJournal();
+    /// Report the result of a file export.
+    void exportFinished(QString const filename, bool const success);
     /// Set pointerPosition. If refresolution==0, set pointerPosition to QPointF(0,0)
     void setPointerPosition(QPointF const point, qint16 const refshiftx, qint16 const refshifty, double const refresolution);
     /// Set stylusPosition. If refresolution==0, set stylusPosition to QPointF(0,0)
@@ -124,6 +401,13 @@ public slots:
     void setStylusTool(FullDrawTool const& newtool, qreal const resolution=-1.);
     void setStylusTool(DrawTool const newtool, QColor const color=QColor(), qreal size=-1, qreal const resolution=-1.) {setStylusTool({newtool, color, size, {0.}}, resolution);}
     void updatePathCache();
+    /// Add the paths of the next slide if they are available and draw them to its layer.
+    /// A new layer is drawn by layerRenderer in a separate thread.
+    void prepareNextPage();
+    /// Install the layer drawn by layerRenderer if the paths and the geometry have not changed.
+    void installLayer();
+    /// Add a page parsed by xmlLoader if it is shown.
+    void xmlPageParsed(QString const label);
     void relaxPointer();
     void relaxStylus();
     void togglePointerVisibility();
@@ -133,13 +417,17 @@ public slots:
 signals:
     void pointerPositionChanged(QPointF const point, qint16 const refshiftx, qint16 const refshifty, double const refresolution);
     void stylusPositionChanged(QPointF const point, qint16 const refshiftx, qint16 const refshifty, double const refresolution);
-    void pathsChangedQuick(QString const pagelabel, QList<DrawPath*> const& list, qint16 const refshiftx, qint16 const refshifty, double const refresolution);
-    void pathsChanged(QString const pagelabel, QList<DrawPath*> const& list, qint16 const refshiftx, qint16 const refshifty, double const refresolution);
+    void sendStrokeOp(StrokeOp const& op);
+    /// Request all paths of a page because received operations could not be applied.
+    void sendRequestPaths(QString const pagelabel);
+    void pathsChanged(QString const pagelabel, QList<DrawPath*> const& list);
     void sendToolChanged(FullDrawTool const tool, qreal const resolution);
     void sendUpdateEnlargedPage();
     void sendRelaxPointer();
     void sendRelaxStylus();
     void sendUpdatePathCache();
+    /// Progress (in percent) of saving drawings to filename in a separate thread.
+    void exportProgress(QString const filename, int const percent);
 };
 
 #endif // PATHOVERLAY_H
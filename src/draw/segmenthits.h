@@ -0,0 +1,77 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SEGMENTHITS_H
+#define SEGMENTHITS_H
+
+#include <algorithm>
+
+// Geometry kernels used by the eraser (see DrawPath::intersects).
+// They do not depend on Qt, such that they can be benchmarked separately (see bench/eraser.cpp).
+
+/// Squared distance between point p and the segment from a to b.
+/// This is written without branches such that loops using it can be vectorized.
+template <typename T>
+inline T segmentDistanceSquared(T const px, T const py, T const ax, T const ay, T const bx, T const by)
+{
+    T const dx = bx - ax, dy = by - ay;
+    T t = ((px - ax)*dx + (py - ay)*dy) / std::max(dx*dx + dy*dy, T(1e-12));
+    t = std::min(std::max(t, T(0)), T(1));
+    T const ex = ax + t*dx - px, ey = ay + t*dy - py;
+    return ex*ex + ey*ey;
+}
+
+/// Mark all segments of a polyline which have a distance smaller than radius to the segment from a to b.
+/// x and y point to the coordinates of the first node. Consecutive nodes are stride elements apart,
+/// such that interleaved (stride 2) and separate (stride 1) coordinate arrays can be used.
+/// hits[i] is set to 1 if segment i (from node i to node i+1) is hit and to 0 otherwise.
+template <int stride, typename T>
+void markSegmentHits(T const* x, T const* y, int const segments, T const ax, T const ay, T const bx, T const by, T const radius, unsigned char* hits)
+{
+    // First pass: compare bounding boxes. This rejects almost all segments.
+    // The loop body has no branches, which allows the compiler to vectorize it.
+    T const left = std::min(ax, bx) - radius, right = std::max(ax, bx) + radius;
+    T const top = std::min(ay, by) - radius, bottom = std::max(ay, by) + radius;
+    for (int i=0; i<segments; i++) {
+        T const px = x[i*stride], py = y[i*stride];
+        T const qx = x[(i+1)*stride], qy = y[(i+1)*stride];
+        hits[i] = (unsigned char)((std::min(px, qx) <= right) & (std::max(px, qx) >= left) & (std::min(py, qy) <= bottom) & (std::max(py, qy) >= top));
+    }
+    // Second pass: exact distance between the segments for the remaining candidates.
+    T const r2 = radius*radius;
+    T const sx = bx - ax, sy = by - ay;
+    for (int i=0; i<segments; i++) {
+        if (!hits[i])
+            continue;
+        T const px = x[i*stride], py = y[i*stride];
+        T const qx = x[(i+1)*stride], qy = y[(i+1)*stride];
+        T d = segmentDistanceSquared(ax, ay, px, py, qx, qy);
+        d = std::min(d, segmentDistanceSquared(bx, by, px, py, qx, qy));
+        d = std::min(d, segmentDistanceSquared(px, py, ax, ay, bx, by));
+        d = std::min(d, segmentDistanceSquared(qx, qy, ax, ay, bx, by));
+        // The segments can also cross each other without any end point being close to the other segment.
+        T const rx = qx - px, ry = qy - py;
+        T const o1 = sx*(py - ay) - sy*(px - ax);
+        T const o2 = sx*(qy - ay) - sy*(qx - ax);
+        T const o3 = rx*(ay - py) - ry*(ax - px);
+        T const o4 = rx*(by - py) - ry*(bx - px);
+        hits[i] = (unsigned char)((d < r2) | ((o1*o2 < 0) & (o3*o4 < 0)));
+    }
+}
+
+#endif // SEGMENTHITS_H
@@ -0,0 +1,75 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <QHash>
+#include <QPair>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include "strokearena.h"
+
+quint8 const StrokeArena::fullPressure;
+
+int StrokeArena::append(StrokeArena const& source, int const start, int const number)
+{
+    int const first = xs.size();
+    if (number <= 0)
+        return first;
+    xs.resize(first + number);
+    ys.resize(first + number);
+    ps.resize(first + number);
+    // If source is this arena, the data pointers have to be read after resizing.
+    std::copy(source.xs.constData() + start, source.xs.constData() + start + number, xs.data() + first);
+    std::copy(source.ys.constData() + start, source.ys.constData() + start + number, ys.data() + first);
+    std::copy(source.ps.constData() + start, source.ps.constData() + start + number, ps.data() + first);
+    return first;
+}
+
+int StrokeArena::append(float const* x, float const* y, int const number, quint8 const* pressure)
+{
+    int const first = xs.size();
+    if (number <= 0)
+        return first;
+    xs.resize(first + number);
+    ys.resize(first + number);
+    std::copy(x, x + number, xs.data() + first);
+    std::copy(y, y + number, ys.data() + first);
+    ps.resize(first + number);
+    if (pressure == nullptr)
+        std::fill(ps.data() + first, ps.data() + first + number, fullPressure);
+    else
+        std::copy(pressure, pressure + number, ps.data() + first);
+    return first;
+}
+
+FullDrawTool const* StrokeArena::toolRecord(FullDrawTool const& tool)
+{
+    // Records are never deleted. The size in page coordinates depends on the resolution of
+    // the overlay, such that each geometry and each imported width can create new records.
+    // The size is rounded to 1/1000 pt, which is not visible, to limit the number of records.
+    // Extras are not used by paths and are not part of the record.
+    static QMutex mutex;
+    static QHash<QPair<quint64, qint64>, FullDrawTool const*> records;
+    qint64 const size = qRound64(tool.size * 1000);
+    QPair<quint64, qint64> const key = qMakePair((quint64(tool.tool) << 32) | tool.color.rgba(), size);
+    QMutexLocker locker(&mutex);
+    FullDrawTool const*& record = records[key];
+    if (record == nullptr)
+        record = new FullDrawTool{tool.tool, tool.color, size / 1000., {0.}};
+    return record;
+}
@@ -0,0 +1,71 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STROKEARENA_H
+#define STROKEARENA_H
+
+#include <QVector>
+#include "../enumerates.h"
+
+/// Contiguous storage for the nodes of all paths on one page.
+/// x and y coordinates are stored in separate float arrays. The pressure of each node is stored
+/// in one byte (see encodePressure), which adds only 1/8 to the memory required for the coordinates.
+/// Paths reference a range of nodes in an arena. Nodes are never changed or removed individually:
+/// splitting a path creates paths which reference parts of the same range.
+/// Nodes which are not referenced anymore are only removed by copying all remaining paths to a new arena.
+/// Copies of an arena share the node arrays until one of them is changed (implicit sharing).
+class StrokeArena
+{
+private:
+    QVector<float> xs;
+    QVector<float> ys;
+    QVector<quint8> ps;
+
+public:
+    StrokeArena() {}
+
+    /// Number of nodes in the arena (including nodes which are not used anymore).
+    int size() const {return xs.size();}
+    float const* x() const {return xs.constData();}
+    float const* y() const {return ys.constData();}
+    /// Encoded pressure of the nodes.
+    quint8 const* pressure() const {return ps.constData();}
+    void reserve(int const number) {xs.reserve(number); ys.reserve(number); ps.reserve(number);}
+
+    /// Encoded pressure of nodes drawn without pressure information (mouse input).
+    static quint8 const fullPressure = 255;
+    /// Encode a pressure between 0 and 1. Nodes always keep a small width.
+    static quint8 encodePressure(qreal const pressure) {return pressure >= 1. ? fullPressure : pressure <= 0. ? 1 : quint8(qMax(1, qRound(fullPressure*pressure)));}
+    /// Pressure between 0 and 1, by which the stroke width is multiplied.
+    static qreal decodePressure(quint8 const pressure) {return qreal(pressure)/fullPressure;}
+
+    /// Append a node and return its index.
+    int append(float const x, float const y, quint8 const pressure = fullPressure) {xs.append(x); ys.append(y); ps.append(pressure); return xs.size() - 1;}
+    /// Append copies of the nodes from index start to start+number of source, which may be this arena.
+    /// Return the index of the first new node.
+    int append(StrokeArena const& source, int const start, int const number);
+    /// Append number nodes with coordinates from the arrays x and y and encoded pressure from the array pressure.
+    /// If pressure is nullptr, the nodes get full pressure. Return the index of the first new node.
+    int append(float const* x, float const* y, int const number, quint8 const* pressure = nullptr);
+
+    /// Return a shared, immutable tool record equal to tool.
+    /// Paths store a pointer to such a record instead of a copy of the tool.
+    static FullDrawTool const* toolRecord(FullDrawTool const& tool);
+};
+
+#endif // STROKEARENA_H
@@ -0,0 +1,76 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STROKEOP_H
+#define STROKEOP_H
+
+#include <QString>
+#include <QVector>
+#include <QPair>
+#include <QPointF>
+#include <QSharedPointer>
+#include "strokearena.h"
+
+/// Change of the paths on one page.
+/// Path overlays send these operations to each other to keep their paths synchronized.
+/// The operations of one sender are numbered consecutively, such that the receiver can
+/// apply each operation exactly once and detect missing operations.
+struct StrokeOp {
+    enum Type {
+        /// Append a new path (begin drawing or redo).
+        AddPath,
+        /// Extend a path to the given nodes (append nodes or end drawing).
+        ExtendPath,
+        /// Replace a path by pieces of it (eraser).
+        SplitPath,
+        /// Remove a path (undo).
+        RemovePath,
+    };
+    Type type;
+    /// Identifier of the sending path overlay.
+    quint32 origin;
+    /// Sequence number of this operation.
+    quint64 sequence;
+    /// Label of the page.
+    QString page;
+    /// Hash of the path which is changed before the change (ExtendPath, SplitPath, RemovePath).
+    quint32 hash;
+    /// Hash of the path after the change (AddPath, ExtendPath).
+    quint32 newHash;
+    /// All nodes of the path after the change (AddPath, ExtendPath).
+    QSharedPointer<StrokeArena> arena;
+    int first;
+    int count;
+    /// Tool record of the path (AddPath, ExtendPath).
+    FullDrawTool const* tool;
+    /// Position of the path in the list of paths of the page (SplitPath),
+    /// or position at which the path is inserted (AddPath, -1 to append the path).
+    int index;
+    /// Node ranges (start, end) of the pieces relative to the path (SplitPath).
+    QVector<QPair<int, int>> pieces;
+    /// Tail of the path: empty or the last input point, which is not stored as node,
+    /// optionally followed by the predicted position of the input (ExtendPath).
+    QVector<QPointF> tail;
+    /// Does this operation belong to the same user action as the previous operation (SplitPath)?
+    /// Such operations are undone together.
+    bool continues = false;
+    /// Time of the oldest input event included in this operation (see InputLatency), or -1.
+    qint64 inputTime = -1;
+};
+
+#endif // STROKEOP_H
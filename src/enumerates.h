@@ -33,6 +33,17 @@ enum PagePart {
     RightHalf = -1,
 };
 
+/// Cache format:
+/// Storage format of pages rendered to cache.
+enum CacheFormat {
+    /// PNG image with 32 bit ARGB pixels as rendered.
+    CachePNG32,
+    /// default: PNG image with 8 bit palette if the page contains at most 256 colors, RGB PNG image otherwise.
+    CacheReduced,
+    /// Like CacheReduced, but store compressed raw 16 bit RGB images instead of RGB PNG images (lossy).
+    CacheRGB565,
+};
+
 /// KeyAction: Actions handled by ControlScreen
 enum KeyAction {
     /// No Key Action. Used to indicate errors and missing KeyActions.
@@ -167,11 +178,13 @@ enum KeyAction {
     /// Restore the latest deleted stroke.
     RedoDrawing,
 
-    /// Save drawings to compressed XML file.
+    /// Save drawings to binary file.
     SaveDrawings,
+    /// Save drawings to compressed XML file.
+    SaveDrawingsXML,
     /// Save drawings to uncompressed XML file.
     SaveDrawingsUncompressed,
-    /// Load drawings from compressed or uncompressed XML file.
+    /// Load drawings from binary or (compressed or uncompressed) XML file.
     LoadDrawings,
     /// Save drawings to Xournal(++) compatibility XML format
     SaveDrawingsXournal,
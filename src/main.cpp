@@ -500,6 +500,8 @@ int main(int argc, char *argv[])
         {{"x", "log"}, "Log times of slide changes to standard output."},
 #endif
         {"color-frames", "Minimum number of frames used for each color transitions in timer colors.", "int"},
+        {"cache-format", "Storage format of cached slides: \"auto\" (lossless, 8 bit palette or RGB), \"rgb565\" (8 bit palette or 16 bit RGB) or \"argb32\" (as rendered).", "format"},
+        {"preview-quality", "JPEG quality (0-100) of cached preview slides on the control screen. A negative number disables lossy storage.", "int"},
 #ifdef CHECK_QPA_PLATFORM
         {"force-show", "Force showing notes or presentation (if in a framebuffer) independent of QPA platform plugin."},
 #endif
@@ -508,6 +510,12 @@ int main(int argc, char *argv[])
         {"mute-presentation", "Mute presentation (default: false)", "bool"},
         {"mute-notes", "Mute notes (default: true)", "bool"},
         {"eraser-size", "Radius of eraser.", "pixels"},
+        {"stroke-tolerance", "Maximum distance between input points and the stored drawing. Larger values reduce the number of stored points.", "points"},
+        {"stroke-smoothing", "Smoothing of drawn input: fraction (0 to 1) by which each input point is moved towards the previous one.", "float"},
+        {"stroke-prediction", "Time by which drawn strokes are extrapolated beyond the last input point to hide input latency (default: 0, disabled).", "ms"},
+        {"latency-log", "Log the latency from input events to painting the drawn strokes to standard error."},
+        {"autosave", "Binary drawing file to which drawings are saved automatically. Drawings from this file and unsaved changes from a previous crash are restored.", "file"},
+        {"autosave-interval", "Time in seconds between automatic saves of the drawing file (default: 60). All changes are written to a journal immediately.", "s"},
         {"icon-path", "Set path for default icons, e.g. /usr/share/icons/default", "path"},
         {"presentation", "Presentation PDF file (usually first positional argument)", "path"},
         {"notes", "Notes PDF file (usually second positional argument)", "path"},
@@ -697,29 +705,28 @@ int main(int argc, char *argv[])
                     file.open(QIODevice::ReadOnly);
                 }
 
-                // Only remaining possibilitys file cannot be interpreted or is a BeamerPresenter drawing (XML, compressed XML, or legacy binary format) or an Xournal(++) file.
+                // Only remaining possibilitys file cannot be interpreted or is a BeamerPresenter drawing (binary, XML, compressed XML, or legacy binary format) or an Xournal(++) file.
                 // Set the drawings file as a drawings file in local configuration.
                 // Later this option in local will be used to load the drawings saved in the drawings file.
                 local["drawings"] = *argument;
                 // Try to extract file names from this file if necessary (i.e. if file names are no known yet).
-                if (presentation.isEmpty() || notes.isEmpty()) {
-                    // Try to read file as BeamerPresenter drawing or Xournal(++) file (XML, compressed XML or legacy binary format).
-                    // Try to open the file as (compressed) XML document.
-                    QDomDocument doc("BeamerPresenter");
-                    // Try to open file as XML file.
-                    if (!doc.setContent(&file)) {
-                        // Failed: reopen file.
-                        file.close();
-                        file.open(QIODevice::ReadOnly);
-                        // Try to open file as compressed XML file.
-                        if (!doc.setContent(qUncompress(file.readAll())))
-                            doc.clear();
-                    }
-                    if (doc.isNull()) {
+                if ((presentation.isEmpty() || notes.isEmpty()) && AnnotationFile::isAnnotationFile(*argument)) {
+                    // Binary BeamerPresenter drawing file: only the header and index are read.
+                    file.close();
+                    AnnotationFile const drawings(*argument);
+                    if (presentation.isEmpty())
+                        presentation = drawings.getPresentation().file;
+                    if (notes.isEmpty())
+                        notes = drawings.getNotes().file;
+                }
+                else if (presentation.isEmpty() || notes.isEmpty()) {
+                    // Try to read file as BeamerPresenter drawing or Xournal(++) file (XML or compressed XML).
+                    // Only the beginning of the file is read.
+                    file.close();
+                    if (!PathOverlay::readXMLFileNames(*argument, presentation, notes)) {
                         // Deprecated: only returns an error.
                         // Try to read deprecated binary file format.
                         // Read the file in a QDataStream.
-                        file.close();
                         file.open(QIODevice::ReadOnly);
                         QDataStream stream(&file);
                         stream.setVersion(QDataStream::Qt_5_0);
@@ -730,29 +737,6 @@ int main(int argc, char *argv[])
                         if (stream.status() == QDataStream::Ok && magic == 0x2CA7D9F8) {
                             qCritical() << "Binary file format is not supported anymore since version 0.1.2.";
                         }
-                    }
-                    else {
-                        QDomElement const root = doc.documentElement();
-                        if (root.attribute("creator").contains("beamerpresenter", Qt::CaseInsensitive)) {
-                            // Try to get file names.
-                            if (presentation.isEmpty())
-                                presentation = root.firstChildElement("presentation").attribute("file");
-                            if (notes.isEmpty())
-                                notes = root.firstChildElement("notes").attribute("file");
-                        }
-                        else if (root.attribute("creator").contains("xournal", Qt::CaseInsensitive)) {
-                            // Try to get a file name.
-                            if (presentation.isEmpty()) {
-                                QDomElement const first_page = root.firstChildElement("page");
-                                QDomElement const first_bg = first_page.firstChildElement("background");
-                                presentation = first_bg.attribute("filename");
-                            }
-                        }
-                        else {
-                            qCritical() << "Failed to understand file: Unknown creator" << root.attribute("creator");
-                            file.close();
-                            throw 4;
-                        }
                         file.close();
                     }
                 }
@@ -1247,6 +1231,15 @@ int main(int argc, char *argv[])
         // Set radius of eraser tool.
         value  = qrealFromConfig(parser, local, settings, "eraser-size", 10, 1e5);
         ctrlScreen->getPresentationSlide()->getPathOverlay()->setEraserSize(value);
+
+        // Set tolerance and smoothing for storing drawn paths.
+        value = qrealFromConfig(parser, local, settings, "stroke-tolerance", 0.1, 1e3);
+        qreal const smoothing = qrealFromConfig(parser, local, settings, "stroke-smoothing", 0., 1.);
+        ctrlScreen->getPresentationSlide()->getPathOverlay()->setStrokeSimplification(value, smoothing);
+
+        // Set time by which drawn strokes are extrapolated.
+        value = qrealFromConfig(parser, local, settings, "stroke-prediction", 0., 100.);
+        ctrlScreen->getPresentationSlide()->getPathOverlay()->setStrokePrediction(value);
     }
 
     // Settings with integer values
@@ -1264,6 +1257,29 @@ int main(int argc, char *argv[])
         value = intFromConfig<quint32>(parser, local, settings, "memory", 200);
         ctrlScreen->setCacheSize(1048576L * value);
     }
+
+    // Set storage format of cached slides.
+    {
+        QString value;
+        if (!parser.value("cache-format").isEmpty())
+            value = parser.value("cache-format");
+        else if (local.contains("cache-format"))
+            value = local.value("cache-format").toString();
+        else
+            value = settings.value("cache-format", "auto").toString();
+        value = value.toLower();
+        if (value == "auto" || value == "reduced")
+            ctrlScreen->setCacheFormat(CacheReduced);
+        else if (value == "rgb565")
+            ctrlScreen->setCacheFormat(CacheRGB565);
+        else if (value == "argb32" || value == "png")
+            ctrlScreen->setCacheFormat(CachePNG32);
+        else
+            qCritical() << "option \"" << value << "\" to cache-format not understood.";
+
+        // Set JPEG quality of cached preview slides.
+        ctrlScreen->setPreviewQuality(intFromConfig<int>(parser, local, settings, "preview-quality", -1));
+    }
     {
         quint8 value;
 
@@ -1346,6 +1362,17 @@ int main(int argc, char *argv[])
     else if (settings.contains("log"))
         ctrlScreen->setLogSlideChanges(true);
 
+    // Log the input latency of drawing
+    if (parser.isSet("latency-log"))
+        ctrlScreen->getPresentationSlide()->getPathOverlay()->setLatencyLog(true);
+    else if (local.contains("latency-log")) {
+        // This is rather unintuitive. Just set any value...
+        if (!QStringList({"false", "no", "0"}).contains(local.value("latency-log").toString().toLower()))
+            ctrlScreen->getPresentationSlide()->getPathOverlay()->setLatencyLog(true);
+    }
+    else if (settings.contains("latency-log"))
+        ctrlScreen->getPresentationSlide()->getPathOverlay()->setLatencyLog(true);
+
 
     // Settings, which can cause exceptions
 
@@ -1506,7 +1533,17 @@ int main(int argc, char *argv[])
     if (local.contains("drawings")) {
         QString drawpath = local.value("drawings").toString();
         // Load the drawings.
-        ctrlScreen->loadXML(drawpath);
+        ctrlScreen->loadDrawings(drawpath);
+    }
+
+    // Save drawings automatically.
+    // The autosave file belongs to one presentation and is therefore not read from the global configuration.
+    {
+        QString autosave = parser.value("autosave");
+        if (autosave.isEmpty())
+            autosave = local.value("autosave").toString();
+        if (!autosave.isEmpty())
+            ctrlScreen->openJournal(autosave, intFromConfig<int>(parser, local, settings, "autosave-interval", 60));
     }
 
     // Start the execution loop.
@@ -129,6 +129,7 @@ static const QMap<KeyAction, QString> actionNames {
 
     {SaveDrawings, "save"},
     {LoadDrawings, "open"},
+    {SaveDrawingsXML, "save xml"},
     {SaveDrawingsUncompressed, "save uncompressed"},
     {SaveDrawingsXournal, "save xournal"},
 };
@@ -267,12 +268,14 @@ static const QMap<QString, KeyAction> keyActionMap {
     {"save drawings compatibility", KeyAction::SaveDrawingsXournal},
     {"load drawings", KeyAction::LoadDrawings},
     {"save drawings uncompressed", KeyAction::SaveDrawingsUncompressed},
+    {"save drawings xml", KeyAction::SaveDrawingsXML},
     {"save", KeyAction::SaveDrawings},
     {"save xournal", KeyAction::SaveDrawingsXournal},
     {"save xournal++", KeyAction::SaveDrawingsXournal},
     {"save compatibility", KeyAction::SaveDrawingsXournal},
     {"load", KeyAction::LoadDrawings},
     {"save uncompressed", KeyAction::SaveDrawingsUncompressed},
+    {"save xml", KeyAction::SaveDrawingsXML},
 };
 
 /// Map tool strings from configuration file to DrawTool (enum).
@@ -16,8 +16,16 @@
  * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <cstring>
+#include <QHash>
+#include <QDataStream>
 #include "basicrenderer.h"
 
+/// Magic bytes at the beginning of compressed raw RGB565 images in cache.
+static char const rgb565Magic[] = "BPR5";
+/// Size of the header of compressed raw RGB565 images: magic, width, height, bytes per line.
+static int const rgb565HeaderSize = 16;
+
 BasicRenderer::BasicRenderer(PdfDoc const* doc, PagePart const part, QObject* parent)
     : QObject(parent),
       pdf(doc),
@@ -28,16 +36,138 @@ BasicRenderer::BasicRenderer(PdfDoc const* doc, PagePart const part, QObject* pa
 }
 
 QPixmap const BasicRenderer::renderPixmap(int const page) const
+{
+    // This should only be called from within BasicRenderer and CacheMap!
+    return QPixmap::fromImage(renderImage(page));
+}
+
+QImage const BasicRenderer::renderImage(int const page) const
 {
     // This should only be called from within CacheThread, BasicRenderer and CacheMap!
     Poppler::Page const* cachePage = pdf->getPage(page);
-    QImage image = cachePage->renderToImage(72*resolution, 72*resolution);
+    QImage const image = cachePage->renderToImage(72*resolution, 72*resolution);
     if (pagePart == FullPage)
-        return QPixmap::fromImage(image);
+        return image;
     else if (pagePart == LeftHalf)
-        return QPixmap::fromImage(image.copy(0, 0, image.width()/2, image.height()));
+        return image.copy(0, 0, image.width()/2, image.height());
+    else
+        return image.copy(image.width()/2, 0, image.width()/2, image.height());
+}
+
+QByteArray const* BasicRenderer::encodeImage(QImage const& image) const
+{
+    QByteArray* bytes = new QByteArray();
+    if (image.isNull())
+        return bytes;
+    QBuffer buffer(bytes);
+    buffer.open(QIODevice::WriteOnly);
+
+    // Lossy storage. JPEG has no alpha channel, but slides are opaque.
+    if (lossyQuality >= 0) {
+        image.convertToFormat(QImage::Format_RGB888).save(&buffer, "JPG", lossyQuality);
+        return bytes;
+    }
+    if (cacheFormat == CachePNG32) {
+        image.save(&buffer, "PNG");
+        return bytes;
+    }
+
+    // Check whether the image is opaque and whether it contains at most 256 colors.
+    // This conversion does not copy the image if it already has the correct format.
+    QImage const argb = image.convertToFormat(QImage::Format_ARGB32);
+    int const width = argb.width(), height = argb.height();
+    /// Map of colors to palette indices. This is only filled as long as it contains at most 256 colors.
+    QHash<QRgb, uchar> palette;
+    bool opaque = true, fewColors = true;
+    for (int y=0; y<height && opaque; y++) {
+        QRgb const* line = reinterpret_cast<QRgb const*>(argb.constScanLine(y));
+        // Pages mostly consist of long runs of equal colors. Only look up color changes.
+        // ~line[0] is transparent and can thus not be equal to any opaque pixel.
+        QRgb last = ~line[0];
+        for (int x=0; x<width; x++) {
+            if (qAlpha(line[x]) != 255) {
+                opaque = false;
+                break;
+            }
+            if (fewColors && line[x] != last) {
+                last = line[x];
+                if (!palette.contains(last)) {
+                    if (palette.size() == 256)
+                        fewColors = false;
+                    else
+                        palette.insert(last, uchar(palette.size()));
+                }
+            }
+        }
+    }
+
+    if (!opaque) {
+        argb.save(&buffer, "PNG");
+    }
+    else if (fewColors) {
+        // Store the page as 8 bit palette image.
+        QVector<QRgb> colorTable(palette.size());
+        for (QHash<QRgb, uchar>::const_iterator it=palette.cbegin(); it!=palette.cend(); it++)
+            colorTable[*it] = it.key();
+        QImage indexed(width, height, QImage::Format_Indexed8);
+        indexed.setColorTable(colorTable);
+        for (int y=0; y<height; y++) {
+            QRgb const* line = reinterpret_cast<QRgb const*>(argb.constScanLine(y));
+            uchar* target = indexed.scanLine(y);
+            QRgb last = line[0];
+            uchar index = palette.value(last);
+            for (int x=0; x<width; x++) {
+                if (line[x] != last) {
+                    last = line[x];
+                    index = palette.value(last);
+                }
+                target[x] = index;
+            }
+        }
+        indexed.save(&buffer, "PNG");
+    }
+    else if (cacheFormat == CacheReduced) {
+        argb.convertToFormat(QImage::Format_RGB888).save(&buffer, "PNG");
+    }
+    else {
+        // Store the page as compressed raw 16 bit image, which is fast to decode.
+        QImage const rgb16 = argb.convertToFormat(QImage::Format_RGB16);
+        QDataStream stream(&buffer);
+        stream.writeRawData(rgb565Magic, 4);
+        stream << quint32(width) << quint32(height) << quint32(rgb16.bytesPerLine());
+        QByteArray const compressed = qCompress(rgb16.constBits(), rgb16.bytesPerLine()*height, 1);
+        stream.writeRawData(compressed.constData(), compressed.size());
+    }
+    return bytes;
+}
+
+QPixmap const BasicRenderer::decodePixmap(QByteArray const& bytes)
+{
+    QPixmap pixmap;
+    if (bytes.startsWith(rgb565Magic)) {
+        // Compressed raw 16 bit image.
+        QDataStream stream(bytes);
+        stream.skipRawData(4);
+        quint32 width, height, bytesPerLine;
+        stream >> width >> height >> bytesPerLine;
+        QByteArray const raw = qUncompress(reinterpret_cast<uchar const*>(bytes.constData()) + rgb565HeaderSize, bytes.size() - rgb565HeaderSize);
+        if (stream.status() != QDataStream::Ok || quint32(raw.size()) != bytesPerLine*height) {
+            qWarning() << "Failed to decode cached page.";
+            return pixmap;
+        }
+        QImage image(int(width), int(height), QImage::Format_RGB16);
+        if (quint32(image.bytesPerLine()) == bytesPerLine)
+            memcpy(image.bits(), raw.constData(), size_t(raw.size()));
+        else {
+            for (quint32 y=0; y<height; y++)
+                memcpy(image.scanLine(int(y)), raw.constData() + y*bytesPerLine, 2*width);
+        }
+        pixmap = QPixmap::fromImage(std::move(image));
+    }
     else
-        return QPixmap::fromImage(image.copy(image.width()/2, 0, image.width()/2, image.height()));
+        // PNG or JPEG image. The format is detected from the header.
+        pixmap.loadFromData(bytes);
+    return pixmap;
 }
 
 QString const BasicRenderer::getRenderCommand(int const page) const
@@ -42,6 +42,15 @@ public:
     CacheThread* getCacheThread() {return cacheThread;}
     /// Render page using poppler.
     QPixmap const renderPixmap(int const page) const;
+    /// Render page using poppler to a QImage. This is safe to use in CacheThread.
+    QImage const renderImage(int const page) const;
+    /// Encode an image for storing it in cache, using cacheFormat and lossyQuality.
+    /// The caller owns the returned bytes.
+    QByteArray const* encodeImage(QImage const& image) const;
+    /// Decode cached bytes created by encodeImage or by an external renderer.
+    static QPixmap const decodePixmap(QByteArray const& bytes);
+    /// Return true if images from an external renderer can be stored in cache without conversion.
+    bool storesRendererOutput() const {return pagePart == FullPage && cacheFormat == CachePNG32 && lossyQuality < 0;}
 
     /// Is a cache thread running?
     bool threadRunning() const {return cacheThread->isRunning();}
@@ -56,6 +65,10 @@ public:
     QString const getRenderCommand(int const page) const;
     /// Get page part.
     PagePart getPagePart() const {return pagePart;}
+    /// Set storage format of cached pages.
+    void setCacheFormat(CacheFormat const format) {cacheFormat = format;}
+    /// Set quality (0 to 100) for lossy JPEG storage of cached pages. Negative values disable lossy storage.
+    void setLossyQuality(int const quality) {lossyQuality = quality > 100 ? 100 : quality;}
 
 public slots:
     /// Get cached pages from cacheThread. Called when cacheThread finishes.
@@ -70,6 +83,10 @@ protected:
     PagePart const pagePart;
     /// Command for external renderer.
     QString renderCommand = "";
+    /// Storage format of cached pages. Ignored if lossyQuality >= 0.
+    CacheFormat cacheFormat = CacheReduced;
+    /// Quality of JPEG images in cache. Negative values disable lossy storage.
+    int lossyQuality = -1;
     /// Separate thread used to render pages to compressed cache.
     CacheThread* cacheThread;
 
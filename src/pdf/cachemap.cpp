@@ -37,10 +37,16 @@ qint64 CacheMap::setPixmap(int const page, QPixmap const* pix)
     // Check whether the pixmap is empty.
     if (pix->isNull())
         return 0;
-    QByteArray* bytes = new QByteArray();
-    QBuffer buffer(bytes);
-    buffer.open(QIODevice::WriteOnly);
-    if (!pix->save(&buffer, "PNG")) {
+    return setImage(page, pix->toImage());
+}
+
+qint64 CacheMap::setImage(int const page, QImage const& image)
+{
+    // Check whether the image is empty.
+    if (image.isNull())
+        return 0;
+    QByteArray const* bytes = encodeImage(image);
+    if (bytes->isEmpty()) {
         qWarning() << "Rendering failed." << this;
         delete bytes;
         return 0;
@@ -80,10 +86,9 @@ QPixmap const CacheMap::getCachedPixmap(int const page) const
 #ifdef DEBUG_CACHE
     qDebug() << "get cached page" << page << this << data.contains(page);
 #endif
-    QPixmap pixmap;
     if (data.contains(page))
-        pixmap.loadFromData(*data.value(page), "PNG");
-    return pixmap;
+        return decodePixmap(*data.value(page));
+    return QPixmap();
 }
 
 QPixmap const CacheMap::getPixmap(int const page)
@@ -93,7 +98,7 @@ QPixmap const CacheMap::getPixmap(int const page)
 #endif
     QPixmap pixmap;
     if (data.contains(page) && data.value(page) != nullptr) {
-        pixmap.loadFromData(*data.value(page), "PNG");
+        pixmap = decodePixmap(*data.value(page));
         // Check whether pixmap has the correct size.
         QSizeF pageSize = resolution*pdf->getPageSize(page);
         if (pagePart != FullPage)
@@ -109,9 +114,11 @@ QPixmap const CacheMap::getPixmap(int const page)
     }
     if (resolution <= 0.)
         return pixmap;
+    emit cacheMiss(page);
     if (renderCommand.isEmpty()) {
-        pixmap = renderPixmap(page);
-        emit cacheSizeChanged(setPixmap(page, &pixmap));
+        QImage const image = renderImage(page);
+        pixmap = QPixmap::fromImage(image);
+        emit cacheSizeChanged(setImage(page, image));
     }
     else {
         ExternalRenderer* renderer = new ExternalRenderer(page);
@@ -128,7 +135,7 @@ QPixmap const CacheMap::getPixmap(int const page)
             renderer->kill();
         delete renderer;
         pixmap.loadFromData(*bytes, "PNG");
-        if (pagePart == FullPage) {
+        if (storesRendererOutput()) {
             data[page] = bytes;
             emit cacheSizeChanged(bytes->size());
         }
@@ -136,7 +143,7 @@ QPixmap const CacheMap::getPixmap(int const page)
             delete bytes;
             if (pagePart == LeftHalf)
                 pixmap = pixmap.copy(0, 0, pixmap.width()/2, pixmap.height());
-            else
+            else if (pagePart == RightHalf)
                 pixmap = pixmap.copy(pixmap.width()/2, 0, pixmap.width()/2, pixmap.height());
             emit cacheSizeChanged(setPixmap(page, &pixmap));
         }
@@ -178,7 +185,8 @@ bool CacheMap::updateCache(int const page)
     if (data.contains(page))
         return false;
     cacheThread->setPage(page);
-    cacheThread->start();
+    // Rendering to cache is background work: It should not slow down painting slides and videos.
+    cacheThread->start(QThread::LowestPriority);
     return true;
 }
 
@@ -43,12 +43,15 @@ public:
     /// Calculate and return cache ssize in bytes.
     qint64 getSizeBytes() const;
     /// Set data from pixmap.
-    /// Write the pixmap in png format to a QBytesArray at *value(page).
+    /// Write the pixmap in the cache format to a QBytesArray at *value(page).
     qint64 setPixmap(int const page, QPixmap const* pix);
+    /// Set data from image.
+    /// Write the image in the cache format to a QBytesArray at *value(page).
+    qint64 setImage(int const page, QImage const& image);
     /// Clear cache.
     void clearCache();
     /// Is a page contained in cache?
-    bool contains(int const page) {return data.contains(page);}
+    bool contains(int const page) const {return data.contains(page);}
     /// Number of cached slides.
     int length() const {return data.size();}
     /// Delete a page from cache and return its size.
@@ -70,6 +73,8 @@ private:
 signals:
     /// Notify about changes in cache size (in bytes).
     void cacheSizeChanged(qint64 const size);
+    /// Notify that a page was requested, which had to be rendered in the main thread because it was not cached.
+    void cacheMiss(int const page);
 };
 
 #endif // CACHEMAP_H
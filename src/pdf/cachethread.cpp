@@ -32,16 +32,13 @@ void CacheThread::run()
     page = newPage;
     QString renderCommand = master->getRenderCommand(page);
     if (renderCommand.isEmpty()) {
-        QPixmap pixmap = master->renderPixmap(page);
+        QImage const image = master->renderImage(page);
         if (isInterruptionRequested())
             return;
-        QByteArray* bytes_nonconst = new QByteArray();
-        QBuffer buffer(bytes_nonconst);
-        buffer.open(QIODevice::WriteOnly);
-        pixmap.save(&buffer, "PNG");
+        QByteArray const* new_bytes = master->encodeImage(image);
         // Usually bytes==nullptr. But if the old bytes have not been picked up, we should delete them here.
         delete bytes;
-        bytes = bytes_nonconst;
+        bytes = new_bytes;
     }
     else {
         ExternalRenderer* renderer = new ExternalRenderer(page);
@@ -63,24 +60,19 @@ void CacheThread::run()
         delete bytes;
         bytes = renderer->getBytes();
         delete renderer;
-        if (master->getPagePart() != FullPage) {
+        if (bytes != nullptr && !master->storesRendererOutput()) {
             if (isInterruptionRequested()) {
                 delete bytes;
                 bytes = nullptr;
                 return;
             }
-            QPixmap pixmap;
-            pixmap.loadFromData(*bytes, "PNG");
+            QImage image = QImage::fromData(*bytes, "PNG");
             delete bytes;
             if (master->getPagePart() == LeftHalf)
-                pixmap = pixmap.copy(0, 0, pixmap.width()/2, pixmap.height());
-            else
-                pixmap = pixmap.copy(pixmap.width()/2, 0, pixmap.width()/2, pixmap.height());
-            QByteArray* bytes_nonconst = new QByteArray();
-            QBuffer buffer(bytes_nonconst);
-            buffer.open(QIODevice::WriteOnly);
-            pixmap.save(&buffer, "PNG");
-            bytes = bytes_nonconst;
+                image = image.copy(0, 0, image.width()/2, image.height());
+            else if (master->getPagePart() == RightHalf)
+                image = image.copy(image.width()/2, 0, image.width()/2, image.height());
+            bytes = master->encodeImage(image);
         }
     }
 }
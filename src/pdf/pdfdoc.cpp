@@ -176,6 +176,40 @@ int PdfDoc::destToSlide(QString const & dest) const
     return page;
 }
 
+QList<int> const PdfDoc::linkTargets(int const pageNumber) const
+{
+    QList<int> targets;
+    Poppler::Page const* page = getPage(pageNumber);
+    if (page == nullptr)
+        return targets;
+    QList<Poppler::Link*> const links = page->links();
+    for (QList<Poppler::Link*>::const_iterator link=links.cbegin(); link!=links.cend(); link++) {
+        if ((*link)->linkType() == Poppler::Link::Goto && !static_cast<Poppler::LinkGoto*>(*link)->isExternal()) {
+            // page = page index = page number - 1
+            int const target = static_cast<Poppler::LinkGoto*>(*link)->destination().pageNumber() - 1;
+            if (target >= 0 && target < popplerDoc->numPages() && !targets.contains(target))
+                targets.append(target);
+        }
+    }
+    qDeleteAll(links);
+    return targets;
+}
+
+QList<int> const PdfDoc::tocTargets() const
+{
+    QList<int> targets;
+    QDomDocument const* toc = popplerDoc->toc();
+    if (toc == nullptr)
+        return targets;
+    for (QDomNode n=toc->firstChild(); !n.isNull(); n=n.nextSibling()) {
+        int const target = destToSlide(n.toElement().attribute("DestinationName", ""));
+        if (target >= 0 && !targets.contains(target))
+            targets.append(target);
+    }
+    delete toc;
+    return targets;
+}
+
 QString const& PdfDoc::getLabel(int const pageNumber) const
 {
     // Check whether pageNumber is valid. Return its label.
@@ -90,6 +90,10 @@ public:
     /// Return page index (number) of a destination string (from table of contents).
     /// Return -1 if an invalid destination string is given.
     int destToSlide(QString const& dest) const;
+    /// Return page indices (numbers) of all internal link targets on the given page.
+    QList<int> const linkTargets(int const pageNumber) const;
+    /// Return page indices (numbers) of all top-level entries in the table of contents.
+    QList<int> const tocTargets() const;
     /// Return the path to the PDF file.
     QString const& getPath() const {return pdfPath;}
 };
@@ -0,0 +1,117 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <QElapsedTimer>
+#include "renderprofiler.h"
+
+/// Resolution in dpi used for profiling.
+static double const profileResolution = 18.;
+
+RenderProfiler::RenderProfiler(PdfDoc const* doc, QObject* parent) :
+    QThread(parent),
+    pdf(doc)
+{
+    // measured is emitted in this thread, but evaluate is executed in the main thread.
+    connect(this, &RenderProfiler::measured, this, &RenderProfiler::evaluate, Qt::QueuedConnection);
+}
+
+void RenderProfiler::profile()
+{
+    reset();
+    generation++;
+    start(QThread::IdlePriority);
+}
+
+void RenderProfiler::stop()
+{
+    requestInterruption();
+    wait();
+}
+
+void RenderProfiler::run()
+{
+    // generation is only changed while the thread is not running.
+    int const runGeneration = generation;
+    int const numberOfPages = pdf->getDoc()->numPages();
+    QVector<qint64> newCosts(numberOfPages, -1);
+    QElapsedTimer timer;
+    for (int page=0; page<numberOfPages; page++) {
+        if (isInterruptionRequested())
+            return;
+        Poppler::Page const* pdfPage = pdf->getPage(page);
+        if (pdfPage == nullptr)
+            continue;
+        timer.start();
+        pdfPage->renderToImage(profileResolution, profileResolution);
+        newCosts[page] = timer.nsecsElapsed()/1000;
+    }
+    mutex.lock();
+    results = newCosts;
+    mutex.unlock();
+    emit measured(runGeneration);
+}
+
+void RenderProfiler::evaluate(int const runGeneration)
+{
+    if (runGeneration != generation)
+        return;
+    mutex.lock();
+    costs = results;
+    mutex.unlock();
+    if (costs.isEmpty())
+        return;
+    QVector<qint64> sorted = costs;
+    std::sort(sorted.begin(), sorted.end());
+    // Ignore pages which could not be rendered.
+    QVector<qint64>::const_iterator const first = std::lower_bound(sorted.cbegin(), sorted.cend(), 0);
+    if (first == sorted.cend())
+        return;
+    median = std::max(Q_INT64_C(1), *(first + (sorted.cend() - first)/2));
+    slowestPage = int(std::max_element(costs.cbegin(), costs.cend()) - costs.cbegin());
+    qint64 total = 0;
+    for (QVector<qint64>::const_iterator it=first; it!=sorted.cend(); it++)
+        total += *it;
+#ifdef DEBUG_CACHE
+    for (int page=0; page<costs.size(); page++)
+        qDebug() << "Render cost of page" << page << costs[page] << "us, relative:" << relativeCost(page);
+#endif
+    qInfo() << "Profiled rendering of" << costs.size() << "pages in" << total/1000 << "ms:"
+            << expensiveNumber() << "expensive pages, slowest page" << slowestPage+1
+            << "is" << relativeCost(slowestPage) << "times slower than the median.";
+    emit profilingFinished();
+}
+
+qreal RenderProfiler::relativeCost(int const page) const
+{
+    if (median <= 0 || page < 0 || page >= costs.size() || costs[page] < 0)
+        return 1.;
+    return qreal(costs[page])/median;
+}
+
+int RenderProfiler::expensiveNumber() const
+{
+    if (median <= 0)
+        return 0;
+    int number = 0;
+    for (int page=0; page<costs.size(); page++) {
+        if (isExpensive(page))
+            number++;
+    }
+    return number;
+}
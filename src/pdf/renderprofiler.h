@@ -0,0 +1,83 @@
+/*
+ * This file is part of BeamerPresenter.
+ * Copyright (C) 2020  stiglers-eponym
+
+ * BeamerPresenter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * BeamerPresenter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef RENDERPROFILER_H
+#define RENDERPROFILER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QVector>
+#include "pdfdoc.h"
+
+/// QThread measuring the render cost of all pages of a document.
+/// Pages are rendered once at a very low resolution. The time needed for this is a good
+/// estimate for the relative render cost of pages with large figures or embedded images.
+/// The results are used by ControlScreen to prioritize expensive pages in cache.
+class RenderProfiler : public QThread
+{
+    Q_OBJECT
+
+private:
+    /// PDF document.
+    PdfDoc const* const pdf;
+    /// Render time of each page in µs. Only used in the main thread.
+    QVector<qint64> costs;
+    /// Number of the current profiling run. Results of older runs are discarded.
+    int generation = 0;
+    /// Results of the last completed run, protected by mutex.
+    QMutex mutex;
+    QVector<qint64> results;
+    /// Median of costs in µs. This is negative until the profiling has been evaluated.
+    qint64 median = -1;
+    /// Index of the page with the highest render cost.
+    int slowestPage = -1;
+    /// Pages which are at least expensiveFactor times more expensive than the median are expensive.
+    qreal expensiveFactor = 4.;
+
+public:
+    /// Constructor.
+    RenderProfiler(PdfDoc const* doc, QObject* parent = nullptr);
+    /// Render all pages and measure the render time.
+    void run() override;
+    /// Forget all results and start profiling the document. This must not be called while the thread is running.
+    void profile();
+    /// Interrupt profiling and wait until the thread has finished.
+    /// The document must not be changed while the thread is running.
+    void stop();
+    /// Forget all results.
+    void reset() {costs.clear(); median = -1; slowestPage = -1;}
+    /// Render cost of a page relative to the median. Return 1 if the page has not been profiled.
+    qreal relativeCost(int const page) const;
+    /// Check whether a page is expensive compared to the other pages.
+    bool isExpensive(int const page) const {return relativeCost(page) >= expensiveFactor;}
+    /// Number of expensive pages.
+    int expensiveNumber() const;
+
+private slots:
+    /// Take the results of run number runGeneration, calculate median and show statistics.
+    /// Called in the main thread when run() finished. Results of outdated runs are ignored.
+    void evaluate(int const runGeneration);
+
+signals:
+    /// run() has measured all pages. Emitted in the profiling thread.
+    void measured(int const runGeneration);
+    /// Profiling has finished and relativeCost can be used.
+    void profilingFinished();
+};
+
+#endif // RENDERPROFILER_H
@@ -47,7 +47,5 @@ void SingleRenderer::renderPage(const int page)
 
 QPixmap const SingleRenderer::getPixmap()
 {
-    QPixmap pixmap;
-    pixmap.loadFromData(*data, "PNG");
-    return pixmap;
+    return decodePixmap(*data);
 }
@@ -16,6 +16,7 @@
  * along with BeamerPresenter. If not, see <https://www.gnu.org/licenses/>.
  */
 #include <cmath>
+#include <algorithm>
 
 #include "controlscreen.h"
 #include "../names.h"
@@ -149,10 +150,13 @@ ControlScreen::ControlScreen(QString presentationPath, QString notesPath, PagePa
 
         // Connect drawSlide to other widgets.
         // Copy paths from draw slide to presentation slide and vice versa when drawing on one of the slides.
-        // Copy paths after moving the mouse while drawing. This assumes that only the last path is changed or a new path is created.
-        connect(drawSlide->getPathOverlay(), &PathOverlay::pathsChangedQuick, presentationScreen->slide->getPathOverlay(), &PathOverlay::setPathsQuick);
-        connect(presentationScreen->slide->getPathOverlay(), &PathOverlay::pathsChangedQuick, drawSlide->getPathOverlay(), &PathOverlay::setPathsQuick);
-        // Copy all paths. This completely updates all paths after using the erasor.
+        // Send changes of the paths while drawing, erasing, undoing and redoing. The receiver applies them once per frame.
+        connect(drawSlide->getPathOverlay(), &PathOverlay::sendStrokeOp, presentationScreen->slide->getPathOverlay(), &PathOverlay::receiveStrokeOp);
+        connect(presentationScreen->slide->getPathOverlay(), &PathOverlay::sendStrokeOp, drawSlide->getPathOverlay(), &PathOverlay::receiveStrokeOp);
+        // Copy all paths of a page if the changes could not be applied.
+        connect(drawSlide->getPathOverlay(), &PathOverlay::sendRequestPaths, presentationScreen->slide->getPathOverlay(), &PathOverlay::resendPaths);
+        connect(presentationScreen->slide->getPathOverlay(), &PathOverlay::sendRequestPaths, drawSlide->getPathOverlay(), &PathOverlay::resendPaths);
+        // Copy all paths. This is used after loading drawings.
         connect(drawSlide->getPathOverlay(), &PathOverlay::pathsChanged, presentationScreen->slide->getPathOverlay(), &PathOverlay::setPaths);
         connect(presentationScreen->slide->getPathOverlay(), &PathOverlay::pathsChanged, drawSlide->getPathOverlay(), &PathOverlay::setPaths);
         // Send pointer position (when using a pointer, torch or magnifier tool).
@@ -205,10 +209,19 @@ ControlScreen::ControlScreen(QString presentationPath, QString notesPath, PagePa
     // Connect cache maps.
     connect(previewCache, &CacheMap::cacheSizeChanged, this, &ControlScreen::updateCacheSize);
     connect(previewCache, &CacheMap::cacheThreadFinished, this, &ControlScreen::cacheThreadFinished);
+    connect(previewCache, &CacheMap::cacheMiss, this, &ControlScreen::receiveCacheMiss);
     connect(ui->notes_widget->getCacheMap(), &CacheMap::cacheSizeChanged, this, &ControlScreen::updateCacheSize);
     connect(ui->notes_widget->getCacheMap(), &CacheMap::cacheThreadFinished, this, &ControlScreen::cacheThreadFinished);
+    connect(ui->notes_widget->getCacheMap(), &CacheMap::cacheMiss, this, &ControlScreen::receiveCacheMiss);
     connect(presentationScreen->slide->getCacheMap(), &CacheMap::cacheSizeChanged, this, &ControlScreen::updateCacheSize);
+    // Show progress of saving drawings in the window title.
+    connect(presentationScreen->slide->getPathOverlay(), &PathOverlay::exportProgress, this, &ControlScreen::showExportProgress);
     connect(presentationScreen->slide->getCacheMap(), &CacheMap::cacheThreadFinished, this, &ControlScreen::cacheThreadFinished);
+    connect(presentationScreen->slide->getCacheMap(), &CacheMap::cacheMiss, this, &ControlScreen::receiveCacheMiss);
+
+    // Measure render costs of all pages in the background. Expensive pages are rendered to cache earlier and freed last.
+    renderProfiler = new RenderProfiler(presentation, this);
+    renderProfiler->profile();
 
     // Create widget showing table of content (TocBox) on the control screen.
     // tocBox is empty by default and will be updated when it is shown for the first time.
@@ -361,6 +374,8 @@ ControlScreen::~ControlScreen()
 {
     // Hide widgets which are shown above the notes widget.
     showNotes();
+    // Save automatically saved drawings while both PDF documents exist.
+    presentationScreen->slide->getPathOverlay()->closeJournal();
     // Delete widgets which would be shown above the notes widget.
     delete tocBox;
     delete overviewBox;
@@ -369,6 +384,16 @@ ControlScreen::~ControlScreen()
     cacheTimer->disconnect();
     interruptCacheProcesses(10000);
     delete cacheTimer;
+    renderProfiler->disconnect();
+    renderProfiler->requestInterruption();
+    renderProfiler->wait(10000);
+    if (renderProfiler->isRunning()) {
+        renderProfiler->terminate();
+        renderProfiler->wait(10000);
+    }
+    delete renderProfiler;
+    if (deadlineMisses > 0)
+        qInfo() << "The next slide was not rendered to cache in time after" << deadlineMisses << "page changes.";
 
     // Disconnect draw slide.
     if (drawSlide != nullptr && drawSlide != ui->notes_widget)
@@ -419,6 +444,17 @@ ControlScreen::~ControlScreen()
     delete ui;
 }
 
+void ControlScreen::showExportProgress(QString const filename, int const percent)
+{
+    QString title = windowTitle();
+    int const suffix = title.indexOf(" (saving ");
+    if (suffix >= 0)
+        title.truncate(suffix);
+    if (percent < 100)
+        title += " (saving " + QFileInfo(filename).fileName() + ": " + QString::number(percent) + "%)";
+    setWindowTitle(title);
+}
+
 void ControlScreen::recalcLayout(const int pageNumber)
 {
 #ifdef DEBUG_RENDERING
@@ -486,6 +522,9 @@ void ControlScreen::recalcLayout(const int pageNumber)
         // Set scaled tool sizes for draw slide.
         drawSlide->getPathOverlay()->setTool(presentationScreen->slide->getPathOverlay()->getTool(), presentationScreen->slide->getResolution());
         drawSlide->getPathOverlay()->setEraserSize(scale*presentationScreen->slide->getPathOverlay()->getEraserSize());
+        drawSlide->getPathOverlay()->setStrokeSimplification(presentationScreen->slide->getPathOverlay()->getStrokeTolerance(), presentationScreen->slide->getPathOverlay()->getStrokeSmoothing());
+        drawSlide->getPathOverlay()->setStrokePrediction(presentationScreen->slide->getPathOverlay()->getStrokePrediction());
+        drawSlide->getPathOverlay()->setLatencyLog(presentationScreen->slide->getPathOverlay()->hasLatencyLog());
         if (drawSlide != ui->notes_widget) {
             // Adapt geometry of draw slide: It should have the same geometry as the notes slide.
             drawSlide->setGeometry(ui->notes_widget->rect());
@@ -619,11 +658,10 @@ void ControlScreen::renderPage(int const pageNumber, bool const full)
         // TODO: improve this part.
         // It is possible that presentationScreen->slide contains drawings which have not been copied to drawSlide yet.
         QString label = presentation->getLabel(currentPageNumber);
-        if (drawSlide->getPage() != nullptr && !drawSlide->getPathOverlay()->getPaths().contains(label)) {
-            qint16 const sx=presentationScreen->slide->getXshift(), sy=presentationScreen->slide->getYshift();
-            qreal res = presentationScreen->slide->getResolution();
-            drawSlide->getPathOverlay()->setPaths(label, presentationScreen->slide->getPathOverlay()->getPaths()[label], sx, sy, res);
-        }
+        // Paths which have not been read from a drawing file yet are sent to drawSlide when they are read.
+        presentationScreen->slide->getPathOverlay()->loadPage(label);
+        if (drawSlide->getPage() != nullptr && !drawSlide->getPathOverlay()->getPaths().contains(label))
+            drawSlide->getPathOverlay()->setPaths(label, presentationScreen->slide->getPathOverlay()->getPaths()[label]);
 
         // Update current slide
         drawSlide->renderPage(currentPageNumber, false);
@@ -672,6 +710,11 @@ void ControlScreen::updateCache()
 
     // Stop running cache updates
     cacheTimer->stop();
+    // Pages which must be cached before the next page change.
+    updateDeadline();
+    triedExpensivePages.clear();
+    // Link and TOC targets, which should be cached.
+    updatePrefetchPages();
     // Number of currently cached slides
     int const cacheNumber = presentationScreen->slide->getCacheMap()->length();
     if (
@@ -753,12 +796,53 @@ void ControlScreen::updateCacheStep()
     *    ControlScreen::cacheThreadFinished is called.
     * 6. cacheThreadFinished decrements cacheThreadsRunning.
     *    If cacheThreadsRunning==0, starts cacheTimer again.
+    *
+    * Before step 2 the pages in deadlinePages (next page and next slide) are rendered
+    * to all caches, independent of the cache region and the cache limits.
+    *
+    * The interval of cacheTimer is adapted in yieldCacheStep: While a slide transition
+    * is shown, no pages are rendered. While multimedia content is playing, pages are
+    * rendered with a delay of cacheThrottleInterval. Otherwise cacheTimer runs with
+    * interval 0 to catch up in idle periods.
     */
 
 #ifdef DEBUG_CACHE
     qDebug() << "Update cache step" << cacheThreadsRunning << cacheSize << maxCacheSize << maxCacheNumber;
 #endif
 
+    // Don't compete with slide transitions or multimedia playback for CPU time.
+    if (yieldCacheStep())
+        return;
+
+    // Deadline: The next page and the next slide must be cached before all other pages.
+    while (!deadlinePages.isEmpty() && isFullyCached(deadlinePages.first()))
+        deadlinePages.removeFirst();
+    if (!deadlinePages.isEmpty()) {
+        int const page = deadlinePages.first();
+#ifdef DEBUG_CACHE
+        qDebug() << "Cache deadline page" << page;
+#endif
+        cachePage(page);
+        // If no cache thread could be started, the page cannot be cached. Don't try again.
+        if (cacheThreadsRunning == 0)
+            deadlinePages.removeOne(page);
+        return;
+    }
+
+    // Expensive pages are rendered to cache further ahead than other pages.
+    {
+        int const page = nextExpensivePage();
+        if (page >= 0) {
+#ifdef DEBUG_CACHE
+            qDebug() << "Cache expensive page" << page << renderProfiler->relativeCost(page);
+#endif
+            // Like deadline pages, each expensive page is only tried once.
+            triedExpensivePages.insert(page);
+            cachePage(page);
+            return;
+        }
+    }
+
     // TODO: improve this, make it more deterministic, avoid caching pages which will directly be freed again
     if (
             presentationScreen->slide->getCacheMap()->length() == numberOfPages
@@ -787,7 +871,21 @@ void ControlScreen::updateCacheStep()
     // Free space if necessary
     while (cacheSize > maxCacheSize || (maxCacheNumber < numberOfPages && presentationScreen->slide->getCacheMap()->length() > maxCacheNumber) ) {
         // Start deleting later slides if less than 1/4 of the caches slides are previous slides
-        if (last_delete > 4*currentPageNumber - 3*first_delete) {
+        bool deleteLast = last_delete > 4*currentPageNumber - 3*first_delete;
+        // Expensive pages are freed last: try the other end of the cache region first.
+        if (deleteLast && renderProfiler->isExpensive(last_delete) && first_delete < currentPageNumber && !renderProfiler->isExpensive(first_delete))
+            deleteLast = false;
+        else if (!deleteLast && renderProfiler->isExpensive(first_delete) && last_delete > currentPageNumber + expensiveLookahead && !renderProfiler->isExpensive(last_delete))
+            deleteLast = true;
+        if (deleteLast) {
+            // Never delete the pages which should be ready for the next page change.
+            if (last_delete <= presentation->getNextSlideIndex(presentationScreen->getPageNumber())) {
+                cacheTimer->stop();
+#ifdef DEBUG_CACHE
+                qDebug() << "Stopped cache timer: cache is full." << first_delete << first_cached << currentPageNumber << last_cached << last_delete;
+#endif
+                return;
+            }
             if (freeCachePage(last_delete))
                 break;
             last_delete--;
@@ -818,6 +916,9 @@ void ControlScreen::updateCacheStep()
             return;
         }
         else {
+            // The cache region is complete. Use the remaining space for link and TOC targets.
+            if (cachePrefetchPage())
+                return;
             cacheTimer->stop();
 #ifdef DEBUG_CACHE
             qDebug() << "Stopped cache timer" << first_delete << first_cached << currentPageNumber << last_cached << last_delete;
@@ -834,6 +935,9 @@ void ControlScreen::updateCacheStep()
              // The remaining cache space is smaller than twice the average space needed per presentation slide.
              && (maxCacheSize - cacheSize)*presentationScreen->slide->getCacheMap()->length() < 2*cacheSize
              ) {
+        // The cache region is complete. Use the remaining space for link and TOC targets.
+        if (cachePrefetchPage())
+            return;
         cacheTimer->stop();
 #ifdef DEBUG_CACHE
         qDebug() << "Stopped cache timer" << first_delete << first_cached << currentPageNumber << last_cached << last_delete;
@@ -846,6 +950,129 @@ void ControlScreen::updateCacheStep()
     }
 }
 
+void ControlScreen::updateDeadline()
+{
+    deadlinePages.clear();
+    int const page = presentationScreen->getPageNumber();
+    if (page < 0 || page >= numberOfPages - 1)
+        return;
+    deadlinePages.append(page + 1);
+    int const nextSlide = presentation->getNextSlideIndex(page);
+    if (nextSlide > page + 1 && nextSlide < numberOfPages)
+        deadlinePages.append(nextSlide);
+}
+
+void ControlScreen::updatePrefetchPages()
+{
+    prefetchPages.clear();
+    int const page = presentationScreen->getPageNumber();
+    if (page < 0 || page >= numberOfPages)
+        return;
+    prefetchPages = presentation->linkTargets(page);
+    if (page + 1 < numberOfPages) {
+        for (int const target : presentation->linkTargets(page + 1)) {
+            if (!prefetchPages.contains(target))
+                prefetchPages.append(target);
+        }
+    }
+    if (!tocTargetsValid) {
+        tocTargets = presentation->tocTargets();
+        tocTargetsValid = true;
+    }
+    for (int const target : tocTargets) {
+        if (!prefetchPages.contains(target))
+            prefetchPages.append(target);
+    }
+}
+
+bool ControlScreen::cachePrefetchPage()
+{
+    // Link and TOC targets are rendered to cache if there is free space.
+    while (!prefetchPages.isEmpty() && isFullyCached(prefetchPages.first()))
+        prefetchPages.removeFirst();
+    if (
+            prefetchPages.isEmpty()
+            || cacheSize >= maxCacheSize
+            || (maxCacheNumber < numberOfPages && presentationScreen->slide->getCacheMap()->length() >= maxCacheNumber)
+            )
+        return false;
+    // Each page is only tried once.
+    int const page = prefetchPages.takeFirst();
+#ifdef DEBUG_CACHE
+    qDebug() << "Cache link target" << page;
+#endif
+    cachePage(page);
+    return true;
+}
+
+int ControlScreen::nextExpensivePage() const
+{
+    // Only use free cache space. Expensive pages should not replace other cached pages.
+    if (cacheSize >= maxCacheSize || (maxCacheNumber < numberOfPages && presentationScreen->slide->getCacheMap()->length() >= maxCacheNumber))
+        return -1;
+    int const end = std::min(currentPageNumber + expensiveLookahead, numberOfPages - 1);
+    for (int page = std::max(last_cached + 1, currentPageNumber); page <= end; page++) {
+        if (renderProfiler->isExpensive(page) && !isFullyCached(page) && !triedExpensivePages.contains(page))
+            return page;
+    }
+    return -1;
+}
+
+bool ControlScreen::isFullyCached(int const page) const
+{
+    // Caches with resolution <= 0 are not used and never filled.
+    CacheMap const* const maps[] = {
+        presentationScreen->slide->getCacheMap(),
+        ui->notes_widget->getCacheMap(),
+        previewCache,
+        previewCacheX,
+        drawSlideCache
+    };
+    for (CacheMap const* map : maps) {
+        if (map != nullptr && map->getResolution() > 0. && !map->contains(page))
+            return false;
+    }
+    return true;
+}
+
+void ControlScreen::receiveCacheMiss(int const page)
+{
+    if (!deadlinePages.contains(page))
+        return;
+    // Count each page change only once, even if several caches missed the page.
+    deadlinePages.clear();
+    deadlineMisses++;
+    qWarning() << "Deadline missed: page" << page+1 << "was not rendered to cache in time." << deadlineMisses << "misses so far.";
+}
+
+bool ControlScreen::yieldCacheStep()
+{
+    // Pause while a slide transition is shown: every frame of the transition should be painted in time.
+    if (presentationScreen->slide->isShowingTransition()) {
+        if (cacheTimer->interval() != cachePauseInterval)
+            cacheTimer->setInterval(cachePauseInterval);
+#ifdef DEBUG_CACHE
+        qDebug() << "Cache paused during slide transition";
+#endif
+        return true;
+    }
+    // Throttle rendering to cache while videos or sounds are playing.
+    int const interval = (
+                presentationScreen->slide->hasActiveMultimediaContent()
+                || ui->notes_widget->hasActiveMultimediaContent()
+                || (drawSlide != nullptr && drawSlide->isVisible() && drawSlide->hasActiveMultimediaContent())
+            ) ? cacheThrottleInterval : 0;
+    if (cacheTimer->interval() != interval) {
+#ifdef DEBUG_CACHE
+        qDebug() << "Changed cache timer interval" << cacheTimer->interval() << "->" << interval;
+#endif
+        cacheTimer->setInterval(interval);
+        // Wait for the next timeout if the interval was increased.
+        return interval > 0;
+    }
+    return false;
+}
+
 bool ControlScreen::freeCachePage(const int page)
 {
     if (drawSlideCache != nullptr) {
@@ -914,6 +1141,26 @@ void ControlScreen::setCacheSize(qint64 const size)
     maxCacheSize = size;
 }
 
+void ControlScreen::setCacheFormat(CacheFormat const format)
+{
+    cacheFormat = format;
+    presentationScreen->slide->getCacheMap()->setCacheFormat(format);
+    ui->notes_widget->getCacheMap()->setCacheFormat(format);
+    previewCache->setCacheFormat(format);
+    if (previewCacheX != nullptr)
+        previewCacheX->setCacheFormat(format);
+    if (drawSlideCache != nullptr)
+        drawSlideCache->setCacheFormat(format);
+}
+
+void ControlScreen::setPreviewQuality(int const quality)
+{
+    previewQuality = quality;
+    previewCache->setLossyQuality(quality);
+    if (previewCacheX != nullptr)
+        previewCacheX->setLossyQuality(quality);
+}
+
 void ControlScreen::setTocLevel(quint8 const level)
 {
     if (level<1) {
@@ -1654,6 +1901,16 @@ bool ControlScreen::handleKeyAction(KeyAction const action)
             qDebug() << "Save drawings event" << action;
 #endif
             QString const savePath = QFileDialog::getSaveFileName(this, "Save drawings");
+            if (!savePath.isEmpty())
+                presentationScreen->slide->getPathOverlay()->saveBinary(savePath, notes);
+        }
+        break;
+    case KeyAction::SaveDrawingsXML:
+        {
+#ifdef DEBUG_KEY_ACTIONS
+            qDebug() << "Save drawings event" << action;
+#endif
+            QString const savePath = QFileDialog::getSaveFileName(this, "Save drawings XML");
             if (!savePath.isEmpty())
                 presentationScreen->slide->getPathOverlay()->saveXML(savePath, notes);
         }
@@ -1685,7 +1942,7 @@ bool ControlScreen::handleKeyAction(KeyAction const action)
 #endif
             QString const loadPath = QFileDialog::getOpenFileName(this, "Load drawings");
             if (!loadPath.isEmpty())
-                presentationScreen->slide->getPathOverlay()->loadXML(loadPath, notes);
+                presentationScreen->slide->getPathOverlay()->loadDrawings(loadPath, notes);
         }
         break;
     case NoAction:
@@ -1768,6 +2025,9 @@ void ControlScreen::presentationResized()
         if (scale < 1e-5)
             scale = 1.;
         drawSlide->getPathOverlay()->setEraserSize(scale*presentationScreen->slide->getPathOverlay()->getEraserSize());
+        drawSlide->getPathOverlay()->setStrokeSimplification(presentationScreen->slide->getPathOverlay()->getStrokeTolerance(), presentationScreen->slide->getPathOverlay()->getStrokeSmoothing());
+        drawSlide->getPathOverlay()->setStrokePrediction(presentationScreen->slide->getPathOverlay()->getStrokePrediction());
+        drawSlide->getPathOverlay()->setLatencyLog(presentationScreen->slide->getPathOverlay()->hasLatencyLog());
     }
 }
 
@@ -1958,6 +2218,9 @@ void ControlScreen::reloadFiles()
 {
     // Stop the cache management and wait until the cache threads finish.
     interruptCacheProcesses(10000);
+    // The profiler renders pages of the presentation: stop it before the document is replaced.
+    bool const profiling = renderProfiler->isRunning();
+    renderProfiler->stop();
 
     /// True if files have changed.
     bool change = false;
@@ -1977,6 +2240,9 @@ void ControlScreen::reloadFiles()
         if (unlimitedCache)
             maxCacheNumber = numberOfPages;
         presentationScreen->updatedFile();
+        // Profile the new document.
+        renderProfiler->profile();
+        tocTargetsValid = false;
         ui->current_slide->clearAll();
         ui->next_slide->clearAll();
         // Hide TOC and overview and set them outdated
@@ -1985,6 +2251,9 @@ void ControlScreen::reloadFiles()
         tocBox->createToc();
         overviewBox->setOutdated();
     }
+    // Continue profiling if it was interrupted although the presentation has not changed.
+    else if (profiling)
+        renderProfiler->profile();
     // If one of the two files has changed: Reset cache region and render pages on control screen.
     if (change) {
         first_cached = currentPageNumber;
@@ -2027,10 +2296,13 @@ void ControlScreen::showDrawSlide()
 
         // Connect drawSlide to other widgets.
         // Copy paths from draw slide to presentation slide and vice versa when drawing on one of the slides.
-        // Copy paths after moving the mouse while drawing. This assumes that only the last path is changed or a new path is created.
-        connect(drawSlide->getPathOverlay(), &PathOverlay::pathsChangedQuick, presentationScreen->slide->getPathOverlay(), &PathOverlay::setPathsQuick);
-        connect(presentationScreen->slide->getPathOverlay(), &PathOverlay::pathsChangedQuick, drawSlide->getPathOverlay(), &PathOverlay::setPathsQuick);
-        // Copy all paths. This completely updates all paths after using the erasor.
+        // Send changes of the paths while drawing, erasing, undoing and redoing. The receiver applies them once per frame.
+        connect(drawSlide->getPathOverlay(), &PathOverlay::sendStrokeOp, presentationScreen->slide->getPathOverlay(), &PathOverlay::receiveStrokeOp);
+        connect(presentationScreen->slide->getPathOverlay(), &PathOverlay::sendStrokeOp, drawSlide->getPathOverlay(), &PathOverlay::receiveStrokeOp);
+        // Copy all paths of a page if the changes could not be applied.
+        connect(drawSlide->getPathOverlay(), &PathOverlay::sendRequestPaths, presentationScreen->slide->getPathOverlay(), &PathOverlay::resendPaths);
+        connect(presentationScreen->slide->getPathOverlay(), &PathOverlay::sendRequestPaths, drawSlide->getPathOverlay(), &PathOverlay::resendPaths);
+        // Copy all paths. This is used after loading drawings.
         connect(drawSlide->getPathOverlay(), &PathOverlay::pathsChanged, presentationScreen->slide->getPathOverlay(), &PathOverlay::setPaths);
         connect(presentationScreen->slide->getPathOverlay(), &PathOverlay::pathsChanged, drawSlide->getPathOverlay(), &PathOverlay::setPaths);
         // Send pointer position (when using a pointer, torch or magnifier tool).
@@ -2077,8 +2349,10 @@ void ControlScreen::showDrawSlide()
     // drawSlide is drawn on top of the notes widget. It should thus have the same geometry.
     if (drawSlideCache == nullptr) {
         drawSlideCache = new CacheMap(presentation, pagePart, this);
+        drawSlideCache->setCacheFormat(cacheFormat);
         connect(drawSlideCache, &CacheMap::cacheSizeChanged, this, &ControlScreen::updateCacheSize);
         connect(drawSlideCache, &CacheMap::cacheThreadFinished, this, &ControlScreen::cacheThreadFinished);
+        connect(drawSlideCache, &CacheMap::cacheMiss, this, &ControlScreen::receiveCacheMiss);
     }
     first_cached = currentPageNumber;
     last_cached = currentPageNumber-1;
@@ -2094,8 +2368,11 @@ void ControlScreen::showDrawSlide()
     if (std::abs(pressize.width()*notessize.height() - pressize.height()*notessize.width()) > 1e-2) {
         if (previewCacheX == nullptr) {
             previewCacheX = new CacheMap(presentation, pagePart, this);
+            previewCacheX->setCacheFormat(cacheFormat);
+            previewCacheX->setLossyQuality(previewQuality);
             connect(previewCacheX, &CacheMap::cacheSizeChanged, this, &ControlScreen::updateCacheSize);
             connect(previewCacheX, &CacheMap::cacheThreadFinished, this, &ControlScreen::cacheThreadFinished);
+            connect(previewCacheX, &CacheMap::cacheMiss, this, &ControlScreen::receiveCacheMiss);
         }
         ui->current_slide->overwriteCacheMap(previewCacheX);
         ui->next_slide->overwriteCacheMap(previewCacheX);
@@ -2110,18 +2387,21 @@ void ControlScreen::showDrawSlide()
     ui->notes_widget->hide();
     drawSlide->show();
     drawSlide->setFocus();
-    // Get offset and resolution of presentation screen.
-    // This is needed to show existing drawings from the presentation screen on drawSlide.
-    qint16 const sx=presentationScreen->slide->getXshift(), sy=presentationScreen->slide->getYshift();
+    // Get resolution of presentation screen.
+    // This is needed to adapt the eraser size on drawSlide.
     qreal const res = presentationScreen->slide->getResolution();
     /// Relative size of the draw slide compared to the presentation slide.
     qreal const scale = drawSlide->getResolution() / res;
     // Set eraser size on the draw slide.
     drawSlide->getPathOverlay()->setEraserSize(scale*presentationScreen->slide->getPathOverlay()->getEraserSize());
+    drawSlide->getPathOverlay()->setStrokeSimplification(presentationScreen->slide->getPathOverlay()->getStrokeTolerance(), presentationScreen->slide->getPathOverlay()->getStrokeSmoothing());
+    drawSlide->getPathOverlay()->setStrokePrediction(presentationScreen->slide->getPathOverlay()->getStrokePrediction());
+    drawSlide->getPathOverlay()->setLatencyLog(presentationScreen->slide->getPathOverlay()->hasLatencyLog());
     // Get the current page label.
     QString const label = presentationScreen->slide->getPage()->label();
     // Load existing drawings from the presentation screen for the current page on drawSlide.
-    drawSlide->getPathOverlay()->setPaths(label, presentationScreen->slide->getPathOverlay()->getPaths()[label], sx, sy, res);
+    presentationScreen->slide->getPathOverlay()->loadPage(label);
+    drawSlide->getPathOverlay()->setPaths(label, presentationScreen->slide->getPathOverlay()->getPaths()[label]);
     // Show the changed drawings.
     drawSlide->update();
     // Render the current page on drawSlide. This also adapts the current and next slide previews to previews of the next two slides.
@@ -23,7 +23,9 @@
 #include <QFileDialog>
 #include <QLabel>
 #include <QApplication>
+#include <QSet>
 #include "../pdf/pdfdoc.h"
+#include "../pdf/renderprofiler.h"
 #include "../gui/timer.h"
 #include "../gui/pagenumberedit.h"
 #include "presentationscreen.h"
@@ -79,6 +81,10 @@ public:
     /// Set maximum memory used for cached pages (in bytes).
     /// A negative number is interpreted as infinity.
     void setCacheSize(qint64 const size);
+    /// Set storage format of cached pages.
+    void setCacheFormat(CacheFormat const format);
+    /// Set JPEG quality (0 to 100) of cached preview slides. A negative number disables lossy storage.
+    void setPreviewQuality(int const quality);
     /// Set maximum level of sections / subsections shown in the table of contents.
     void setTocLevel(quint8 const level);
     void setOverviewColumns(quint8 const columns) {if (overviewBox != nullptr) overviewBox->setColumns(columns);}
@@ -101,7 +107,9 @@ public:
     Timer* getTimer() {return ui->label_timer;}
 
     /// Load drawings from file (used only from main.cpp)
-    void loadXML(QString const& filename) {presentationScreen->slide->getPathOverlay()->loadXML(filename, notes);}
+    void loadDrawings(QString const& filename) {presentationScreen->slide->getPathOverlay()->loadDrawings(filename, notes);}
+    /// Save drawings automatically to filename and a journal (used only from main.cpp)
+    void openJournal(QString const& filename, int const interval) {presentationScreen->slide->getPathOverlay()->openJournal(filename, notes, interval);}
 
     // Show or hide different widgets on the notes area.
     // This activates different modes: drawing, TOC, and overview mode.
@@ -188,6 +196,10 @@ private:
     CacheMap* previewCacheX = nullptr;
     /// Cached draw slide.
     CacheMap* drawSlideCache = nullptr;
+    /// Storage format of cached pages.
+    CacheFormat cacheFormat = CacheReduced;
+    /// JPEG quality of cached preview slides. Negative values disable lossy storage.
+    int previewQuality = -1;
 
     /// Maximum relative width of the notes slide.
     /// This equals one minus minimum width of the side bar.
@@ -224,10 +236,50 @@ private:
     int last_cached = -1;
     /// Memory used by cache in bytes.
     qint64 cacheSize = 0;
+    /// Poll interval (in ms) of cacheTimer while a slide transition is shown.
+    /// No new pages are rendered to cache during transitions.
+    int cachePauseInterval = 20;
+    /// Interval (in ms) between rendering two pages to cache while multimedia content is playing.
+    int cacheThrottleInterval = 250;
+    /// Pages which must be rendered to all caches before any other page after a page change:
+    /// the next page and the first page of the next slide (skipping overlays).
+    QList<int> deadlinePages;
+    /// Number of page changes for which a page in deadlinePages was not cached in time.
+    int deadlineMisses = 0;
+    /// Set deadlinePages relative to the current page of the presentation.
+    void updateDeadline();
+    /// Check whether a page is contained in all caches filled by cachePage.
+    bool isFullyCached(int const page) const;
+    /// Background thread measuring the render cost of all presentation pages.
+    RenderProfiler* renderProfiler = nullptr;
+    /// Expensive pages are rendered to cache up to this number of pages ahead of the current page.
+    int expensiveLookahead = 20;
+    /// Expensive pages which have been rendered to cache ahead of the regular cache region since the last page change.
+    /// Pages which still are not cached (e.g. because rendering failed) are not tried again.
+    QSet<int> triedExpensivePages;
+    /// Return an expensive page within expensiveLookahead, which should be rendered to cache now, or -1.
+    int nextExpensivePage() const;
+    /// Targets of top-level TOC entries. These are only calculated once per document.
+    QList<int> tocTargets;
+    /// True if tocTargets is up to date.
+    bool tocTargetsValid = false;
+    /// Link targets of the current and next page and targets of top-level TOC entries.
+    /// These pages are rendered to cache with low priority, because navigating to them should be fast.
+    QList<int> prefetchPages;
+    /// Set prefetchPages relative to the current page of the presentation.
+    void updatePrefetchPages();
+    /// Render the next page in prefetchPages to cache if there is free space.
+    /// This is only done when the regular cache region is complete. Return false if no page was rendered.
+    bool cachePrefetchPage();
+    /// Check whether background work should yield to the foreground and adapt cacheTimer.
+    /// Return true if no page should be rendered to cache in this step.
+    bool yieldCacheStep();
 
 private slots:
     /// Select a page which should be rendered to cache and free cache space if necessary.
     void updateCacheStep();
+    /// Show progress of saving drawings in a separate thread in the window title.
+    void showExportProgress(QString const filename, int const percent);
 
 public slots:
     // TODO: Some of these functions are not used as slots. Tidy up!
@@ -262,6 +314,8 @@ public slots:
     void updateCacheSize(qint64 const diff) {cacheSize += diff;}
     /// Check whether cache threads finished.
     void cacheThreadFinished();
+    /// Record a page which had to be rendered in the main thread. This is a deadline miss if the page is in deadlinePages.
+    void receiveCacheMiss(int const page);
     /// Send draw tool from tool selector to draw slide and presentation.
     void distributeTools(FullDrawTool const& tool);
     void distributeStylusTools(FullDrawTool const& tool);
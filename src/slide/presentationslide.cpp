@@ -130,7 +130,7 @@ void PresentationSlide::updateImages(int const oldPage)
         }
         painter.setRenderHint(QPainter::Antialiasing);
         painter.drawPixmap(shiftx, shifty, getPixmap(oldPage));
-        pathOverlay->drawPaths(painter, doc->getLabel(oldPage), QRegion(rect()), true, false);
+        pathOverlay->drawPaths(painter, doc->getLabel(oldPage), QRegion(rect()), true);
     }
     {
         picfinal = QPixmap(size());
@@ -146,9 +146,7 @@ void PresentationSlide::updateImages(int const oldPage)
         }
         painter.setRenderHint(QPainter::Antialiasing);
         painter.drawPixmap(shiftx, shifty, pixmap);
-        if (pathOverlay->end_cache >= 0)
-            painter.drawPixmap(0, 0, pathOverlay->pixpaths);
-        pathOverlay->drawPaths(painter, page->label(), QRegion(rect()), false, false);
+        pathOverlay->drawPaths(painter, page->label(), QRegion(rect()));
     }
 }
 